@@ -0,0 +1,434 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libchippy/chippy.h"
+#include "chippy/clock.h"
+#include "chippy/gfx.h"
+
+/**
+ * The default number of cycles each workload runs for, per engine.
+ */
+#define DEFAULT_CYCLES 20000000UL
+
+/**
+ * The default number of frames rendered to measure gfx_render().
+ */
+#define DEFAULT_FRAMES 2000UL
+
+/**
+ * A synthetic workload: setup code, and a loop body that exercises one class
+ * of opcodes, followed by a jump back to the start of the body. Bodies are at
+ * least 8 instructions, so the jump is a small share of the cycles.
+ */
+struct workload {
+    const char *name;
+    const uint16_t *setup;              // Executed once, before the loop
+    size_t setup_length;
+    const uint16_t *body;               // Executed in a loop
+    size_t body_length;
+};
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+static const uint16_t alu_setup[] = { 0x6003, 0x6105, 0x6207 };
+static const uint16_t alu_body[] = {
+    0x8014, 0x8125, 0x7301, 0x8236, 0x840E, 0x8AB3, 0x6C12, 0x8DC2,
+    0x8017, 0x8121, 0x7255, 0x8344, 0x8456, 0x8565, 0x867E, 0x8702,
+    0x8014, 0x8125, 0x7301, 0x8236, 0x840E, 0x8AB3, 0x6C12, 0x8DC2,
+    0x8017, 0x8121, 0x7255, 0x8344, 0x8456, 0x8565, 0x867E
+};
+
+static const uint16_t branch_setup[] = { 0x6001, 0x6102 };
+static const uint16_t branch_body[] = {
+    0x3001, 0x0000, 0x4001, 0x5010, 0x0000, 0x9010, 0x0000, 0x3002,
+    0x3101, 0x4102, 0x5000, 0x0000, 0x9000, 0x3001, 0x0000, 0x4001,
+    0x5010, 0x0000, 0x9010, 0x0000, 0x3002, 0x3101, 0x4102, 0x5000
+};
+
+/**
+ * The loop at 0x208 calls the function at 0x202, which calls itself until V0
+ * is counted down from 14 to 0, and then returns all the way up.
+ */
+static const uint16_t call_program[] = {
+    0x1208, 0x3000, 0x1210, 0x00EE, 0x600E, 0x2202, 0x1208, 0x0000,
+    0x70FF, 0x2202, 0x00EE
+};
+
+static const uint16_t draw_setup[] = { 0x6000, 0x6100, 0xA000 };
+static const uint16_t draw_body[] = {
+    0xD015, 0x7007, 0xD015, 0x7105, 0xD01F, 0x7009, 0xD015, 0x7103,
+    0xD01A, 0x700B, 0xD015, 0x7101, 0xD015, 0x7005, 0xD018, 0x7102
+};
+
+/**
+ * The draw workload on a 128x64 display with both bitplanes selected, mixing
+ * 16x16 sprites in.
+ */
+static const uint16_t draw_hires_setup[] = { 0x00FF, 0xF301, 0x6000, 0x6100, 0xA000 };
+static const uint16_t draw_hires_body[] = {
+    0xD015, 0x7007, 0xD010, 0x7105, 0xD01F, 0x7009, 0xD010, 0x7103,
+    0xD01A, 0x700B, 0xD010, 0x7101, 0xD015, 0x7005, 0xD018, 0x7102
+};
+
+static const uint16_t memory_body[] = {
+    0xA300, 0xFF55, 0xA310, 0xFF65, 0xA320, 0xF755, 0xA300, 0xFF65,
+    0xA330, 0xFF55, 0xA340, 0xF365, 0xA310, 0xFF55, 0xA320, 0xFF65
+};
+
+static const uint16_t timer_body[] = {
+    0xF015, 0xF107, 0xF218, 0xF307, 0xF015, 0xF407, 0xF518, 0xF607
+};
+
+static const uint16_t random_body[] = {
+    0xC0FF, 0xC10F, 0xC2F0, 0xC3FF, 0xC4AA, 0xC555, 0xC6FF, 0xC701
+};
+
+static const struct workload workloads[] = {
+    { "alu",    alu_setup,    COUNT(alu_setup),    alu_body,    COUNT(alu_body)    },
+    { "branch", branch_setup, COUNT(branch_setup), branch_body, COUNT(branch_body) },
+    { "call",   call_program, COUNT(call_program), NULL,        0                  },
+    { "draw",   draw_setup,   COUNT(draw_setup),   draw_body,   COUNT(draw_body)   },
+    { "draw_hires", draw_hires_setup, COUNT(draw_hires_setup), draw_hires_body, COUNT(draw_hires_body) },
+    { "memory", NULL,         0,                   memory_body, COUNT(memory_body) },
+    { "timer",  NULL,         0,                   timer_body,  COUNT(timer_body)  },
+    { "random", NULL,         0,                   random_body, COUNT(random_body) }
+};
+
+static const struct {
+    enum chippy_engine engine;
+    const char *name;
+} engines[] = {
+    { CHIPPY_ENGINE_INTERPRETER, "interpreter" },
+    { CHIPPY_ENGINE_JIT,         "jit"         }
+};
+
+static unsigned long cycles = DEFAULT_CYCLES;
+static unsigned long frames = DEFAULT_FRAMES;
+static int render = 1;
+
+static struct option long_options[] = {
+    { "help",      no_argument,       0,       'h' },
+    { "version",   no_argument,       0,       'v' },
+    { "cycles",    required_argument, 0,       'c' },
+    { "frames",    required_argument, 0,       'f' },
+    { "no-render", no_argument,       &render,  0  },
+    { "output",    required_argument, 0,       'o' },
+    { 0, 0, 0, 0 }
+};
+
+static void display_help(const char *program) {
+    printf("Usage: %s [options] [file...]\n"
+           "\n"
+           "Runs the built-in synthetic workloads and the given ROMs on every\n"
+           "engine, measures gfx_render() without a display, and writes the\n"
+           "results as JSON.\n"
+           "\n"
+           "Options:\n"
+           " -h, --help         Display this information.\n"
+           " -v, --version      Display version information.\n"
+           " -c, --cycles N     Run every workload for N cycles (default %lu).\n"
+           " -f, --frames N     Render N frames (default %lu).\n"
+           "     --no-render    Do not measure rendering.\n"
+           " -o, --output FILE  Write the results to FILE (default stdout).\n"
+           "\n"
+           "For bug reports, please see <%s>.\n", program, DEFAULT_CYCLES, DEFAULT_FRAMES, PACKAGE_BUGREPORT);
+}
+
+static void display_version(void) {
+    printf("%s-bench %s\nCopyright (c) 2017, Jacob van Eijk\n",
+        PACKAGE_NAME,
+        PACKAGE_VERSION);
+}
+
+/**
+ * Writes a list of opcodes into memory.
+ *
+ * @return Returns the address after the last opcode.
+ */
+static uint16_t assemble(struct chippy *machine, uint16_t address, const uint16_t *opcodes, size_t length) {
+    for (size_t i = 0; i < length; i++, address += 2) {
+        machine->ram[address] = opcodes[i] >> 8;
+        machine->ram[address + 1] = opcodes[i] & 0xFF;
+    }
+
+    return address;
+}
+
+static void load_workload(struct chippy *machine, const struct workload *workload) {
+    uint16_t body = assemble(machine, PROGRAM_START, workload->setup, workload->setup_length);
+
+    if (workload->body != NULL) {
+        uint16_t jump = 0x1000 | body;
+
+        assemble(machine, assemble(machine, body, workload->body, workload->body_length), &jump, 1);
+    }
+
+    chippy_invalidate(machine, PROGRAM_START, RAM_SIZE - PROGRAM_START);
+}
+
+static void write_result(FILE *out, int *first, const char *name, const char *engine, uint64_t elapsed) {
+    double seconds = (double)elapsed / CLOCK_NS_PER_SEC;
+
+    fprintf(out, "%s\n    {\"name\":\"%s\",\"engine\":\"%s\",\"cycles\":%lu,\"seconds\":%.6f,"
+                 "\"ips\":%.0f,\"ns_per_op\":%.3f}",
+        *first ? "" : ",",
+        name,
+        engine,
+        cycles,
+        seconds,
+        cycles / seconds,
+        (double)elapsed / cycles);
+
+    *first = 0;
+}
+
+/**
+ * Runs a loaded machine for the configured number of cycles.
+ *
+ * @return Returns the elapsed time in nanoseconds.
+ */
+static uint64_t measure(struct chippy *machine, enum chippy_engine engine) {
+    machine->engine = engine;
+
+    // Skipping idle loops would measure how fast nothing is done.
+    machine->skip_idle = 0;
+
+    // Warm up the caches and the JIT before measuring.
+    chippy_run_cycles(machine, cycles / 100 + 1);
+
+    uint64_t start = clock_now();
+
+    chippy_run_cycles(machine, cycles);
+
+    return clock_now() - start;
+}
+
+/**
+ * Loads every ROM once, so that a ROM that cannot be loaded is reported before
+ * any results are written.
+ *
+ * @return Returns 0 when every ROM could be loaded, otherwise 1.
+ */
+static int check_roms(char **roms, int rom_count) {
+    struct chippy *machine = malloc(sizeof(struct chippy));
+    int result = EXIT_SUCCESS;
+
+    chippy_init(machine);
+
+    for (int i = 0; i < rom_count; i++) {
+        int error = chippy_load_rom(machine, roms[i]);
+
+        if (error != 0) {
+            fprintf(stderr, "%s: %s\n", roms[i], chippy_rom_error_string(error));
+            result = EXIT_FAILURE;
+        }
+    }
+
+    chippy_destroy(machine);
+
+    return result;
+}
+
+/**
+ * Runs every workload and ROM on every engine, each on a new machine.
+ *
+ * @return Returns 0 on success, or 1 when a ROM could not be loaded. The
+ *         results written so far are closed off either way.
+ */
+static int bench_workloads(FILE *out, char **roms, int rom_count) {
+    size_t workload_count = sizeof(workloads) / sizeof(workloads[0]);
+    int result = EXIT_SUCCESS;
+    int first = 1;
+
+    fprintf(out, "  \"workloads\": [");
+
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]) && result == EXIT_SUCCESS; e++) {
+        for (size_t w = 0; w < workload_count + rom_count && result == EXIT_SUCCESS; w++) {
+            struct chippy *machine = malloc(sizeof(struct chippy));
+            const char *name;
+
+            chippy_init(machine);
+
+            if (w < workload_count) {
+                name = workloads[w].name;
+                load_workload(machine, &workloads[w]);
+            } else {
+                const char *rom = roms[w - workload_count];
+                int error = chippy_load_rom(machine, rom);
+
+                if (error != 0) {
+                    fprintf(stderr, "%s: %s\n", rom, chippy_rom_error_string(error));
+                    chippy_destroy(machine);
+                    result = EXIT_FAILURE;
+                    break;
+                }
+
+                name = strrchr(rom, '/') != NULL ? strrchr(rom, '/') + 1 : rom;
+            }
+
+            write_result(out, &first, name, engines[e].name, measure(machine, engines[e].engine));
+
+            chippy_destroy(machine);
+        }
+    }
+
+    fprintf(out, "\n  ]");
+
+    return result;
+}
+
+/**
+ * Renders frames that alternate between two screens through the SDL frontend,
+ * so that every frame uploads the whole texture. In high resolution both
+ * bitplanes are filled, so every pixel takes one of four colours. Unless
+ * changing, every frame shows the same screen, which is how most frames of
+ * most programs look. With a filter, the screen is scaled on the CPU to a
+ * window of the given scale.
+ */
+static void bench_render_mode(FILE *out, const char *name, int hires, int changing, int scale, enum scale_filter filter) {
+    fprintf(out, ",\n  \"%s\": ", name);
+
+    if (gfx_init(scale, filter) != 0) {
+        fprintf(out, "{\"error\":\"could not initialize graphics\"}");
+        return;
+    }
+
+    struct chippy *machine = malloc(sizeof(struct chippy));
+
+    chippy_init(machine);
+    machine->hires = hires;
+
+    for (int plane = 0; plane < (hires ? GFX_PLANES : 1); plane++) {
+        for (int y = 0; y < chippy_screen_height(machine); y++) {
+            for (int word = 0; word < chippy_screen_width(machine) / 64; word++) {
+                machine->gfx[plane][y][word] = (y + plane) % 2 == 0
+                    ? UINT64_C(0xAAAAAAAAAAAAAAAA)
+                    : UINT64_C(0x5555555555555555);
+            }
+        }
+    }
+
+    uint64_t start = clock_now();
+
+    for (unsigned long frame = 0; frame < frames; frame++) {
+        for (int plane = 0; changing && plane < (hires ? GFX_PLANES : 1); plane++) {
+            for (int y = 0; y < chippy_screen_height(machine); y++) {
+                for (int word = 0; word < chippy_screen_width(machine) / 64; word++) {
+                    machine->gfx[plane][y][word] = ~machine->gfx[plane][y][word];
+                }
+            }
+        }
+
+        if (changing) {
+            chippy_invalidate_gfx(machine, GFX_ALL_ROWS);
+        }
+
+        gfx_render(machine);
+    }
+
+    uint64_t elapsed = clock_now() - start;
+
+    fprintf(out, "{\"frames\":%lu,\"seconds\":%.6f,\"fps\":%.1f}",
+        frames,
+        (double)elapsed / CLOCK_NS_PER_SEC,
+        frames * (double)CLOCK_NS_PER_SEC / elapsed);
+
+    chippy_destroy(machine);
+    gfx_destroy();
+}
+
+static void bench_render(FILE *out) {
+    bench_render_mode(out, "render", 0, 1, 1, SCALE_NONE);
+    bench_render_mode(out, "render_hires", 1, 1, 1, SCALE_NONE);
+    bench_render_mode(out, "render_static", 0, 0, 1, SCALE_NONE);
+    bench_render_mode(out, "render_nearest", 1, 1, 2, SCALE_NEAREST);
+    bench_render_mode(out, "render_scale2x", 1, 1, 2, SCALE_2X);
+    bench_render_mode(out, "render_scale3x", 1, 1, 2, SCALE_3X);
+    bench_render_mode(out, "render_scale4x", 1, 1, 2, SCALE_4X);
+    bench_render_mode(out, "render_crt", 1, 1, 2, SCALE_CRT);
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, "hvc:f:o:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'h':
+                display_help(argv[0]);
+                return EXIT_SUCCESS;
+
+            case 'v':
+                display_version();
+                return EXIT_SUCCESS;
+
+            case 'c':
+                cycles = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'f':
+                frames = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            case 0:
+                break;
+
+            default:
+                display_help(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (cycles == 0 || frames == 0) {
+        display_help(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (check_roms(argv + optind, argc - optind) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    // Rendering is measured without a display, unless a video driver was
+    // chosen explicitly.
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+
+    FILE *out = output != NULL ? fopen(output, "w") : stdout;
+
+    if (out == NULL) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "{\n  \"version\": \"%s\",\n", PACKAGE_VERSION);
+
+    int result = bench_workloads(out, argv + optind, argc - optind);
+
+    if (result == EXIT_SUCCESS && render) {
+        bench_render(out);
+    }
+
+    fprintf(out, "\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return result;
+}
@@ -0,0 +1,179 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+/*
+ * An in-process fuzzing harness. Every input is a ROM, run for a few seconds of
+ * emulated time on a machine that is set up only once. Between inputs, the
+ * machine is restored from a snapshot of its initial state, which only copies
+ * back the memory pages that the previous input wrote.
+ *
+ * Built with -Dlibfuzzer=true, the harness only provides the libFuzzer entry
+ * point. Otherwise it has its own main(), which runs the files it is given, or
+ * reads inputs from stdin in a loop when built with afl-clang-fast.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libchippy/chippy.h"
+
+/**
+ * The number of timer ticks an input runs for.
+ */
+#define FUZZ_TICKS 120
+
+/**
+ * The size of the header that precedes the ROM in an input.
+ */
+#define FUZZ_HEADER 3
+
+/**
+ * The bits of the first byte of an input.
+ */
+#define FUZZ_JIT       0x01             // Run on the JIT compiler instead of the interpreter
+#define FUZZ_SKIP_IDLE 0x02             // Skip idle loops
+
+/**
+ * The largest input that is read from a file or stdin.
+ */
+#define FUZZ_MAX_INPUT (FUZZ_HEADER + MAX_ROM_SIZE)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static struct chippy machine;
+static struct chippy_snapshot initial;
+static int initialized = 0;
+
+/**
+ * Runs one input. The first byte selects the engine, the next two bytes are
+ * the keys that are held on every other tick, and the rest is the ROM. Keys are
+ * released in between, so that FX0A sees them pressed.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (!initialized) {
+        chippy_init(&machine);
+        chippy_snapshot(&machine, &initial);
+        initialized = 1;
+    }
+
+    if (size <= FUZZ_HEADER) {
+        return 0;
+    }
+
+    uint8_t flags = data[0];
+    uint16_t keys = data[1] | data[2] << 8;
+    size_t rom_size = size - FUZZ_HEADER;
+
+    if (rom_size > MAX_ROM_SIZE) {
+        rom_size = MAX_ROM_SIZE;
+    }
+
+    // Loading marks the pages of the ROM as written, so that the restore below
+    // copies them back along with everything the ROM wrote itself.
+    memcpy(machine.ram + PROGRAM_START, data + FUZZ_HEADER, rom_size);
+    chippy_invalidate(&machine, PROGRAM_START, rom_size);
+
+    machine.engine = flags & FUZZ_JIT ? CHIPPY_ENGINE_JIT : CHIPPY_ENGINE_INTERPRETER;
+    machine.skip_idle = (flags & FUZZ_SKIP_IDLE) != 0;
+
+    for (int tick = 0; tick < FUZZ_TICKS; tick++) {
+        machine.keys = tick % 2 == 0 ? keys : 0;
+
+        // The ROM may change the speed, so the budget is the default one. A
+        // run cannot fail, so every input runs for all of its ticks.
+        chippy_run_cycles(&machine, DEFAULT_CYCLES_PER_TICK);
+    }
+
+    chippy_restore(&machine, &initial);
+
+    return 0;
+}
+
+#if !defined(CHIPPY_LIBFUZZER)
+
+/**
+ * Reads a whole input from a stream, truncated to FUZZ_MAX_INPUT bytes.
+ */
+static size_t read_input(FILE *f, uint8_t *data) {
+    return fread(data, 1, FUZZ_MAX_INPUT, f);
+}
+
+/**
+ * Returns the time in seconds from an arbitrary point.
+ */
+static double seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t data[FUZZ_MAX_INPUT];
+    unsigned long repeat = 1;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "--repeat") == 0) {
+        repeat = strtoul(argv[2], NULL, 10);
+        first = 3;
+    }
+
+    if (first == argc) {
+#if defined(__AFL_HAVE_MANUAL_CONTROL)
+        __AFL_INIT();
+#endif
+
+#if defined(__AFL_LOOP)
+        while (__AFL_LOOP(10000)) {
+            LLVMFuzzerTestOneInput(data, read_input(stdin, data));
+        }
+#else
+        LLVMFuzzerTestOneInput(data, read_input(stdin, data));
+#endif
+
+        return EXIT_SUCCESS;
+    }
+
+    // Inputs given as files are run one after the other, which reproduces a
+    // crash found by a fuzzer, or with --repeat measures the executions per
+    // second.
+    for (int i = first; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+
+        if (f == NULL) {
+            fprintf(stderr, "Could not open %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+
+        size_t size = read_input(f, data);
+
+        fclose(f);
+
+        double start = seconds();
+
+        for (unsigned long n = 0; n < repeat; n++) {
+            LLVMFuzzerTestOneInput(data, size);
+        }
+
+        if (repeat > 1) {
+            fprintf(stderr, "%s: %.0f exec/s\n", argv[i], repeat / (seconds() - start));
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#endif
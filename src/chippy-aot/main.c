@@ -0,0 +1,806 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libchippy/chippy.h"
+#include "libchippy/ops.h"
+
+/**
+ * The ROM being translated, as it is loaded at PROGRAM_START.
+ */
+static uint8_t rom[MAX_ROM_SIZE];
+static size_t rom_size = 0;
+
+/**
+ * What is known about every address. Instructions may overlap, so every
+ * address is looked at separately.
+ */
+static uint8_t visited[RAM_SIZE];       // An instruction that is translated starts here
+static uint8_t leader[RAM_SIZE];        // A block starts here
+static uint8_t code[RAM_SIZE];          // Part of an instruction that is translated
+
+/**
+ * The addresses still to be scanned.
+ */
+static uint16_t worklist[RAM_SIZE];
+static size_t worklist_size = 0;
+
+static FILE *out = NULL;
+
+static struct option long_options[] = {
+    { "help",    no_argument,       0, 'h' },
+    { "version", no_argument,       0, 'v' },
+    { "output",  required_argument, 0, 'o' },
+    { 0, 0, 0, 0 }
+};
+
+static void display_help(const char *program) {
+    printf("Usage: %s [options] file\n"
+           "\n"
+           "Translates a ROM ahead of time into a C program that runs it without\n"
+           "an interpreter. The program links against libchippy, which runs what\n"
+           "could not be translated: indirect jumps, code outside the ROM, and\n"
+           "code that the ROM overwrites.\n"
+           "\n"
+           "Options:\n"
+           " -h, --help         Display this information.\n"
+           " -v, --version      Display version information.\n"
+           " -o, --output FILE  Write the program to FILE (default stdout).\n"
+           "\n"
+           "For bug reports, please see <%s>.\n", program, PACKAGE_BUGREPORT);
+}
+
+static void display_version(void) {
+    printf("%s-aot %s\nCopyright (c) 2017, Jacob van Eijk\n",
+        PACKAGE_NAME,
+        PACKAGE_VERSION);
+}
+
+static void emit(const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(out, format, args);
+    va_end(args);
+}
+
+/**
+ * Returns whether the given number of bytes at the address are part of the
+ * ROM, and so known ahead of time.
+ */
+static int in_rom(uint32_t address, uint32_t size) {
+    return address >= PROGRAM_START && address + size <= PROGRAM_START + rom_size;
+}
+
+static uint16_t opcode_at(uint32_t address) {
+    return rom[address - PROGRAM_START] << 8 | rom[address + 1 - PROGRAM_START];
+}
+
+/**
+ * Returns the size of the instruction at the given address, which is 4 for
+ * F000 NNNN and 2 otherwise.
+ */
+static uint32_t size_at(uint32_t address) {
+    return in_rom(address, 2) && opcode_at(address) == 0xF000 ? 4 : 2;
+}
+
+static void add_leader(uint32_t address) {
+    address &= RAM_SIZE - 1;
+
+    if (!leader[address]) {
+        leader[address] = 1;
+        worklist[worklist_size++] = address;
+    }
+}
+
+/**
+ * Returns whether an instruction ends a block, as it does not simply continue
+ * with the next one.
+ */
+static int is_terminator(uint8_t op) {
+    return op == OP_JP || op == OP_CALL || op == OP_RET || op == OP_JP_V0 || op == OP_EXIT
+        || op == OP_LD_X_K || ops_is_skip(op);
+}
+
+/**
+ * Finds every instruction that can be reached from the start of the ROM
+ * through jumps, calls, returns and skips, and the addresses that blocks start
+ * at. Returns from subroutines are assumed to return after their call.
+ */
+static void scan(void) {
+    add_leader(PROGRAM_START);
+
+    while (worklist_size > 0) {
+        uint32_t address = worklist[--worklist_size];
+
+        for (;;) {
+            uint32_t size = size_at(address);
+
+            if (!in_rom(address, size)) {
+                break;
+            }
+
+            // Another path already continued from here, which now joins.
+            if (visited[address]) {
+                add_leader(address);
+                break;
+            }
+
+            uint16_t opcode = opcode_at(address);
+            uint8_t op = chippy_decode_op(opcode);
+
+            visited[address] = 1;
+            memset(code + address, 1, size);
+
+            if (op == OP_JP || op == OP_CALL) {
+                add_leader(NNN(opcode));
+            }
+
+            if (op == OP_CALL || op == OP_LD_X_K) {
+                add_leader(address + 2);
+            }
+
+            if (ops_is_skip(op)) {
+                add_leader(address + 2);
+                add_leader(address + 2 + size_at(address + 2));
+            }
+
+            if (is_terminator(op)) {
+                break;
+            }
+
+            address += size;
+        }
+    }
+}
+
+/**
+ * Continues at the given address: directly in the block starting there when
+ * there is one, and through the dispatcher otherwise.
+ */
+static void emit_goto(uint32_t address, const char *indent) {
+    address &= RAM_SIZE - 1;
+
+    if (leader[address] && visited[address]) {
+        emit("%s    goto block_%04X;\n", indent, address);
+    } else {
+        emit("%s    machine->pc = 0x%04X;\n", indent, address);
+        emit("%s    goto dispatch;\n", indent);
+    }
+}
+
+/**
+ * Brings the cycle counter up to date with the instructions executed so far.
+ */
+static void emit_cycles(int *pending) {
+    if (*pending > 0) {
+        emit("    machine->cycles += %d;\n", *pending);
+        *pending = 0;
+    }
+}
+
+/**
+ * Executes one instruction in the interpreter.
+ */
+static void emit_step(uint32_t address, int *pending) {
+    emit_cycles(pending);
+    emit("    machine->pc = 0x%04X;\n", address);
+    emit("    chippy_step(machine);\n");
+}
+
+/**
+ * Emits the condition under which a skip instruction skips.
+ */
+static void emit_condition(uint8_t op, uint16_t opcode) {
+    int x = X(opcode);
+    int y = Y(opcode);
+
+    switch (op) {
+        case OP_SE_XKK:  emit("machine->V[%d] == 0x%02X", x, KK(opcode)); break;
+        case OP_SNE_XKK: emit("machine->V[%d] != 0x%02X", x, KK(opcode)); break;
+        case OP_SE_XY:   emit("machine->V[%d] == machine->V[%d]", x, y); break;
+        case OP_SNE_XY:  emit("machine->V[%d] != machine->V[%d]", x, y); break;
+        case OP_SKP:     emit("machine->keys & (1 << (machine->V[%d] & 0xF))", x); break;
+        case OP_SKNP:    emit("!(machine->keys & (1 << (machine->V[%d] & 0xF)))", x); break;
+    }
+}
+
+/**
+ * Emits an instruction that is neither a terminator nor run in the
+ * interpreter. Returns 0 for instructions that have no translation.
+ */
+static int emit_simple(uint8_t op, uint16_t opcode, uint32_t address, int *pending) {
+    int x = X(opcode);
+    int y = Y(opcode);
+
+    switch (op) {
+        case OP_NOP:
+            break;
+
+        case OP_CLS:
+            emit("    ops_clear(machine->gfx, machine->hires, machine->planes);\n");
+            emit("    chippy_invalidate_gfx(machine, GFX_ALL_ROWS);\n");
+            break;
+
+        case OP_LD_XKK:
+            emit("    machine->V[%d] = 0x%02X;\n", x, KK(opcode));
+            break;
+
+        case OP_ADD_XKK:
+            emit("    machine->V[%d] += 0x%02X;\n", x, KK(opcode));
+            break;
+
+        case OP_LD_XY:
+            emit("    machine->V[%d] = machine->V[%d];\n", x, y);
+            break;
+
+        case OP_OR:
+            emit("    machine->V[%d] |= machine->V[%d];\n", x, y);
+            break;
+
+        case OP_XOR:
+            emit("    machine->V[%d] ^= machine->V[%d];\n", x, y);
+            break;
+
+        // VF is set before VX, like in the interpreter, so that VF holds the
+        // result when it is VX.
+        case OP_ADD_XY:
+            emit("    machine->V[15] = (machine->V[%d] + machine->V[%d]) > 255;\n", x, y);
+            emit("    machine->V[%d] += machine->V[%d];\n", x, y);
+            break;
+
+        case OP_SUB:
+            emit("    machine->V[15] = machine->V[%d] > machine->V[%d];\n", x, y);
+            emit("    machine->V[%d] -= machine->V[%d];\n", x, y);
+            break;
+
+        case OP_SHR:
+            emit("    machine->V[15] = machine->V[%d] & 1;\n", x);
+            emit("    machine->V[%d] >>= 1;\n", x);
+            break;
+
+        case OP_SUBN:
+            emit("    machine->V[15] = machine->V[%d] > machine->V[%d];\n", y, x);
+            emit("    machine->V[%d] = machine->V[%d] - machine->V[%d];\n", x, y, x);
+            break;
+
+        case OP_SHL:
+            emit("    machine->V[15] = (machine->V[%d] & 0x80) != 0;\n", x);
+            emit("    machine->V[%d] <<= 1;\n", x);
+            break;
+
+        case OP_LD_I:
+            emit("    machine->I = 0x%03X;\n", NNN(opcode));
+            break;
+
+        case OP_RND:
+            emit("    machine->V[%d] = ops_random_byte(&machine->rng) & 0x%02X;\n", x, KK(opcode));
+            break;
+
+        case OP_DRW:
+            // VY can be VF, so the rows are marked before the collision flag
+            // is written.
+            emit("    chippy_invalidate_gfx(machine, ops_draw_rows(machine->hires, machine->V[%d], %d));\n", y, N(opcode));
+            emit("    machine->V[15] = ops_draw(machine->gfx, machine->hires, machine->planes, machine->ram, machine->I, machine->V[%d], machine->V[%d], %d);\n", x, y, N(opcode));
+            break;
+
+        // The timers are read and set at the cycle of the instruction.
+        case OP_LD_X_DT:
+            emit_cycles(pending);
+            emit("    machine->V[%d] = ops_timer_value(machine->dt, machine->dt_cycle, machine->cycles, machine->cycles_per_tick);\n", x);
+            break;
+
+        case OP_LD_DT_X:
+            emit_cycles(pending);
+            emit("    machine->dt = machine->V[%d];\n", x);
+            emit("    machine->dt_cycle = machine->cycles;\n");
+            break;
+
+        case OP_LD_ST_X:
+            emit_cycles(pending);
+            emit("    machine->st = machine->V[%d];\n", x);
+            emit("    machine->st_cycle = machine->cycles;\n");
+            break;
+
+        case OP_ADD_I:
+            emit("    machine->I += machine->V[%d];\n", x);
+            break;
+
+        case OP_LD_F:
+            emit("    machine->I = machine->V[%d] * 5;\n", x);
+            break;
+
+        case OP_LD_X_MEM:
+            for (int i = 0; i <= x; i++) {
+                emit("    machine->V[%d] = machine->ram[(machine->I + %d) & (RAM_SIZE - 1)];\n", i, i);
+            }
+            break;
+
+        case OP_LD_I_LONG:
+            emit("    machine->I = 0x%04X;\n", opcode_at(address + 2));
+            break;
+
+        case OP_PLANE:
+            emit("    machine->planes = %d;\n", x & 0x3);
+            break;
+
+        case OP_LD_HF:
+            emit("    machine->I = BIG_FONT_ADDRESS + (machine->V[%d] & 0xF) * 10;\n", x);
+            break;
+
+        case OP_PITCH:
+            emit("    machine->pitch = machine->V[%d];\n", x);
+            break;
+
+        default:
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Emits the block that starts at the given address. A block runs up to and
+ * including its first terminator, or up to the start of the next block.
+ */
+static void emit_block(uint32_t start) {
+    uint32_t end = start;
+    uint32_t checked;
+    uint8_t op;
+    int count = 0;
+    int index = 0;
+    int pending = 0;
+
+    // Finds the end of the block first, as the block checks its length and
+    // whether its code was overwritten before it runs.
+    for (;;) {
+        op = chippy_decode_op(opcode_at(end));
+
+        end += size_at(end);
+        count++;
+
+        if (is_terminator(op) || !visited[end & (RAM_SIZE - 1)] || leader[end & (RAM_SIZE - 1)]) {
+            break;
+        }
+    }
+
+    // A skip also depends on the size of the instruction after it.
+    checked = ops_is_skip(op) ? end + 2 : end;
+
+    emit("\nblock_%04X:\n", start);
+    emit("    if (remaining < %d", count);
+
+    for (uint32_t page = start / RAM_PAGE_SIZE; page <= (checked - 1) / RAM_PAGE_SIZE; page++) {
+        emit(" || stale[%u]", (unsigned)(page % RAM_PAGES));
+    }
+
+    emit(") {\n");
+    emit("        machine->pc = 0x%04X;\n", start);
+    emit("        goto slow;\n");
+    emit("    }\n\n");
+    emit("    remaining -= %d;\n\n", count);
+
+    for (uint32_t address = start; address < end; address += size_at(address), index++) {
+        uint16_t opcode = opcode_at(address);
+        uint32_t next = address + size_at(address);
+
+        op = chippy_decode_op(opcode);
+
+        emit("    // %04X: %04X\n", address, opcode);
+
+        switch (op) {
+            case OP_JP:
+                pending++;
+                emit_cycles(&pending);
+                emit_goto(NNN(opcode), "");
+                return;
+
+            case OP_CALL:
+                pending++;
+                emit_cycles(&pending);
+                emit("    machine->stack[machine->sp++ & 0xF] = 0x%04X;\n", next);
+                emit_goto(NNN(opcode), "");
+                return;
+
+            case OP_RET:
+                pending++;
+                emit_cycles(&pending);
+                emit("    machine->pc = machine->stack[--machine->sp & 0xF];\n");
+                emit("    goto dispatch;\n");
+                return;
+
+            case OP_JP_V0:
+                emit_step(address, &pending);
+                emit("    goto dispatch;\n");
+                return;
+
+            // The instruction repeats itself for all remaining cycles.
+            case OP_EXIT:
+                emit_cycles(&pending);
+                emit("    machine->pc = 0x%04X;\n", address);
+                emit("    machine->cycles += remaining + 1;\n");
+                emit("    return EXIT_SUCCESS;\n");
+                return;
+
+            // The remaining cycles are spent waiting.
+            case OP_LD_X_K:
+                emit_step(address, &pending);
+                emit("    if (machine->wait_key != -1) {\n");
+                emit("        machine->cycles += remaining;\n");
+                emit("        return CHIPPY_WAITING;\n");
+                emit("    }\n");
+                emit_goto(next, "");
+                return;
+
+            default:
+                break;
+        }
+
+        if (ops_is_skip(op)) {
+            pending++;
+            emit_cycles(&pending);
+            emit("    if (");
+            emit_condition(op, opcode);
+            emit(") {\n");
+            emit_goto(next + size_at(next), "    ");
+            emit("    }\n");
+            emit_goto(next, "");
+            return;
+        }
+
+        if (emit_simple(op, opcode, address, &pending)) {
+            pending++;
+            continue;
+        }
+
+        emit_step(address, &pending);
+
+        // Code that was overwritten from here on is run in the interpreter.
+        if (ops_store_size(op, opcode) != 0) {
+            emit("    if (chippy_aot_invalidate(machine, machine->I, %u)) {\n", ops_store_size(op, opcode));
+            emit("        remaining += %d;\n", count - index - 1);
+            emit("        machine->pc = 0x%04X;\n", next & (RAM_SIZE - 1));
+            emit("        goto dispatch;\n");
+            emit("    }\n");
+        }
+    }
+
+    emit_cycles(&pending);
+    emit_goto(end, "");
+}
+
+/**
+ * Emits the state that is shared by the translated code and the main program:
+ * the ROM, the bytes of it that were translated, and the pages of which the
+ * code was overwritten.
+ */
+static void emit_data(void) {
+    emit("/**\n * The ROM, as it is loaded at PROGRAM_START.\n */\n");
+    emit("static const uint8_t rom[%zu] = {", rom_size);
+
+    for (size_t i = 0; i < rom_size; i++) {
+        emit("%s0x%02X,", i % 12 == 0 ? "\n    " : " ", rom[i]);
+    }
+
+    emit("\n};\n\n");
+
+    emit("/**\n * The bytes of the ROM that were translated, one bit per byte.\n */\n");
+    emit("static const uint8_t translated[%zu] = {", (rom_size + 7) / 8);
+
+    for (size_t i = 0; i < (rom_size + 7) / 8; i++) {
+        uint8_t bits = 0;
+
+        for (size_t bit = 0; bit < 8 && i * 8 + bit < rom_size; bit++) {
+            bits |= code[PROGRAM_START + i * 8 + bit] << bit;
+        }
+
+        emit("%s0x%02X,", i % 12 == 0 ? "\n    " : " ", bits);
+    }
+
+    emit("\n};\n\n");
+
+    emit("/**\n"
+         " * The pages of which translated code was overwritten, and no longer\n"
+         " * matches the ROM. Their blocks are run in the interpreter instead.\n"
+         " */\n"
+         "static uint8_t stale[RAM_PAGES];\n\n");
+}
+
+static void emit_runtime(void) {
+    emit("int chippy_aot_invalidate(struct chippy *machine, uint16_t address, uint32_t length) {\n"
+         "    int changed = 0;\n"
+         "\n"
+         "    for (uint32_t i = 0; i < length; i++) {\n"
+         "        uint32_t byte = (address + i) & (RAM_SIZE - 1);\n"
+         "        uint32_t offset = byte - PROGRAM_START;\n"
+         "\n"
+         "        if (byte >= PROGRAM_START && offset < sizeof(rom)\n"
+         "            && (translated[offset / 8] & (1 << (offset %% 8)))\n"
+         "            && machine->ram[byte] != rom[offset]\n"
+         "            && !stale[byte / RAM_PAGE_SIZE]) {\n"
+         "            stale[byte / RAM_PAGE_SIZE] = 1;\n"
+         "            changed = 1;\n"
+         "        }\n"
+         "    }\n"
+         "\n"
+         "    return changed;\n"
+         "}\n\n");
+
+    emit("int chippy_aot_run(struct chippy *machine, unsigned long cycles) {\n"
+         "    unsigned long remaining = cycles;\n"
+         "    uint16_t opcode;\n"
+         "    uint16_t address;\n"
+         "    int status;\n"
+         "\n"
+         "    // The interpreter traces and profiles every instruction.\n"
+         "    if (machine->trace != NULL || machine->profile != NULL) {\n"
+         "        return chippy_run_cycles(machine, cycles);\n"
+         "    }\n"
+         "\n"
+         "    if (machine->wait_key != -1) {\n"
+         "        goto slow;\n"
+         "    }\n"
+         "\n"
+         "dispatch:\n"
+         "    switch (machine->pc) {\n");
+
+    for (uint32_t address = 0; address < RAM_SIZE; address++) {
+        if (leader[address] && visited[address]) {
+            emit("        case 0x%04X: goto block_%04X;\n", address, address);
+        }
+    }
+
+    emit("    }\n"
+         "\n"
+         "    // Anything that was not translated runs in the interpreter, one\n"
+         "    // instruction at a time, until it reaches translated code again.\n"
+         "slow:\n"
+         "    if (remaining == 0) {\n"
+         "        return EXIT_SUCCESS;\n"
+         "    }\n"
+         "\n"
+         "    opcode = machine->ram[machine->pc & (RAM_SIZE - 1)] << 8 | machine->ram[(machine->pc + 1) & (RAM_SIZE - 1)];\n"
+         "    address = machine->I;\n"
+         "    status = chippy_step(machine);\n"
+         "    remaining--;\n"
+         "\n"
+         "    // Stores made here can overwrite translated code as well.\n"
+         "    chippy_aot_invalidate(machine, address, ops_store_size(chippy_decode_op(opcode), opcode));\n"
+         "\n"
+         "    if (status == CHIPPY_WAITING) {\n"
+         "        machine->cycles += remaining;\n"
+         "        return CHIPPY_WAITING;\n"
+         "    }\n"
+         "\n"
+         "    goto dispatch;\n");
+
+    for (uint32_t address = 0; address < RAM_SIZE; address++) {
+        if (leader[address] && visited[address]) {
+            emit_block(address);
+        }
+    }
+
+    emit("}\n\n");
+}
+
+/**
+ * Emits a main program that runs the ROM without a display, and prints the
+ * final state like chippy-batch. With --verify, it runs the interpreter next
+ * to the translation and compares the machines after every frame.
+ */
+static void emit_main(void) {
+    emit("#ifndef CHIPPY_AOT_NO_MAIN\n"
+         "\n"
+         "static struct chippy *create_machine(uint64_t seed) {\n"
+         "    struct chippy *machine = malloc(sizeof(struct chippy));\n"
+         "\n"
+         "    if (machine == NULL) {\n"
+         "        return NULL;\n"
+         "    }\n"
+         "\n"
+         "    chippy_init(machine);\n"
+         "    chippy_seed(machine, seed);\n"
+         "\n"
+         "    memcpy(machine->ram + PROGRAM_START, rom, sizeof(rom));\n"
+         "    chippy_invalidate(machine, PROGRAM_START, sizeof(rom));\n"
+         "\n"
+         "    return machine;\n"
+         "}\n"
+         "\n"
+         "/**\n"
+         " * Returns whether two machines are in the same state.\n"
+         " */\n"
+         "static int same(const struct chippy *a, const struct chippy *b) {\n"
+         "    return memcmp(a->ram, b->ram, sizeof(a->ram)) == 0\n"
+         "        && memcmp(a->V, b->V, sizeof(a->V)) == 0\n"
+         "        && memcmp(a->stack, b->stack, sizeof(a->stack)) == 0\n"
+         "        && memcmp(a->gfx, b->gfx, sizeof(a->gfx)) == 0\n"
+         "        && memcmp(a->flags, b->flags, sizeof(a->flags)) == 0\n"
+         "        && memcmp(a->pattern, b->pattern, sizeof(a->pattern)) == 0\n"
+         "        && a->pc == b->pc && a->I == b->I && a->sp == b->sp\n"
+         "        && a->dt == b->dt && a->st == b->st\n"
+         "        && a->dt_cycle == b->dt_cycle && a->st_cycle == b->st_cycle\n"
+         "        && a->cycles == b->cycles && a->hires == b->hires && a->planes == b->planes\n"
+         "        && a->wait_key == b->wait_key && a->pitch == b->pitch && a->rng == b->rng;\n"
+         "}\n"
+         "\n"
+         "int main(int argc, char **argv) {\n"
+         "    int verify = argc > 1 && strcmp(argv[1], \"--verify\") == 0;\n"
+         "    unsigned long frames = argc > 1 + verify ? strtoul(argv[1 + verify], NULL, 10) : 600;\n"
+         "    uint64_t seed = argc > 2 + verify ? strtoull(argv[2 + verify], NULL, 0) : 0;\n"
+         "    struct chippy *machine = create_machine(seed);\n"
+         "    struct chippy *reference = verify ? create_machine(seed) : NULL;\n"
+         "    int status = EXIT_SUCCESS;\n"
+         "    int result = EXIT_FAILURE;\n"
+         "\n"
+         "    if (machine == NULL || (verify && reference == NULL)) {\n"
+         "        fprintf(stderr, \"%%s: out of memory\\n\", argv[0]);\n"
+         "        goto done;\n"
+         "    }\n"
+         "\n"
+         "    for (unsigned long frame = 0; frame < frames; frame++) {\n"
+         "        status = chippy_aot_run(machine, machine->cycles_per_tick);\n"
+         "\n"
+         "        if (reference != NULL) {\n"
+         "            chippy_run_cycles(reference, reference->cycles_per_tick);\n"
+         "\n"
+         "            if (!same(machine, reference)) {\n"
+         "                fprintf(stderr, \"%%s: differs from the interpreter after frame %%lu\\n\", argv[0], frame);\n"
+         "                goto done;\n"
+         "            }\n"
+         "        }\n"
+         "    }\n"
+         "\n"
+         "    uint64_t hash = UINT64_C(0xCBF29CE484222325);\n"
+         "    const uint8_t *bytes = (const uint8_t *)machine->gfx;\n"
+         "\n"
+         "    for (size_t i = 0; i < sizeof(machine->gfx); i++) {\n"
+         "        hash = (hash ^ bytes[i]) * UINT64_C(0x100000001B3);\n"
+         "    }\n"
+         "\n"
+         "    printf(\"{\\\"cycles\\\":%%llu,\\\"pc\\\":%%u,\\\"waiting\\\":%%s,\\\"gfx_hash\\\":\\\"%%016llx\\\"}\\n\",\n"
+         "        (unsigned long long)machine->cycles,\n"
+         "        machine->pc,\n"
+         "        status == CHIPPY_WAITING ? \"true\" : \"false\",\n"
+         "        (unsigned long long)hash);\n"
+         "\n"
+         "    result = EXIT_SUCCESS;\n"
+         "\n"
+         "done:\n"
+         "    if (reference != NULL) {\n"
+         "        chippy_destroy(reference);\n"
+         "    }\n"
+         "\n"
+         "    if (machine != NULL) {\n"
+         "        chippy_destroy(machine);\n"
+         "    }\n"
+         "\n"
+         "    return result;\n"
+         "}\n"
+         "\n"
+         "#endif\n");
+}
+
+static void emit_program(const char *path) {
+    size_t count = 0;
+    size_t blocks = 0;
+
+    for (uint32_t address = 0; address < RAM_SIZE; address++) {
+        count += visited[address];
+        blocks += leader[address] && visited[address];
+    }
+
+    emit("/*\n"
+         " * Translated from %s by %s-aot %s: %zu instructions in %zu blocks.\n"
+         " *\n"
+         " * chippy_aot_run() runs the machine like chippy_run_cycles(), for a\n"
+         " * machine that was loaded with this ROM. Code that the ROM overwrites runs\n"
+         " * in the interpreter, which is only noticed for writes made while the\n"
+         " * machine runs: after writing to its memory from outside, call\n"
+         " * chippy_aot_invalidate() too. The state of the translation is global, so\n"
+         " * it runs one machine per process.\n"
+         " *\n"
+         " * Build with -DCHIPPY_AOT_NO_MAIN to leave out the main program.\n"
+         " */\n"
+         "\n"
+         "#include <stdio.h>\n"
+         "#include <stdlib.h>\n"
+         "#include <string.h>\n"
+         "\n"
+         "#include \"libchippy/chippy.h\"\n"
+         "#include \"libchippy/ops.h\"\n"
+         "\n"
+         "int chippy_aot_invalidate(struct chippy *machine, uint16_t address, uint32_t length);\n"
+         "\n"
+         "int chippy_aot_run(struct chippy *machine, unsigned long cycles);\n"
+         "\n",
+         path, PACKAGE_NAME, PACKAGE_VERSION, count, blocks);
+
+    emit_data();
+    emit_runtime();
+    emit_main();
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, "hvo:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'h':
+                display_help(argv[0]);
+                return EXIT_SUCCESS;
+
+            case 'v':
+                display_version();
+                return EXIT_SUCCESS;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                display_help(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        display_help(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The ROM is checked by loading it into a machine, which reports errors
+    // like every other tool does, and then read again for its size.
+    struct chippy *machine = malloc(sizeof(struct chippy));
+
+    chippy_init(machine);
+
+    int error = chippy_load_rom(machine, argv[optind]);
+
+    chippy_destroy(machine);
+
+    if (error != 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], chippy_rom_error_string(error));
+        return EXIT_FAILURE;
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+
+    if (f == NULL) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    rom_size = fread(rom, 1, sizeof(rom), f);
+    fclose(f);
+
+    scan();
+
+    out = output != NULL ? fopen(output, "w") : stdout;
+
+    if (out == NULL) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+
+    emit_program(argv[optind]);
+
+    if (out != stdout && fclose(out) != 0) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
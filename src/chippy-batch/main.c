@@ -0,0 +1,538 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libchippy/capture.h"
+#include "libchippy/chippy.h"
+#include "libchippy/library.h"
+
+/**
+ * A single run of a ROM with a seed, and its results.
+ */
+struct job {
+    const char *path;                   // Path to the ROM
+    const struct chippy_rom *rom;       // The ROM, shared by all its jobs
+    uint64_t seed;                      // Seed of the random number generator
+
+    int error;                          // Why the ROM could not be run, 0 if it ran
+    uint64_t cycles;                    // Number of cycles executed
+    uint16_t pc;                        // Final program counter
+    int waiting;                        // Whether the machine ended up waiting for a key press
+    uint64_t state_hash;                // Hash of the final machine state
+    uint64_t gfx_hash;                  // Hash of the final framebuffer
+};
+
+/**
+ * A worker thread with its own queue of jobs. A worker takes jobs from the back
+ * of its own queue, and steals from the front of the queues of other workers
+ * once its own queue is empty.
+ */
+struct worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+
+    size_t *queue;                      // Indices into the job list
+    size_t head;                        // First queued job
+    size_t tail;                        // One past the last queued job
+};
+
+static struct job *jobs = NULL;
+static size_t job_count = 0;
+
+static struct worker *workers = NULL;
+static size_t worker_count = 0;
+
+static unsigned long ipf = DEFAULT_CYCLES_PER_TICK;
+static unsigned long frames = 600;
+static unsigned long cycles = 0;
+
+static FILE *profile_out = NULL;
+
+static const char *trace_dir = NULL;
+
+static const char *capture_dir = NULL;
+
+static int capture_gif = 0;
+
+static int capture_scale = 0;
+
+static struct option long_options[] = {
+    { "help",          no_argument,       0,            'h' },
+    { "version",       no_argument,       0,            'v' },
+    { "seeds",         required_argument, 0,            's' },
+    { "frames",        required_argument, 0,            'f' },
+    { "cycles",        required_argument, 0,            'c' },
+    { "ipf",           required_argument, 0,            'i' },
+    { "jobs",          required_argument, 0,            'j' },
+    { "output",        required_argument, 0,            'o' },
+    { "profile",       required_argument, 0,            'p' },
+    { "trace",         required_argument, 0,            't' },
+    { "capture",       required_argument, 0,            'C' },
+    { "gif",           no_argument,       &capture_gif,  1  },
+    { "capture-scale", required_argument, 0,            'S' },
+    { 0, 0, 0, 0 }
+};
+
+static void display_help(const char *program) {
+    printf("Usage: %s [options] file...\n"
+           "\n"
+           "Runs every ROM once per seed without a display, and writes one JSON\n"
+           "object per run with hashes of the final state.\n"
+           "\n"
+           "Options:\n"
+           " -h, --help         Display this information.\n"
+           " -v, --version      Display version information.\n"
+           " -s, --seeds LIST   Comma-separated list of seeds (default 0).\n"
+           " -f, --frames N     Run every machine for N frames (default 600).\n"
+           " -c, --cycles N     Run every machine for N cycles instead.\n"
+           "     --ipf N        Execute N instructions per frame (default %d).\n"
+           " -j, --jobs N       Use N threads (default: one per CPU).\n"
+           " -o, --output FILE  Write the results to FILE (default stdout).\n"
+           " -p, --profile FILE Profile every run, and write the cycles spent in\n"
+           "                    every chain of subroutine calls to FILE in the\n"
+           "                    folded format for flamegraphs.\n"
+           " -t, --trace DIR    Record every executed instruction of every run to\n"
+           "                    DIR/ROM-SEED.trace.\n"
+           " -C, --capture DIR  Record one frame per timer tick of every run to\n"
+           "                    DIR/ROM-SEED.y4m.\n"
+           "     --gif          Record GIFs to DIR/ROM-SEED.gif instead.\n"
+           "     --capture-scale N\n"
+           "                    Record a high resolution pixel as NxN pixels, up\n"
+           "                    to %d (default %d for Y4M, %d for GIF).\n"
+           "\n"
+           "For bug reports, please see <%s>.\n", program, DEFAULT_CYCLES_PER_TICK,
+           CAPTURE_MAX_SCALE, CAPTURE_Y4M_SCALE, CAPTURE_GIF_SCALE, PACKAGE_BUGREPORT);
+}
+
+static void display_version(void) {
+    printf("%s-batch %s\nCopyright (c) 2017, Jacob van Eijk\n",
+        PACKAGE_NAME,
+        PACKAGE_VERSION);
+}
+
+/**
+ * Hashes a block of memory with 64-bit FNV-1a, continuing from the given hash.
+ */
+static uint64_t hash(uint64_t h, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ bytes[i]) * UINT64_C(0x100000001B3);
+    }
+
+    return h;
+}
+
+#define HASH_INIT UINT64_C(0xCBF29CE484222325)
+
+/**
+ * Hashes the architectural state of a machine, leaving out caches and host
+ * pointers, so that equal machines always have equal hashes.
+ */
+static uint64_t hash_state(const struct chippy *machine) {
+    uint8_t timers[2] = {
+        chippy_get_delay_timer(machine),
+        chippy_get_sound_timer(machine)
+    };
+
+    uint64_t h = HASH_INIT;
+
+    h = hash(h, machine->ram, sizeof(machine->ram));
+    h = hash(h, machine->V, sizeof(machine->V));
+    h = hash(h, timers, sizeof(timers));
+    h = hash(h, &machine->pc, sizeof(machine->pc));
+    h = hash(h, &machine->I, sizeof(machine->I));
+    h = hash(h, &machine->sp, sizeof(machine->sp));
+    h = hash(h, machine->stack, sizeof(machine->stack));
+    h = hash(h, machine->gfx, sizeof(machine->gfx));
+    h = hash(h, &machine->hires, sizeof(machine->hires));
+    h = hash(h, &machine->planes, sizeof(machine->planes));
+    h = hash(h, machine->flags, sizeof(machine->flags));
+
+    return h;
+}
+
+static void run_job(struct job *job) {
+    struct chippy *machine = malloc(sizeof(struct chippy));
+
+    if (machine == NULL) {
+        job->error = CHIPPY_ROM_UNREADABLE;
+        return;
+    }
+
+    chippy_init(machine);
+    chippy_seed(machine, job->seed);
+    machine->cycles_per_tick = ipf;
+
+    chippy_load(machine, job->rom);
+
+    if (profile_out != NULL) {
+        machine->profile = chippy_profile_create();
+    }
+
+    if (trace_dir != NULL) {
+        const char *name = strrchr(job->path, '/') != NULL ? strrchr(job->path, '/') + 1 : job->path;
+        char path[4096];
+
+        snprintf(path, sizeof(path), "%s/%s-%llu.trace", trace_dir, name, (unsigned long long)job->seed);
+        machine->trace = chippy_trace_open(path);
+
+        if (machine->trace == NULL) {
+            perror(path);
+        }
+    }
+
+    struct chippy_capture *capture = NULL;
+
+    if (capture_dir != NULL) {
+        const char *name = strrchr(job->path, '/') != NULL ? strrchr(job->path, '/') + 1 : job->path;
+        char path[4096];
+
+        snprintf(path, sizeof(path), "%s/%s-%llu.%s", capture_dir, name, (unsigned long long)job->seed, capture_gif ? "gif" : "y4m");
+        capture = chippy_capture_open(path, capture_gif ? CAPTURE_GIF : CAPTURE_Y4M, capture_scale);
+
+        if (capture == NULL) {
+            perror(path);
+        }
+    }
+
+    if (capture == NULL) {
+        job->waiting = chippy_run_cycles(machine, cycles != 0 ? cycles : frames * ipf) == CHIPPY_WAITING;
+    } else {
+        // A frame is presented after every tick, as in the window.
+        unsigned long remaining = cycles != 0 ? cycles : frames * ipf;
+        int status = EXIT_SUCCESS;
+
+        while (remaining > 0) {
+            unsigned long frame = remaining < ipf ? remaining : ipf;
+
+            status = chippy_run_cycles(machine, frame);
+            remaining -= frame;
+
+            chippy_capture_frame(capture, machine);
+        }
+
+        job->waiting = status == CHIPPY_WAITING;
+
+        if (chippy_capture_close(capture) != 0) {
+            fprintf(stderr, "%s: could not write the video\n", job->path);
+        }
+    }
+
+    if (machine->trace != NULL && chippy_trace_close(machine->trace) != 0) {
+        fprintf(stderr, "%s: could not write the trace\n", job->path);
+    }
+
+    if (machine->profile != NULL) {
+        flockfile(profile_out);
+        chippy_profile_write_folded(machine->profile, job->path, profile_out);
+        funlockfile(profile_out);
+
+        chippy_profile_destroy(machine->profile);
+    }
+
+    job->cycles = machine->cycles;
+    job->pc = machine->pc;
+    job->state_hash = hash_state(machine);
+    job->gfx_hash = hash(HASH_INIT, machine->gfx, sizeof(machine->gfx));
+
+    chippy_destroy(machine);
+}
+
+/**
+ * Takes the next job for the given worker, stealing one if its own queue is
+ * empty.
+ *
+ * @return Returns 1 when a job was taken, or 0 when all queues are empty.
+ */
+static int take_job(size_t self, size_t *job) {
+    for (size_t i = 0; i < worker_count; i++) {
+        struct worker *worker = &workers[(self + i) % worker_count];
+        int found = 0;
+
+        pthread_mutex_lock(&worker->lock);
+
+        if (worker->head < worker->tail) {
+            *job = i == 0 ? worker->queue[--worker->tail] : worker->queue[worker->head++];
+            found = 1;
+        }
+
+        pthread_mutex_unlock(&worker->lock);
+
+        if (found) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void *work(void *arg) {
+    size_t self = (size_t)(uintptr_t)arg;
+    size_t job;
+
+    while (take_job(self, &job)) {
+        run_job(&jobs[job]);
+    }
+
+    return NULL;
+}
+
+static void write_string(FILE *out, const char *string) {
+    fputc('"', out);
+
+    for (const char *c = string; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        } else {
+            fputc(*c, out);
+        }
+    }
+
+    fputc('"', out);
+}
+
+static void write_results(FILE *out) {
+    for (size_t i = 0; i < job_count; i++) {
+        struct job *job = &jobs[i];
+
+        fprintf(out, "{\"rom\":");
+        write_string(out, job->path);
+        fprintf(out, ",\"seed\":%llu", (unsigned long long)job->seed);
+
+        if (job->error) {
+            fprintf(out, ",\"error\":");
+            write_string(out, chippy_rom_error_string(job->error));
+            fprintf(out, "}\n");
+            continue;
+        }
+
+        fprintf(out, ",\"cycles\":%llu,\"pc\":%u,\"waiting\":%s,\"state_hash\":\"%016llx\",\"gfx_hash\":\"%016llx\"}\n",
+            (unsigned long long)job->cycles,
+            job->pc,
+            job->waiting ? "true" : "false",
+            (unsigned long long)job->state_hash,
+            (unsigned long long)job->gfx_hash);
+    }
+}
+
+/**
+ * Parses a comma-separated list of seeds.
+ *
+ * @return Returns the number of seeds, or 0 when the list is invalid.
+ */
+static size_t parse_seeds(const char *list, uint64_t **seeds) {
+    size_t count = 1;
+
+    for (const char *c = list; *c != '\0'; c++) {
+        count += *c == ',';
+    }
+
+    *seeds = malloc(count * sizeof(uint64_t));
+
+    for (size_t i = 0; i < count; i++) {
+        char *end;
+
+        (*seeds)[i] = strtoull(list, &end, 0);
+
+        if (end == list || (*end != ',' && *end != '\0')) {
+            free(*seeds);
+            return 0;
+        }
+
+        list = end + 1;
+    }
+
+    return count;
+}
+
+int main(int argc, char **argv) {
+    const char *seed_list = "0";
+    const char *output = NULL;
+    const char *profile = NULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, "hvs:f:c:j:o:p:t:C:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'h':
+                display_help(argv[0]);
+                return EXIT_SUCCESS;
+
+            case 'v':
+                display_version();
+                return EXIT_SUCCESS;
+
+            case 's':
+                seed_list = optarg;
+                break;
+
+            case 'f':
+                frames = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'c':
+                cycles = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'i':
+                ipf = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'j':
+                threads = strtol(optarg, NULL, 10);
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            case 'p':
+                profile = optarg;
+                break;
+
+            case 't':
+                trace_dir = optarg;
+                break;
+
+            case 'C':
+                capture_dir = optarg;
+                break;
+
+            case 'S':
+                capture_scale = strtol(optarg, NULL, 10);
+
+                if (capture_scale < 1 || capture_scale > CAPTURE_MAX_SCALE) {
+                    display_help(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 0:
+                break;
+
+            default:
+                display_help(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    uint64_t *seeds;
+    size_t seed_count = parse_seeds(seed_list, &seeds);
+
+    if (optind >= argc || seed_count == 0 || ipf == 0 || threads < 1) {
+        display_help(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (profile != NULL) {
+        struct chippy_profile *available = chippy_profile_create();
+
+        if (available == NULL) {
+            fprintf(stderr, "%s: built without the profiler\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        chippy_profile_destroy(available);
+
+        profile_out = fopen(profile, "w");
+
+        if (profile_out == NULL) {
+            perror(profile);
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t rom_count = argc - optind;
+    struct chippy_library *library = chippy_library_create();
+
+    job_count = rom_count * seed_count;
+    jobs = calloc(job_count, sizeof(struct job));
+
+    // Every ROM is read and decoded once, and then shared by all its jobs.
+    for (size_t i = 0; i < rom_count; i++) {
+        const struct chippy_rom *rom = NULL;
+        int error = chippy_library_open(library, argv[optind + i], &rom);
+
+        for (size_t j = i * seed_count; j < (i + 1) * seed_count; j++) {
+            jobs[j].path = argv[optind + i];
+            jobs[j].rom = rom;
+            jobs[j].seed = seeds[j % seed_count];
+            jobs[j].error = error;
+        }
+    }
+
+    worker_count = (size_t)threads < job_count ? (size_t)threads : job_count;
+    workers = calloc(worker_count, sizeof(struct worker));
+
+    for (size_t i = 0; i < worker_count; i++) {
+        pthread_mutex_init(&workers[i].lock, NULL);
+        workers[i].queue = malloc((job_count / worker_count + 1) * sizeof(size_t));
+    }
+
+    // Jobs are dealt round-robin, so that every ROM is spread over all workers.
+    for (size_t i = 0; i < job_count; i++) {
+        struct worker *worker = &workers[i % worker_count];
+
+        if (!jobs[i].error) {
+            worker->queue[worker->tail++] = i;
+        }
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        pthread_create(&workers[i].thread, NULL, work, (void *)(uintptr_t)i);
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        pthread_mutex_destroy(&workers[i].lock);
+        free(workers[i].queue);
+    }
+
+    FILE *out = output != NULL ? fopen(output, "w") : stdout;
+
+    if (out == NULL) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+
+    write_results(out);
+
+    int failed = 0;
+
+    for (size_t i = 0; i < job_count; i++) {
+        failed |= jobs[i].error != 0;
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    chippy_library_destroy(library);
+
+    if (profile_out != NULL) {
+        fclose(profile_out);
+    }
+
+    free(workers);
+    free(jobs);
+    free(seeds);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,450 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "libchippy/trace.h"
+
+/**
+ * The registers that a record can change, as bits of a change mask. V0 to VF
+ * are bits 0 to 15.
+ */
+#define CHANGE_I  (1 << 16)
+#define CHANGE_SP (1 << 17)
+#define CHANGE_DT (1 << 18)
+#define CHANGE_ST (1 << 19)
+
+/**
+ * The registers as decoded from the records so far.
+ */
+struct state {
+    uint64_t cycles;                    // Cycle of the next instruction
+    uint16_t pc;                        // PC of the next instruction
+    uint16_t I;
+    uint8_t sp;
+    uint8_t V[16];
+    uint8_t dt;
+    uint8_t st;
+};
+
+/**
+ * The instructions to print, everything matches by default.
+ */
+struct filter {
+    long pc;                            // Address, or -1 for any
+    uint16_t opcode;                    // Opcode to match under opcode_mask
+    uint16_t opcode_mask;               // Nibbles that must match, 0 for any
+    uint32_t changes;                   // Registers of which one must change, 0 for any
+    uint64_t from;                      // First cycle
+    uint64_t to;                        // Last cycle
+};
+
+static struct option long_options[] = {
+    { "help",    no_argument,       0, 'h' },
+    { "version", no_argument,       0, 'v' },
+    { "pc",      required_argument, 0, 'p' },
+    { "opcode",  required_argument, 0, 'o' },
+    { "changes", required_argument, 0, 'c' },
+    { "from",    required_argument, 0, 'f' },
+    { "to",      required_argument, 0, 't' },
+    { "count",   no_argument,       0, 'n' },
+    { 0, 0, 0, 0 }
+};
+
+static void display_help(const char *program) {
+    printf("Usage: %s [options] file\n"
+           "\n"
+           "Decodes an execution trace, and prints one line per instruction with\n"
+           "its cycle, address, opcode and the registers it changed.\n"
+           "\n"
+           "Options:\n"
+           " -h, --help           Display this information.\n"
+           " -v, --version        Display version information.\n"
+           " -p, --pc ADDR        Only show instructions at ADDR.\n"
+           " -o, --opcode PATTERN Only show opcodes matching PATTERN, four hex\n"
+           "                      digits where ? matches any digit (e.g. D??F).\n"
+           " -c, --changes REG    Only show instructions that changed REG, one\n"
+           "                      of V0 to VF, I, SP, DT or ST. May be repeated.\n"
+           " -f, --from CYCLE     Skip instructions before CYCLE.\n"
+           " -t, --to CYCLE       Stop after CYCLE.\n"
+           " -n, --count          Only print the number of matching instructions.\n"
+           "\n"
+           "For bug reports, please see <%s>.\n", program, PACKAGE_BUGREPORT);
+}
+
+static void display_version(void) {
+    printf("%s-trace %s\nCopyright (c) 2017, Jacob van Eijk\n",
+        PACKAGE_NAME,
+        PACKAGE_VERSION);
+}
+
+/**
+ * Parses an opcode pattern like "D??F".
+ *
+ * @return Returns 0 on success, or 1 when the pattern is invalid.
+ */
+static int parse_opcode(const char *pattern, struct filter *filter) {
+    if (strlen(pattern) != 4) {
+        return 1;
+    }
+
+    filter->opcode = 0;
+    filter->opcode_mask = 0;
+
+    for (int i = 0; i < 4; i++) {
+        char c = pattern[i];
+        int shift = 12 - 4 * i;
+
+        if (c == '?') {
+            continue;
+        }
+
+        if (c >= '0' && c <= '9') {
+            filter->opcode |= (c - '0') << shift;
+        } else if (c >= 'a' && c <= 'f') {
+            filter->opcode |= (c - 'a' + 10) << shift;
+        } else if (c >= 'A' && c <= 'F') {
+            filter->opcode |= (c - 'A' + 10) << shift;
+        } else {
+            return 1;
+        }
+
+        filter->opcode_mask |= 0xF << shift;
+    }
+
+    return 0;
+}
+
+/**
+ * Parses a register name into its change bit.
+ *
+ * @return Returns the change bit, or 0 when the name is invalid.
+ */
+static uint32_t parse_register(const char *name) {
+    if (strcasecmp(name, "I") == 0) {
+        return CHANGE_I;
+    } else if (strcasecmp(name, "SP") == 0) {
+        return CHANGE_SP;
+    } else if (strcasecmp(name, "DT") == 0) {
+        return CHANGE_DT;
+    } else if (strcasecmp(name, "ST") == 0) {
+        return CHANGE_ST;
+    }
+
+    if ((name[0] == 'V' || name[0] == 'v') && name[1] != '\0' && name[2] == '\0') {
+        char *end;
+        long index = strtol(name + 1, &end, 16);
+
+        if (*end == '\0') {
+            return 1 << index;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Reads a little-endian field of the given number of bytes.
+ */
+static int read_field(FILE *in, int bytes, uint64_t *value) {
+    *value = 0;
+
+    for (int i = 0; i < bytes; i++) {
+        int c = fgetc(in);
+
+        if (c == EOF) {
+            return 1;
+        }
+
+        *value |= (uint64_t)c << (8 * i);
+    }
+
+    return 0;
+}
+
+static void print_changes(const struct state *state, uint32_t changes) {
+    for (int i = 0; i < 16; i++) {
+        if (changes & (1 << i)) {
+            printf(" V%X=%02X", i, state->V[i]);
+        }
+    }
+
+    if (changes & CHANGE_I) {
+        printf(" I=%03X", state->I);
+    }
+
+    if (changes & CHANGE_SP) {
+        printf(" SP=%u", state->sp);
+    }
+
+    if (changes & CHANGE_DT) {
+        printf(" DT=%02X", state->dt);
+    }
+
+    if (changes & CHANGE_ST) {
+        printf(" ST=%02X", state->st);
+    }
+}
+
+/**
+ * Decodes the records that follow the magic, printing or counting the
+ * instructions that pass the filter.
+ *
+ * @return Returns 0 on success, or 1 when the trace is malformed or truncated.
+ */
+static int decode(FILE *in, const struct filter *filter, int count_only, uint64_t *count) {
+    struct state state;
+    int searching = filter->pc >= 0 || filter->opcode_mask != 0 || filter->changes != 0;
+    int synced = 0;
+    int flags;
+
+    memset(&state, 0, sizeof(state));
+
+    while ((flags = fgetc(in)) != EOF) {
+        uint64_t value;
+        uint32_t changes = 0;
+        uint16_t pc;
+        uint16_t opcode;
+
+        if (flags & TRACE_SYNC) {
+            uint8_t record[TRACE_SYNC_SIZE - 1];
+
+            if (fread(record, 1, sizeof(record), in) != sizeof(record)) {
+                return 1;
+            }
+
+            state.pc = record[0] | record[1] << 8;
+            state.I = record[2] | record[3] << 8;
+            state.sp = record[4];
+            memcpy(state.V, record + 5, 16);
+            state.dt = record[21];
+            state.st = record[22];
+            state.cycles = 0;
+
+            for (int i = 0; i < 8; i++) {
+                state.cycles |= (uint64_t)record[23 + i] << (8 * i);
+            }
+
+            synced = 1;
+
+            // Sync records are only shown when every instruction is.
+            if (!count_only && !searching && state.cycles >= filter->from && state.cycles <= filter->to) {
+                printf("%12llu sync PC=%03X", (unsigned long long)state.cycles, state.pc);
+                print_changes(&state, 0xFFFF | CHANGE_I | CHANGE_SP | CHANGE_DT | CHANGE_ST);
+                printf("\n");
+            }
+
+            continue;
+        }
+
+        // An instruction record needs the registers from a sync record.
+        if (!synced) {
+            return 1;
+        }
+
+        pc = state.pc;
+
+        if (flags & TRACE_PC) {
+            if (read_field(in, 2, &value)) {
+                return 1;
+            }
+            pc = value;
+        }
+
+        // The opcode is stored big-endian, like in memory.
+        if (read_field(in, 2, &value)) {
+            return 1;
+        }
+        opcode = (value & 0xFF) << 8 | value >> 8;
+
+        if (flags & TRACE_V) {
+            int index = fgetc(in);
+            int byte = fgetc(in);
+
+            if (index == EOF || byte == EOF) {
+                return 1;
+            }
+
+            state.V[index & 0xF] = byte;
+            changes |= 1 << (index & 0xF);
+        }
+
+        if (flags & TRACE_VS) {
+            if (read_field(in, 2, &value)) {
+                return 1;
+            }
+
+            for (int i = 0; i < 16; i++) {
+                if (value & (1 << i)) {
+                    int byte = fgetc(in);
+
+                    if (byte == EOF) {
+                        return 1;
+                    }
+
+                    state.V[i] = byte;
+                }
+            }
+
+            changes |= value;
+        }
+
+        if (flags & TRACE_I) {
+            if (read_field(in, 2, &value)) {
+                return 1;
+            }
+            state.I = value;
+            changes |= CHANGE_I;
+        }
+
+        if (flags & TRACE_SP) {
+            if (read_field(in, 1, &value)) {
+                return 1;
+            }
+            state.sp = value;
+            changes |= CHANGE_SP;
+        }
+
+        if (flags & TRACE_DT) {
+            if (read_field(in, 1, &value)) {
+                return 1;
+            }
+            state.dt = value;
+            changes |= CHANGE_DT;
+        }
+
+        if (flags & TRACE_ST) {
+            if (read_field(in, 1, &value)) {
+                return 1;
+            }
+            state.st = value;
+            changes |= CHANGE_ST;
+        }
+
+        if (state.cycles > filter->to) {
+            return 0;
+        }
+
+        if (state.cycles >= filter->from
+            && (filter->pc < 0 || filter->pc == pc)
+            && (opcode & filter->opcode_mask) == filter->opcode
+            && (filter->changes == 0 || (changes & filter->changes) != 0)) {
+            (*count)++;
+
+            if (!count_only) {
+                printf("%12llu %03X %04X", (unsigned long long)state.cycles, pc, opcode);
+                print_changes(&state, changes);
+                printf("\n");
+            }
+        }
+
+        state.pc = pc + 2;
+        state.cycles++;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    struct filter filter = { -1, 0, 0, 0, 0, UINT64_MAX };
+    int count_only = 0;
+    int opt = 0;
+
+    while ((opt = getopt_long(argc, argv, "hvp:o:c:f:t:n", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'h':
+                display_help(argv[0]);
+                return EXIT_SUCCESS;
+
+            case 'v':
+                display_version();
+                return EXIT_SUCCESS;
+
+            case 'p':
+                filter.pc = strtol(optarg, NULL, 16);
+                break;
+
+            case 'o':
+                if (parse_opcode(optarg, &filter)) {
+                    fprintf(stderr, "%s: invalid opcode pattern: %s\n", argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'c': {
+                uint32_t change = parse_register(optarg);
+
+                if (change == 0) {
+                    fprintf(stderr, "%s: invalid register: %s\n", argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+
+                filter.changes |= change;
+                break;
+            }
+
+            case 'f':
+                filter.from = strtoull(optarg, NULL, 10);
+                break;
+
+            case 't':
+                filter.to = strtoull(optarg, NULL, 10);
+                break;
+
+            case 'n':
+                count_only = 1;
+                break;
+
+            default:
+                display_help(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        display_help(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *in = fopen(argv[optind], "rb");
+    char magic[TRACE_MAGIC_SIZE];
+    uint64_t count = 0;
+
+    if (in == NULL) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    if (fread(magic, 1, TRACE_MAGIC_SIZE, in) != TRACE_MAGIC_SIZE || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "%s: not a trace\n", argv[optind]);
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    int error = decode(in, &filter, count_only, &count);
+
+    fclose(in);
+
+    if (count_only) {
+        printf("%llu\n", (unsigned long long)count);
+    }
+
+    if (error) {
+        fprintf(stderr, "%s: truncated or malformed trace\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,220 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include "audio.h"
+
+#include <string.h>
+#include <SDL.h>
+
+/**
+ * The sample rate that is asked for. The device may choose another one.
+ */
+#define SAMPLE_RATE 48000
+
+/**
+ * The number of segments that can be queued, which must be a power of two.
+ * Every frame pushes at most three.
+ */
+#define SEGMENTS 64
+
+/**
+ * The amplitude of the square wave, out of 32767.
+ */
+#define AMPLITUDE 4000
+
+/**
+ * A stretch of samples that either play the pattern at the pitch, or are
+ * silent.
+ */
+struct segment {
+    uint32_t samples;
+    uint8_t on;
+    uint8_t pitch;
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+};
+
+static SDL_AudioDeviceID device = 0;
+
+static int sample_rate = 0;
+
+static uint32_t frame_samples = 0;
+
+/**
+ * The ring buffer between the emulation and the audio callback. SDL calls the
+ * callback from its own thread at the rate of the device, so it must never
+ * wait for a frame, and a frame that finds the ring full is not heard.
+ */
+static struct segment ring[SEGMENTS];
+
+static size_t head = 0;
+
+static size_t tail = 0;
+
+/**
+ * The segment that is playing, the number of its samples left, and where in
+ * the pattern it is, in bits. Only used by the callback. The last segment
+ * keeps playing when the ring runs dry, so that a late frame does not click.
+ */
+static struct segment current;
+
+static uint32_t remaining = 0;
+
+static double phase = 0;
+
+static double step = 0;
+
+/**
+ * Starts playing the given segment.
+ */
+static void play(const struct segment *segment) {
+    current = *segment;
+    remaining = current.samples;
+
+    step = 4000 * SDL_pow(2, (current.pitch - 64) / 48.0) / sample_rate;
+}
+
+static void callback(void *userdata, Uint8 *stream, int len) {
+    int16_t *samples = (int16_t *)stream;
+    int count = len / sizeof(int16_t);
+    size_t published = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    size_t taken = tail;
+    uint64_t queued = remaining;
+    uint64_t limit = (uint64_t)count > frame_samples ? (uint64_t)count : frame_samples;
+
+    (void)userdata;
+
+    for (size_t i = tail; i != published; i++) {
+        queued += ring[i & (SEGMENTS - 1)].samples;
+    }
+
+    // Keeps at most one frame queued after this buffer, by skipping the oldest
+    // sound, so that latency does not build up when the device runs slow.
+    while (queued > limit && (remaining != 0 || taken != published)) {
+        if (remaining == 0) {
+            play(&ring[taken++ & (SEGMENTS - 1)]);
+            continue;
+        }
+
+        uint32_t skip = queued - limit < remaining ? queued - limit : remaining;
+
+        remaining -= skip;
+        queued -= skip;
+    }
+
+    for (int i = 0; i < count; i++) {
+        while (remaining == 0 && taken != published) {
+            play(&ring[taken++ & (SEGMENTS - 1)]);
+        }
+
+        int bit = (int)phase;
+
+        if (!current.on) {
+            samples[i] = 0;
+        } else if (current.pattern[bit / 8] & (0x80 >> (bit % 8))) {
+            samples[i] = AMPLITUDE;
+        } else {
+            samples[i] = -AMPLITUDE;
+        }
+
+        phase += step;
+
+        if (phase >= AUDIO_PATTERN_BITS) {
+            phase -= AUDIO_PATTERN_BITS;
+        }
+
+        if (remaining != 0) {
+            remaining--;
+        }
+    }
+
+    __atomic_store_n(&tail, taken, __ATOMIC_RELEASE);
+}
+
+int audio_init(int samples, int frame_rate) {
+    SDL_AudioSpec want;
+    SDL_AudioSpec have;
+
+    memset(&want, 0, sizeof(want));
+
+    want.freq = SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = samples;
+    want.callback = callback;
+
+    device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+
+    if (device == 0) {
+        return 1;
+    }
+
+    sample_rate = have.freq;
+    frame_samples = have.freq / frame_rate;
+
+    SDL_PauseAudioDevice(device, 0);
+
+    return 0;
+}
+
+void audio_destroy(void) {
+    if (device != 0) {
+        SDL_CloseAudioDevice(device);
+        device = 0;
+    }
+}
+
+/**
+ * Queues a segment of the given number of samples, unless the ring is full.
+ */
+static void push_segment(const struct chippy *machine, uint32_t samples, int on) {
+    if (samples == 0 || head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == SEGMENTS) {
+        return;
+    }
+
+    struct segment *segment = &ring[head & (SEGMENTS - 1)];
+
+    segment->samples = samples;
+    segment->on = on;
+    segment->pitch = machine->pitch;
+    memcpy(segment->pattern, machine->pattern, sizeof(segment->pattern));
+
+    __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+}
+
+void audio_push(const struct chippy *machine, uint64_t start) {
+    uint64_t end = machine->cycles;
+
+    if (device == 0) {
+        return;
+    }
+
+    if (start >= end) {
+        push_segment(machine, frame_samples, 0);
+        return;
+    }
+
+    // The sound plays for the part of the frame between the cycle the sound
+    // timer was set at and the cycle it runs out at, scaled to samples.
+    uint64_t on = machine->st_cycle > start ? machine->st_cycle : start;
+    uint64_t off = chippy_get_sound_end(machine);
+
+    off = off < end ? off : end;
+
+    if (on >= off) {
+        push_segment(machine, frame_samples, 0);
+        return;
+    }
+
+    uint32_t before = (on - start) * frame_samples / (end - start);
+    uint32_t during = (off - start) * frame_samples / (end - start) - before;
+
+    push_segment(machine, before, 0);
+    push_segment(machine, during, 1);
+    push_segment(machine, frame_samples - before - during, 0);
+}
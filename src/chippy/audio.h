@@ -0,0 +1,51 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __AUDIO_H__
+#define __AUDIO_H__
+
+#include <stdint.h>
+
+#include "libchippy/chippy.h"
+
+/**
+ * The default number of samples in the buffer of the audio device.
+ */
+#define DEFAULT_AUDIO_BUFFER 512
+
+/**
+ * Opens the audio device. The device plays the sound that is pushed with
+ * audio_push(), at most about one frame behind.
+ *
+ * @param samples    The number of samples in the buffer of the device, a
+ *                   power of two. Smaller buffers lower the latency.
+ * @param frame_rate The number of frames per second that are pushed.
+ *
+ * @return Returns 0 on success, otherwise 1.
+ */
+int audio_init(int samples, int frame_rate);
+
+/**
+ * Closes the audio device, if it was opened.
+ */
+void audio_destroy(void);
+
+/**
+ * Queues one frame of sound, in which the cycles of the machine since the
+ * given cycle are played. The sound timer decides when the sound plays, and
+ * the XO-CHIP pattern and pitch what it sounds like. Never blocks: a frame is
+ * dropped when the device is too far behind.
+ *
+ * @param machine The machine to play the sound of.
+ * @param start   The first cycle of the frame. When it is not before the
+ *                current cycle of the machine, the frame is silent.
+ */
+void audio_push(const struct chippy *machine, uint64_t start);
+
+#endif
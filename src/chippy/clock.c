@@ -0,0 +1,34 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "clock.h"
+
+#include <errno.h>
+#include <time.h>
+
+uint64_t clock_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * CLOCK_NS_PER_SEC + ts.tv_nsec;
+}
+
+void clock_sleep_until(uint64_t deadline) {
+    struct timespec ts;
+
+    ts.tv_sec = deadline / CLOCK_NS_PER_SEC;
+    ts.tv_nsec = deadline % CLOCK_NS_PER_SEC;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        continue;
+    }
+}
@@ -0,0 +1,30 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <stdint.h>
+
+/**
+ * The number of clock ticks in one second.
+ */
+#define CLOCK_NS_PER_SEC 1000000000ULL
+
+/**
+ * Returns the current time of the monotonic clock in nanoseconds.
+ */
+uint64_t clock_now(void);
+
+/**
+ * Sleeps until the monotonic clock reaches the given time in nanoseconds.
+ */
+void clock_sleep_until(uint64_t deadline);
+
+#endif
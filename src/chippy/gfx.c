@@ -11,9 +11,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <SDL.h>
 
 #include "libchippy/chippy.h"
+#include "libchippy/input.h"
+#include "clock.h"
+#include "scale.h"
 
 static SDL_Window *window = NULL;
 
@@ -21,7 +25,55 @@ static SDL_Renderer *renderer = NULL;
 
 static SDL_Texture *texture = NULL;
 
-int gfx_init(int scale) {
+/**
+ * The filter that scales the screen on the CPU, and the size of the texture it
+ * fills, which is that of the window.
+ */
+static enum scale_filter filter = SCALE_NONE;
+
+static int texture_width = 0;
+
+static int texture_height = 0;
+
+/**
+ * Set once the window was closed, by whichever call removed the event.
+ */
+static int quit = 0;
+
+/**
+ * The mode of the framebuffer that was last uploaded to the texture. Rows are
+ * only uploaded again when the machine marked them dirty since, or when the
+ * mode changed.
+ */
+static int uploaded_hires = 0;
+
+static int uploaded_valid = 0;
+
+/**
+ * The texture pixels for every combination of four pixels of both bitplanes,
+ * indexed by the nibble of the first plane in the low bits and that of the
+ * second plane in the high bits. Rows are expanded four pixels at a time with
+ * 16-byte copies, which compilers turn into single vector moves.
+ */
+static uint32_t nibble_pixels[256][4];
+
+/**
+ * The colours of pixels that are set in neither plane, the first, the second,
+ * and both.
+ */
+static const uint32_t palette[4] = { 0x000000FF, 0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF };
+
+/**
+ * The keys that map to the CHIP-8 keypad, indexed by the keypad value.
+ */
+static const SDL_Scancode keymap[16] = {
+    SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,
+    SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
+    SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
+    SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V
+};
+
+int gfx_init(int scale, enum scale_filter scale_filter) {
     if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
         return 1;
     }
@@ -46,23 +98,48 @@ int gfx_init(int scale) {
         -1,
         SDL_RENDERER_ACCELERATED);
 
+    // Without a GPU, e.g. with the dummy video driver, render in software.
+    if (renderer == NULL) {
+        renderer = SDL_CreateRenderer(
+            window,
+            -1,
+            SDL_RENDERER_SOFTWARE);
+    }
+
     if (renderer == NULL) {
         gfx_destroy();
         return 1;
     }
 
+    // Without a filter, the texture holds one texel per CHIP-8 pixel and is
+    // scaled up when it is copied to the window. In low resolution only its top
+    // left corner is used. With one, it is filled at the size of the window.
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+
+    filter = scale_filter;
+    texture_width = filter == SCALE_NONE ? HIRES_SCREEN_W : width;
+    texture_height = filter == SCALE_NONE ? HIRES_SCREEN_H : height;
+
     texture = SDL_CreateTexture(
         renderer,
         SDL_PIXELFORMAT_RGBA8888,
         SDL_TEXTUREACCESS_STREAMING,
-        width,
-        height);
+        texture_width,
+        texture_height);
 
     if (texture == NULL) {
         gfx_destroy();
         return 1;
     }
 
+    for (int n = 0; n < 256; n++) {
+        for (int i = 0; i < 4; i++) {
+            nibble_pixels[n][i] = palette[((n >> (3 - i)) & 1) | ((n >> (7 - i)) & 1) << 1];
+        }
+    }
+
+    uploaded_valid = 0;
+
     return 0;
 }
 
@@ -80,35 +157,125 @@ void gfx_destroy(void) {
     }
 }
 
-static void render_pixel(int x, int y, int scale) {
-    SDL_Rect rect;
+static void expand_row(const struct chippy *machine, int y, int width, uint32_t *pixels) {
+    for (int i = 0; i < width / 4; i++) {
+        int word = i / 16;
+        int shift = 60 - (i % 16) * 4;
+        int index = ((machine->gfx[0][y][word] >> shift) & 0xF) | ((machine->gfx[1][y][word] >> shift) & 0xF) << 4;
+
+        memcpy(pixels + i * 4, nibble_pixels[index], sizeof(nibble_pixels[0]));
+    }
+}
+
+/**
+ * Uploads the rows from first up to but not including last to the texture.
+ */
+static int upload_rows(const struct chippy *machine, int width, int first, int last) {
+    SDL_Rect rect = { 0, first, width, last - first };
+    void *pixels;
+    int pitch;
 
-    rect.x = x * PIXEL_SIZE * scale;
-    rect.y = y * PIXEL_SIZE * scale;
-    rect.w = PIXEL_SIZE * scale;
-    rect.h = PIXEL_SIZE * scale;
+    if (SDL_LockTexture(texture, &rect, &pixels, &pitch) != 0) {
+        return 1;
+    }
+
+    for (int y = first; y < last; y++) {
+        expand_row(machine, y, width, (uint32_t *)((uint8_t *)pixels + (y - first) * pitch));
+    }
 
-    SDL_RenderFillRect(renderer, &rect);
+    SDL_UnlockTexture(texture);
+
+    return 0;
 }
 
-int gfx_render(struct chippy *machine, int scale) {
-    (void)machine;
+/**
+ * Filters the rows from first up to but not including last, which include all
+ * dirty rows, and uploads the part of the window that changed as a result.
+ */
+static int upload_filtered(const struct chippy *machine, uint64_t dirty, int width, int height, int first, int last) {
+    int target_first;
+    int target_last;
+    void *pixels;
+    int pitch;
+
+    for (int y = first; y < last; y++) {
+        if (dirty & (UINT64_C(1) << y)) {
+            expand_row(machine, y, width, scale_source_row(y));
+        }
+    }
 
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
+    scale_prepare(filter, width, height, first, last, texture_height, &target_first, &target_last);
+
+    SDL_Rect rect = { 0, target_first, texture_width, target_last - target_first };
+
+    if (rect.h == 0) {
+        return 0;
+    }
+
+    if (SDL_LockTexture(texture, &rect, &pixels, &pitch) != 0) {
+        return 1;
+    }
 
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    scale_write(pixels, pitch, texture_width);
 
-    for (int y = 0; y < SCREEN_H; y++) {
-        for (int x = 0; x < SCREEN_W; x++) {
-            if (machine->gfx[SCREEN_W * y + x]) {
-                render_pixel(x, y, scale);
-            }
+    SDL_UnlockTexture(texture);
+
+    return 0;
+}
+
+int gfx_render(struct chippy *machine) {
+    int width = chippy_screen_width(machine);
+    int height = chippy_screen_height(machine);
+    uint64_t dirty = machine->gfx_dirty;
+
+    if (!uploaded_valid || uploaded_hires != machine->hires) {
+        dirty = GFX_ALL_ROWS;
+    } else if (dirty == 0) {
+        // The window still shows this frame.
+        return 0;
+    }
+
+    if (height < 64) {
+        dirty &= (UINT64_C(1) << height) - 1;
+    }
+
+    // The filters look at the rows around a pixel, so the dirty rows are
+    // filtered as one band.
+    if (filter != SCALE_NONE && dirty != 0) {
+        int first = __builtin_ctzll(dirty);
+        int last = 64 - __builtin_clzll(dirty);
+
+        if (upload_filtered(machine, dirty, width, height, first, last) != 0) {
+            return 1;
         }
+
+        dirty = 0;
     }
 
+    // Every run of consecutive dirty rows is uploaded with one lock.
+    while (dirty != 0) {
+        int first = __builtin_ctzll(dirty);
+        int last = first;
+
+        while (last < height && (dirty & (UINT64_C(1) << last))) {
+            last++;
+        }
+
+        if (upload_rows(machine, width, first, last) != 0) {
+            return 1;
+        }
+
+        dirty &= last < 64 ? ~((UINT64_C(1) << last) - 1) : 0;
+    }
+
+    machine->gfx_dirty = 0;
+    uploaded_hires = machine->hires;
+    uploaded_valid = 1;
+
+    SDL_Rect source = { 0, 0, width, height };
+
+    SDL_RenderCopy(renderer, texture, filter == SCALE_NONE ? &source : NULL, NULL);
     SDL_RenderPresent(renderer);
-    SDL_Delay(1);
 
     return 0;
 }
@@ -118,9 +285,76 @@ int gfx_close_requested(void) {
 
     while (SDL_PollEvent(&event)) {
         if (event.type == SDL_QUIT) {
-            return 1;
+            quit = 1;
+        }
+    }
+
+    return quit;
+}
+
+/**
+ * Pushes keypad events into the queue as soon as SDL receives them, with the
+ * time at which they arrived. Called by SDL while it pumps events.
+ */
+static int watch_keypad(void *userdata, SDL_Event *event) {
+    if ((event->type != SDL_KEYDOWN && event->type != SDL_KEYUP) || event->key.repeat) {
+        return 0;
+    }
+
+    for (int i = 0; i < 16; i++) {
+        if (event->key.keysym.scancode == keymap[i]) {
+            chippy_input_push(userdata, clock_now(), i, event->type == SDL_KEYDOWN);
+            break;
         }
     }
 
     return 0;
 }
+
+void gfx_watch_keypad(struct chippy_input *input) {
+    SDL_AddEventWatch(watch_keypad, input);
+}
+
+void gfx_wait_until(uint64_t deadline) {
+    SDL_Event event;
+    uint64_t now;
+
+    // Wakes up for every event, so that key events are timestamped when they
+    // arrive rather than at the next frame. The last millisecond is slept on
+    // the clock, as SDL only waits in whole milliseconds.
+    while ((now = clock_now()) + CLOCK_NS_PER_SEC / 1000 < deadline) {
+        if (SDL_WaitEventTimeout(&event, (deadline - now) / 1000000) && event.type == SDL_QUIT) {
+            quit = 1;
+        }
+    }
+
+    clock_sleep_until(deadline);
+}
+
+void gfx_wait_event(int timeout) {
+    if (timeout < 0) {
+        SDL_WaitEvent(NULL);
+    } else {
+        SDL_WaitEventTimeout(NULL, timeout);
+    }
+}
+
+int gfx_rewind_held(void) {
+    return SDL_GetKeyboardState(NULL)[SDL_SCANCODE_BACKSPACE] != 0;
+}
+
+int gfx_fast_forward_held(void) {
+    return SDL_GetKeyboardState(NULL)[SDL_SCANCODE_TAB] != 0;
+}
+
+void gfx_show_speed(double speed) {
+    char title[64];
+
+    if (speed == 0) {
+        SDL_SetWindowTitle(window, PACKAGE_NAME);
+        return;
+    }
+
+    snprintf(title, sizeof(title), "%s x%.0f", PACKAGE_NAME, speed);
+    SDL_SetWindowTitle(window, title);
+}
@@ -10,9 +10,11 @@
 #ifndef __GFX_H__
 #define __GFX_H__
 
-#include "libchippy/chippy.h"
+#include <stdint.h>
 
-void set_pixel(int x, int y, int scale);
+#include "libchippy/chippy.h"
+#include "libchippy/input.h"
+#include "scale.h"
 
 /**
  * The size of a CHIP-8 pixel.
@@ -21,8 +23,12 @@ void set_pixel(int x, int y, int scale);
 
 /**
  * Initializes the graphics context.
+ *
+ * @param scale  The factor by which the window is enlarged.
+ * @param filter The filter that scales the screen to the window on the CPU,
+ *               or SCALE_NONE to leave the scaling to the renderer.
  */
-int gfx_init(int scale);
+int gfx_init(int scale, enum scale_filter filter);
 
 /**
  * Destroys the graphics context.
@@ -30,13 +36,55 @@ int gfx_init(int scale);
 void gfx_destroy(void);
 
 /**
- * Renders the screen buffer from the given machine into the SDL texture.
+ * Renders the screen buffer from the given machine into the SDL texture, and
+ * presents it. Only the rows that the machine marked dirty are uploaded, after
+ * which they are marked clean, and a frame without dirty rows is not presented
+ * at all.
  */
-int gfx_render(struct chippy *machine, int scale);
+int gfx_render(struct chippy *machine);
 
 /**
  * Checks whether the user requested to close the application.
  */
 int gfx_close_requested(void);
 
+/**
+ * Pushes the keys mapped to the CHIP-8 keypad into the given queue whenever
+ * they are pressed or released, while events are polled or waited for. The
+ * keys 1-4, Q-R, A-F and Z-V map to the keypad 123C, 456D, 789E and A0BF.
+ */
+void gfx_watch_keypad(struct chippy_input *input);
+
+/**
+ * Sleeps until the monotonic clock reaches the given time in nanoseconds,
+ * while receiving events as they arrive.
+ */
+void gfx_wait_until(uint64_t deadline);
+
+/**
+ * Blocks until an event arrives or the timeout expires, without removing the
+ * event from the queue.
+ *
+ * @param timeout The timeout in milliseconds, or -1 to wait without one.
+ */
+void gfx_wait_event(int timeout);
+
+/**
+ * Checks whether the rewind key is held down. Events have to be polled with
+ * gfx_close_requested() first.
+ */
+int gfx_rewind_held(void);
+
+/**
+ * Checks whether the fast-forward key is held down. Events have to be polled
+ * with gfx_close_requested() first.
+ */
+int gfx_fast_forward_held(void);
+
+/**
+ * Shows the emulation speed as a multiple of real time in the window title, or
+ * hides it when the speed is 0.
+ */
+void gfx_show_speed(double speed);
+
 #endif
@@ -10,17 +10,77 @@
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include "libchippy/capture.h"
 #include "libchippy/chippy.h"
+#include "libchippy/input.h"
+#include "libchippy/rewind.h"
+#include "audio.h"
+#include "clock.h"
 #include "gfx.h"
 
+/**
+ * The rate at which frames are rendered and input is polled, which is also the
+ * rate of the CHIP-8 timers.
+ */
+#define FRAME_RATE TIMER_HZ
+
+/**
+ * The default number of instructions executed per frame.
+ */
+#define DEFAULT_IPF DEFAULT_CYCLES_PER_TICK
+
+/**
+ * The number of times per second that the speed is measured and shown while
+ * fast-forwarding.
+ */
+#define SPEED_RATE 2
+
 static int hidpi = 0;
 
+static int rewind_stats = 0;
+
+static int fast_forward = 0;
+
+static unsigned long ipf = DEFAULT_IPF;
+
+static unsigned long audio_buffer = DEFAULT_AUDIO_BUFFER;
+
+static size_t rewind_capacity = DEFAULT_REWIND_CAPACITY;
+
+static const char *trace_path = NULL;
+
+static enum scale_filter filter = SCALE_NONE;
+
+static const char *capture_path = NULL;
+
+static int capture_scale = 0;
+
+/**
+ * The video of the presented frames, NULL when not capturing.
+ */
+static struct chippy_capture *capture = NULL;
+
+/**
+ * The keypad events on their way from SDL to the machine.
+ */
+static struct chippy_input input;
+
 static struct option long_options[] = {
-    { "help",    no_argument, 0,      'h' },
-    { "version", no_argument, 0,      'v' },
-    { "hidpi",   no_argument, &hidpi,  1  },
+    { "help",          no_argument,       0,             'h' },
+    { "version",       no_argument,       0,             'v' },
+    { "hidpi",         no_argument,       &hidpi,         1  },
+    { "fast-forward",  no_argument,       &fast_forward,  1  },
+    { "ipf",           required_argument, 0,             'i' },
+    { "audio",         required_argument, 0,             'a' },
+    { "rewind",        required_argument, 0,             'r' },
+    { "rewind-stats",  no_argument,       &rewind_stats,  1  },
+    { "trace",         required_argument, 0,             't' },
+    { "filter",        required_argument, 0,             's' },
+    { "capture",       required_argument, 0,             'c' },
+    { "capture-scale", required_argument, 0,             'S' },
     { 0, 0, 0, 0 }
 };
 
@@ -28,11 +88,27 @@ static void display_help(const char *program) {
     printf("Usage: %s [options] file\n"
            "\n"
            "Options:\n"
-           " -h, --help    Display this information.\n"
-           " -v, --version Display version information.\n"
-           "     --hidpi   Scale for HiDPI screens.\n"
+           " -h, --help         Display this information.\n"
+           " -v, --version      Display version information.\n"
+           "     --hidpi        Scale for HiDPI screens.\n"
+           "     --fast-forward Run as fast as possible, like holding tab.\n"
+           "     --ipf N        Execute N instructions per frame (default %d).\n"
+           "     --audio N      Buffer N samples of audio, a power of two, or 0\n"
+           "                    to mute (default %d).\n"
+           "     --rewind KB    Keep KB kilobytes of history to rewind with\n"
+           "                    backspace, 0 to disable (default %d).\n"
+           "     --rewind-stats Print the cost of the history on exit.\n"
+           "     --trace FILE   Record every executed instruction to FILE.\n"
+           "     --filter NAME  Scale on the CPU with NAME: nearest, scale2x,\n"
+           "                    scale3x, scale4x or crt (default none).\n"
+           "     --capture FILE Record every presented frame to FILE, as a GIF\n"
+           "                    when it ends in .gif and as Y4M otherwise.\n"
+           "     --capture-scale N\n"
+           "                    Record a high resolution pixel as NxN pixels, up\n"
+           "                    to %d (default %d for Y4M, %d for GIF).\n"
            "\n"
-           "For bug reports, please see <%s>.\n", program, PACKAGE_BUGREPORT);
+           "For bug reports, please see <%s>.\n", program, DEFAULT_IPF, DEFAULT_AUDIO_BUFFER, DEFAULT_REWIND_CAPACITY / 1024,
+           CAPTURE_MAX_SCALE, CAPTURE_Y4M_SCALE, CAPTURE_GIF_SCALE, PACKAGE_BUGREPORT);
 }
 
 static void display_version(void) {
@@ -41,6 +117,166 @@ static void display_version(void) {
         PACKAGE_VERSION);
 }
 
+/**
+ * The time spent adding frames to the history.
+ */
+struct rewind_cost {
+    uint64_t frames;
+    uint64_t total;
+    uint64_t max;
+};
+
+static void print_rewind_cost(const struct chippy_rewind *rewind, const struct rewind_cost *cost) {
+    fprintf(stderr, "rewind: %zu frames in %zu bytes, %.2f us per frame on average, %.2f us at most\n",
+        rewind->frames,
+        rewind->used,
+        cost->frames != 0 ? (double)cost->total / cost->frames / 1000 : 0.0,
+        (double)cost->max / 1000);
+}
+
+/**
+ * Executes one frame and adds it to the history. The frame emulates the host
+ * time since the previous one, so key events are applied at the cycle that
+ * matches the time they arrived at.
+ *
+ * @return Returns 0 on success, CHIPPY_WAITING when the machine is waiting for
+ *         a key press, otherwise 1.
+ */
+static int run_frame(struct chippy *machine, struct chippy_rewind *rewind, struct rewind_cost *cost, uint64_t *input_time) {
+    uint64_t now = clock_now();
+    int status = chippy_input_run(machine, &input, ipf, *input_time, now);
+
+    *input_time = now;
+
+    if (rewind != NULL) {
+        uint64_t start = clock_now();
+
+        chippy_rewind_push(rewind, machine);
+
+        uint64_t elapsed = clock_now() - start;
+
+        cost->frames++;
+        cost->total += elapsed;
+        cost->max = elapsed > cost->max ? elapsed : cost->max;
+    }
+
+    return status;
+}
+
+/**
+ * Runs the machine until the user closes the window. Every frame executes a
+ * batch of instructions, polls input and renders once, and then sleeps until
+ * the next frame is due on the monotonic clock. While backspace is held, every
+ * frame steps back one frame in the history instead.
+ *
+ * Key events are received and timestamped while the loop sleeps, and the next
+ * frame applies them at the matching cycle, so the order and spacing of key
+ * presses within a frame is kept.
+ *
+ * While fast-forwarding, frames are executed back to back for the duration of
+ * one frame before rendering once, so the number of frames skipped adapts to
+ * the speed of the host and presenting never holds emulation back.
+ *
+ * While the machine waits for a key press, the loop blocks on the event queue
+ * instead: until the next frame while a timer is running, and without a
+ * timeout otherwise, as nothing changes until a key is pressed.
+ */
+static void run(struct chippy *machine, struct chippy_rewind *rewind) {
+    uint64_t frame = CLOCK_NS_PER_SEC / FRAME_RATE;
+    uint64_t deadline = clock_now();
+    struct rewind_cost cost = { 0, 0, 0 };
+    uint64_t speed_start = 0;
+    uint64_t speed_frames = 0;
+    int was_fast = 0;
+    uint64_t input_time = deadline;
+    uint64_t audio_cycle = machine->cycles;
+    int status = EXIT_SUCCESS;
+
+    if (rewind != NULL) {
+        chippy_rewind_push(rewind, machine);
+    }
+
+    for (;;) {
+        if (gfx_close_requested() != 0) {
+            break;
+        }
+
+        int fast = fast_forward || gfx_fast_forward_held();
+
+        if (rewind != NULL && gfx_rewind_held()) {
+            chippy_rewind_pop(rewind, machine);
+            chippy_input_sync(machine, &input);
+            input_time = clock_now();
+            status = EXIT_SUCCESS;
+            fast = 0;
+        } else if (fast) {
+            uint64_t now = clock_now();
+            uint64_t until = now + frame;
+
+            if (!was_fast) {
+                speed_start = now;
+                speed_frames = 0;
+            }
+
+            do {
+                status = run_frame(machine, rewind, &cost, &input_time);
+                speed_frames++;
+                now = clock_now();
+            } while (now < until && status != CHIPPY_WAITING);
+
+            if (now - speed_start >= CLOCK_NS_PER_SEC / SPEED_RATE) {
+                gfx_show_speed((double)speed_frames * CLOCK_NS_PER_SEC / FRAME_RATE / (now - speed_start));
+                speed_start = now;
+                speed_frames = 0;
+            }
+        } else {
+            status = run_frame(machine, rewind, &cost, &input_time);
+        }
+
+        if (was_fast && !fast) {
+            gfx_show_speed(0);
+        }
+
+        was_fast = fast;
+
+        // While fast-forwarding, the frames since the last render are squeezed
+        // into one frame of sound. Rewinding is silent.
+        audio_push(machine, audio_cycle);
+        audio_cycle = machine->cycles;
+
+        gfx_render(machine);
+
+        if (capture != NULL) {
+            chippy_capture_frame(capture, machine);
+        }
+
+        deadline += frame;
+
+        uint64_t now = clock_now();
+
+        if (status == CHIPPY_WAITING) {
+            if (chippy_get_delay_timer(machine) == 0 && chippy_get_sound_timer(machine) == 0) {
+                gfx_wait_event(-1);
+                deadline = clock_now();
+            } else if (now < deadline) {
+                gfx_wait_event((deadline - now + 999999) / 1000000);
+            }
+        } else if (fast) {
+            deadline = now;
+        } else if (now < deadline) {
+            gfx_wait_until(deadline);
+        } else if (now - deadline > frame * FRAME_RATE / 4) {
+            // Do not try to catch up after falling far behind, e.g. after the
+            // window was dragged.
+            deadline = now;
+        }
+    }
+
+    if (rewind != NULL && rewind_stats) {
+        print_rewind_cost(rewind, &cost);
+    }
+}
+
 int main(int argc, char **argv) {
     int opt = 0;
 
@@ -54,6 +290,52 @@ int main(int argc, char **argv) {
                 display_version();
                 return EXIT_SUCCESS;
 
+            case 'i':
+                ipf = strtoul(optarg, NULL, 10);
+
+                if (ipf == 0) {
+                    display_help(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'a':
+                audio_buffer = strtoul(optarg, NULL, 10);
+
+                if ((audio_buffer & (audio_buffer - 1)) != 0) {
+                    display_help(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'r':
+                rewind_capacity = strtoul(optarg, NULL, 10) * 1024;
+                break;
+
+            case 't':
+                trace_path = optarg;
+                break;
+
+            case 'c':
+                capture_path = optarg;
+                break;
+
+            case 'S':
+                capture_scale = strtol(optarg, NULL, 10);
+
+                if (capture_scale < 1 || capture_scale > CAPTURE_MAX_SCALE) {
+                    display_help(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 's':
+                if (scale_parse(optarg, &filter) != 0) {
+                    display_help(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+
             case '?':
                 break;
 
@@ -67,28 +349,84 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
-    if (gfx_init(hidpi ? 2 : 1)) {
+    if (gfx_init(hidpi ? 2 : 1, filter)) {
         return EXIT_FAILURE;
     }
 
-    srand(time(NULL));
+    chippy_input_init(&input);
+    gfx_watch_keypad(&input);
+
+    if (audio_buffer != 0 && audio_init(audio_buffer, FRAME_RATE) != 0) {
+        fprintf(stderr, "%s: could not open the audio device, continuing without sound\n", argv[0]);
+    }
 
     struct chippy *machine = malloc(sizeof(struct chippy));
 
     chippy_init(machine);
+    chippy_seed(machine, time(NULL));
+
+    // Every frame is one tick of the timers.
+    machine->cycles_per_tick = ipf;
 
-    if (chippy_load_rom(machine, argv[optind]) != 0) {
+    int error = chippy_load_rom(machine, argv[optind]);
+
+    if (error != 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], chippy_rom_error_string(error));
         return EXIT_FAILURE;
     }
 
-    while (chippy_step(machine) != EXIT_FAILURE) {
-        if (gfx_close_requested() != 0) {
-            break;
+    struct chippy_rewind *rewind = NULL;
+
+    if (rewind_capacity != 0) {
+        rewind = malloc(sizeof(struct chippy_rewind));
+
+        if (rewind == NULL || chippy_rewind_init(rewind, rewind_capacity) != 0) {
+            free(rewind);
+            return EXIT_FAILURE;
         }
+    }
 
-        gfx_render(machine, hidpi ? 2 : 1);
+    if (trace_path != NULL) {
+        machine->trace = chippy_trace_open(trace_path);
+
+        if (machine->trace == NULL) {
+            perror(trace_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (capture_path != NULL) {
+        const char *extension = strrchr(capture_path, '.');
+
+        capture = chippy_capture_open(capture_path, extension != NULL && strcmp(extension, ".gif") == 0 ? CAPTURE_GIF : CAPTURE_Y4M, capture_scale);
+
+        if (capture == NULL) {
+            perror(capture_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    run(machine, rewind);
+
+    if (rewind != NULL) {
+        chippy_rewind_destroy(rewind);
+    }
+
+    if (machine->trace != NULL && chippy_trace_close(machine->trace) != 0) {
+        fprintf(stderr, "%s: could not write the trace\n", trace_path);
+    }
+
+    if (capture != NULL) {
+        if (capture->dropped != 0) {
+            fprintf(stderr, "%s: dropped %llu frames\n", capture_path, (unsigned long long)capture->dropped);
+        }
+
+        if (chippy_capture_close(capture) != 0) {
+            fprintf(stderr, "%s: could not write the video\n", capture_path);
+        }
     }
 
+    audio_destroy();
     gfx_destroy();
 
     return EXIT_FAILURE;
@@ -0,0 +1,365 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include "scale.h"
+
+#include <string.h>
+
+/*
+ * Eight pixels at a time are handled with GNU C vector extensions, which the
+ * compiler lowers to SSE2 or AVX2 instructions. On x86-64 Linux the kernels
+ * are compiled for both, and the best version is picked at load time.
+ */
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) && !defined(__clang__)
+#define SCALE_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define SCALE_CLONES
+#endif
+
+typedef uint32_t pixel8 __attribute__((vector_size(32)));
+typedef int32_t mask8 __attribute__((vector_size(32)));
+
+#define LOAD(p)     ({ pixel8 v_; memcpy(&v_, (p), sizeof(v_)); v_; })
+#define STORE(p, v) do { pixel8 v_ = (v); memcpy((p), &v_, sizeof(v_)); } while (0)
+
+#define SELECT(m, a, b) ((pixel8)(((mask8)(a) & (m)) | ((mask8)(b) & ~(m))))
+
+/**
+ * The number of pixels left and right of every row, which hold copies of the
+ * pixels at the edges, so that the kernels can read past them.
+ */
+#define PAD 8
+
+/**
+ * An image whose rows are padded left and right by PAD pixels, and with one
+ * padding row above and below.
+ */
+struct image {
+    uint32_t *pixels;                   // The first pixel of the first row
+    int width;
+    int height;
+    int stride;                         // Pixels from one row to the next
+};
+
+#define IMAGE_STORAGE(w, h) ((h) + 2) * ((w) + 2 * PAD)
+
+static uint32_t source_pixels[IMAGE_STORAGE(HIRES_SCREEN_W, HIRES_SCREEN_H)];
+static uint32_t middle_pixels[IMAGE_STORAGE(2 * HIRES_SCREEN_W, 2 * HIRES_SCREEN_H)];
+static uint32_t scaled_pixels[IMAGE_STORAGE(SCALE_MAX_FACTOR * HIRES_SCREEN_W, SCALE_MAX_FACTOR * HIRES_SCREEN_H)];
+
+static struct image source = {
+    source_pixels + HIRES_SCREEN_W + 3 * PAD, 0, 0, HIRES_SCREEN_W + 2 * PAD
+};
+
+static struct image middle = {
+    middle_pixels + 2 * HIRES_SCREEN_W + 3 * PAD, 0, 0, 2 * HIRES_SCREEN_W + 2 * PAD
+};
+
+static struct image scaled = {
+    scaled_pixels + SCALE_MAX_FACTOR * HIRES_SCREEN_W + 3 * PAD, 0, 0, SCALE_MAX_FACTOR * HIRES_SCREEN_W + 2 * PAD
+};
+
+/**
+ * What the last call to scale_prepare() left for scale_write().
+ */
+static enum scale_filter prepared_filter = SCALE_NONE;
+
+static const struct image *prepared = NULL;
+
+static int prepared_height = 0;
+
+static int prepared_first = 0;
+
+static int prepared_last = 0;
+
+static inline uint32_t *image_row(const struct image *image, int y) {
+    return image->pixels + y * image->stride;
+}
+
+int scale_parse(const char *name, enum scale_filter *filter) {
+    static const char *names[] = { "none", "nearest", "scale2x", "scale3x", "scale4x", "crt" };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *filter = (enum scale_filter)i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+uint32_t *scale_source_row(int y) {
+    return image_row(&source, y);
+}
+
+/**
+ * Copies the edge pixels of the given rows into the padding, and the top and
+ * bottom rows into the padding rows when they are among them.
+ */
+static void pad_rows(struct image *image, int first, int last) {
+    for (int y = first; y < last; y++) {
+        uint32_t *row = image_row(image, y);
+
+        for (int x = 1; x <= PAD; x++) {
+            row[-x] = row[0];
+            row[image->width - 1 + x] = row[image->width - 1];
+        }
+    }
+
+    if (first == 0) {
+        memcpy(image_row(image, -1) - PAD, image_row(image, 0) - PAD, image->stride * sizeof(uint32_t));
+    }
+
+    if (last == image->height) {
+        memcpy(image_row(image, image->height) - PAD, image_row(image, image->height - 1) - PAD, image->stride * sizeof(uint32_t));
+    }
+}
+
+/**
+ * Scales the given rows by two with Scale2x. Every pixel P becomes four, each
+ * of which takes the colour of two neighbours of P when they agree and the
+ * other two do not, which rounds off staircase edges.
+ *
+ *       A           E0 E1
+ *     C P B   =>    E2 E3
+ *       D
+ */
+SCALE_CLONES
+static void scale2x(const struct image *in, struct image *out, int first, int last) {
+    for (int y = first; y < last; y++) {
+        const uint32_t *up = image_row(in, y - 1);
+        const uint32_t *row = image_row(in, y);
+        const uint32_t *down = image_row(in, y + 1);
+        uint32_t *out0 = image_row(out, 2 * y);
+        uint32_t *out1 = image_row(out, 2 * y + 1);
+
+        for (int x = 0; x < in->width; x += 8) {
+            pixel8 a = LOAD(up + x);
+            pixel8 b = LOAD(row + x + 1);
+            pixel8 c = LOAD(row + x - 1);
+            pixel8 d = LOAD(down + x);
+            pixel8 p = LOAD(row + x);
+            pixel8 e0 = SELECT((c == a) & (c != d) & (a != b), a, p);
+            pixel8 e1 = SELECT((a == b) & (a != c) & (b != d), b, p);
+            pixel8 e2 = SELECT((d == c) & (d != b) & (c != a), c, p);
+            pixel8 e3 = SELECT((b == d) & (b != a) & (d != c), d, p);
+
+            for (int i = 0; i < 8; i++) {
+                out0[2 * (x + i)] = e0[i];
+                out0[2 * (x + i) + 1] = e1[i];
+                out1[2 * (x + i)] = e2[i];
+                out1[2 * (x + i) + 1] = e3[i];
+            }
+        }
+    }
+}
+
+/**
+ * Scales the given rows by three with Scale3x, the same idea as Scale2x with
+ * all eight neighbours.
+ *
+ *     A B C           E0 E1 E2
+ *     D E F   =>      E3 E4 E5
+ *     G H I           E6 E7 E8
+ */
+SCALE_CLONES
+static void scale3x(const struct image *in, struct image *out, int first, int last) {
+    for (int y = first; y < last; y++) {
+        const uint32_t *up = image_row(in, y - 1);
+        const uint32_t *row = image_row(in, y);
+        const uint32_t *down = image_row(in, y + 1);
+        uint32_t *out0 = image_row(out, 3 * y);
+        uint32_t *out1 = image_row(out, 3 * y + 1);
+        uint32_t *out2 = image_row(out, 3 * y + 2);
+
+        for (int x = 0; x < in->width; x += 8) {
+            pixel8 a = LOAD(up + x - 1), b = LOAD(up + x), c = LOAD(up + x + 1);
+            pixel8 d = LOAD(row + x - 1), e = LOAD(row + x), f = LOAD(row + x + 1);
+            pixel8 g = LOAD(down + x - 1), h = LOAD(down + x), i = LOAD(down + x + 1);
+
+            // The four corners where two edges meet.
+            mask8 db = (d == b) & (b != f) & (d != h);
+            mask8 bf = (b == f) & (b != d) & (f != h);
+            mask8 dh = (d == h) & (d != b) & (h != f);
+            mask8 hf = (h == f) & (d != h) & (b != f);
+
+            pixel8 e0 = SELECT(db, d, e);
+            pixel8 e1 = SELECT((db & (e != c)) | (bf & (e != a)), b, e);
+            pixel8 e2 = SELECT(bf, f, e);
+            pixel8 e3 = SELECT((db & (e != g)) | (dh & (e != a)), d, e);
+            pixel8 e5 = SELECT((bf & (e != i)) | (hf & (e != c)), f, e);
+            pixel8 e6 = SELECT(dh, d, e);
+            pixel8 e7 = SELECT((dh & (e != i)) | (hf & (e != g)), h, e);
+            pixel8 e8 = SELECT(hf, f, e);
+
+            for (int n = 0; n < 8; n++) {
+                out0[3 * (x + n)] = e0[n];
+                out0[3 * (x + n) + 1] = e1[n];
+                out0[3 * (x + n) + 2] = e2[n];
+                out1[3 * (x + n)] = e3[n];
+                out1[3 * (x + n) + 1] = e[n];
+                out1[3 * (x + n) + 2] = e5[n];
+                out2[3 * (x + n)] = e6[n];
+                out2[3 * (x + n) + 1] = e7[n];
+                out2[3 * (x + n) + 2] = e8[n];
+            }
+        }
+    }
+}
+
+/**
+ * Stretches a row to the target width by repeating pixels. Whole multiples,
+ * which are the common case, are filled eight pixels at a time.
+ */
+SCALE_CLONES
+static void stretch_row(const uint32_t *in, int width, uint32_t *out, int target_width) {
+    if (target_width % width != 0) {
+        for (int x = 0; x < target_width; x++) {
+            out[x] = in[x * width / target_width];
+        }
+        return;
+    }
+
+    int repeat = target_width / width;
+
+    for (int x = 0; x < width; x++, out += repeat) {
+        pixel8 splat = (pixel8){ 0 } + in[x];
+        int i = 0;
+
+        for (; i + 8 <= repeat; i += 8) {
+            STORE(out + i, splat);
+        }
+
+        for (; i < repeat; i++) {
+            out[i] = in[x];
+        }
+    }
+}
+
+/**
+ * Halves the brightness of a row, keeping the alpha in the lowest byte.
+ */
+SCALE_CLONES
+static void darken_row(uint32_t *row, int width) {
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        pixel8 p = LOAD(row + x);
+
+        STORE(row + x, ((p >> 1) & 0x7F7F7F00) | (p & 0xFF));
+    }
+
+    for (; x < width; x++) {
+        row[x] = ((row[x] >> 1) & 0x7F7F7F00) | (row[x] & 0xFF);
+    }
+}
+
+/**
+ * Returns the first target row that shows the given image row.
+ */
+static int target_row(int y, int height, int target_height) {
+    return ((int64_t)y * target_height + height - 1) / height;
+}
+
+/**
+ * Scales the given rows of an image by a Scale2x or Scale3x factor into
+ * another, and returns the rows of the output that changed. Every output row
+ * depends on the rows next to its input row too.
+ */
+static void scale_rows(const struct image *in, struct image *out, int factor, int *first, int *last) {
+    int from = *first > 0 ? *first - 1 : 0;
+    int to = *last < in->height ? *last + 1 : in->height;
+
+    out->width = in->width * factor;
+    out->height = in->height * factor;
+
+    if (factor == 2) {
+        scale2x(in, out, from, to);
+    } else {
+        scale3x(in, out, from, to);
+    }
+
+    *first = from * factor;
+    *last = to * factor;
+
+    pad_rows(out, *first, *last);
+}
+
+void scale_prepare(enum scale_filter filter, int width, int height, int first, int last, int target_height, int *target_first, int *target_last) {
+    source.width = width;
+    source.height = height;
+
+    pad_rows(&source, first, last);
+
+    switch (filter) {
+        case SCALE_2X:
+            scale_rows(&source, &scaled, 2, &first, &last);
+            prepared = &scaled;
+            break;
+
+        case SCALE_3X:
+            scale_rows(&source, &scaled, 3, &first, &last);
+            prepared = &scaled;
+            break;
+
+        case SCALE_4X:
+            scale_rows(&source, &middle, 2, &first, &last);
+            scale_rows(&middle, &scaled, 2, &first, &last);
+            prepared = &scaled;
+            break;
+
+        default:
+            prepared = &source;
+            break;
+    }
+
+    prepared_filter = filter;
+    prepared_height = target_height;
+    prepared_first = target_row(first, prepared->height, target_height);
+    prepared_last = target_row(last, prepared->height, target_height);
+
+    *target_first = prepared_first;
+    *target_last = prepared_last;
+}
+
+void scale_write(uint32_t *target, int pitch, int target_width) {
+    const uint32_t *previous = NULL;
+    int previous_y = -1;
+    int previous_dark = 0;
+
+    for (int ty = prepared_first; ty < prepared_last; ty++) {
+        uint32_t *out = (uint32_t *)((uint8_t *)target + (ty - prepared_first) * pitch);
+        int y = (int64_t)ty * prepared->height / prepared_height;
+        int dark = 0;
+
+        // The bottom third of every pixel is a dark scanline.
+        if (prepared_filter == SCALE_CRT) {
+            int top = target_row(y, prepared->height, prepared_height);
+            int bottom = target_row(y + 1, prepared->height, prepared_height);
+
+            dark = (ty - top) * 3 >= (bottom - top) * 2;
+        }
+
+        // Rows that repeat the row above are copied.
+        if (y == previous_y && dark == previous_dark) {
+            memcpy(out, previous, target_width * sizeof(uint32_t));
+        } else {
+            stretch_row(image_row(prepared, y), prepared->width, out, target_width);
+
+            if (dark) {
+                darken_row(out, target_width);
+            }
+        }
+
+        previous = out;
+        previous_y = y;
+        previous_dark = dark;
+    }
+}
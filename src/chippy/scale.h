@@ -0,0 +1,74 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __SCALE_H__
+#define __SCALE_H__
+
+#include <stdint.h>
+
+#include "libchippy/chippy.h"
+
+/**
+ * The pixel-art filters that scale the screen on the CPU. Every filter fills a
+ * target of any size: the pixel-art scalers first scale by their own factor,
+ * and the result is stretched to the target by repeating pixels.
+ */
+enum scale_filter {
+    SCALE_NONE,                         // Not scaled on the CPU at all
+    SCALE_NEAREST,                      // Repeats every pixel
+    SCALE_2X,                           // Scale2x (EPX), which smooths diagonal edges
+    SCALE_3X,                           // Scale3x
+    SCALE_4X,                           // Scale2x applied twice
+    SCALE_CRT                           // Repeats every pixel, with dark scanlines
+};
+
+/**
+ * The largest factor by which a filter scales before stretching.
+ */
+#define SCALE_MAX_FACTOR 4
+
+/**
+ * Looks up a filter by its name: none, nearest, scale2x, scale3x, scale4x or
+ * crt.
+ *
+ * @return Returns 0 on success, or 1 when the name is unknown.
+ */
+int scale_parse(const char *name, enum scale_filter *filter);
+
+/**
+ * Returns the row of the source image to write the pixels of screen row y to,
+ * one 32-bit pixel per CHIP-8 pixel.
+ */
+uint32_t *scale_source_row(int y);
+
+/**
+ * Filters the source rows that changed, and returns the target rows that
+ * changed as a result, which scale_write() writes.
+ *
+ * @param filter        The filter to use, other than SCALE_NONE.
+ * @param width         The width of the screen.
+ * @param height        The height of the screen.
+ * @param first         The first source row that changed.
+ * @param last          The source row after the last one that changed.
+ * @param target_height The height of the target.
+ * @param target_first  Set to the first target row that changed.
+ * @param target_last   Set to the target row after the last one that changed.
+ */
+void scale_prepare(enum scale_filter filter, int width, int height, int first, int last, int target_height, int *target_first, int *target_last);
+
+/**
+ * Writes the target rows that the last call to scale_prepare() returned.
+ *
+ * @param target       The first of those rows.
+ * @param pitch        The number of bytes between two target rows.
+ * @param target_width The width of the target.
+ */
+void scale_write(uint32_t *target, int pitch, int target_width);
+
+#endif
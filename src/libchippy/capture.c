@@ -0,0 +1,382 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include "capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The shortest time a GIF shows a frame, in hundredths of a second. Most
+ * viewers show frames with shorter delays for a tenth of a second instead.
+ */
+#define GIF_MIN_DELAY 2
+
+/**
+ * GIF images are compressed with LZW codes of up to 12 bits, starting from
+ * codes for the 4 colours, a clear code and an end code.
+ */
+#define LZW_MIN_CODE_SIZE 2
+#define LZW_CLEAR (1 << LZW_MIN_CODE_SIZE)
+#define LZW_END (LZW_CLEAR + 1)
+#define LZW_MAX_CODE 4095
+
+/**
+ * The grey levels of pixels that are set in neither plane, the first, the
+ * second, and both, like in the window.
+ */
+static const uint8_t palette[4] = { 0x00, 0xFF, 0xAA, 0x55 };
+
+/**
+ * The state of the encoder thread. The last frame that was taken from the
+ * queue is only written once the next one arrives, as only then is it known
+ * for how long it is shown.
+ */
+struct encoder {
+    struct chippy_capture *capture;
+
+    uint8_t pixels[CAPTURE_MAX_H * CAPTURE_MAX_W]; // Palette indices of the last frame, by row
+    uint64_t start;                     // The frame at which it is first shown
+    int pending;                        // Whether there is a last frame
+
+    uint8_t luma[CAPTURE_MAX_H * CAPTURE_MAX_W]; // Y4M planes, by row
+    uint8_t chroma[CAPTURE_MAX_H * CAPTURE_MAX_W];
+
+    uint16_t children[LZW_MAX_CODE + 1][4]; // LZW code of a code followed by a colour, 0 if none
+    uint32_t bits;                      // Bits not yet written
+    int bit_count;
+    uint8_t block[255];                 // Sub-block not yet written
+    int block_size;
+};
+
+/**
+ * Converts a frame to palette indices.
+ */
+static void expand(const struct chippy_capture *capture, const struct chippy_capture_frame *frame, uint8_t *pixels) {
+    int size = frame->hires ? capture->scale : 2 * capture->scale;
+    int width = capture->width;
+
+    for (int y = 0; y < capture->height / size; y++) {
+        uint8_t *row = pixels + y * size * width;
+
+        for (int x = 0; x < width / size; x++) {
+            int index = ((frame->gfx[0][y][x / 64] & GFX_ROW_BIT(x)) != 0)
+                | ((frame->gfx[1][y][x / 64] & GFX_ROW_BIT(x)) != 0) << 1;
+
+            memset(row + x * size, index, size);
+        }
+
+        for (int i = 1; i < size; i++) {
+            memcpy(row + i * width, row, width);
+        }
+    }
+}
+
+/**
+ * Writes the last frame as often as it was presented. The luma follows from
+ * the grey level and all chroma is neutral.
+ */
+static void write_y4m(struct encoder *encoder, uint64_t count) {
+    FILE *file = encoder->capture->file;
+    size_t size = (size_t)encoder->capture->width * encoder->capture->height;
+
+    for (size_t i = 0; i < size; i++) {
+        encoder->luma[i] = 16 + palette[encoder->pixels[i]] * 219 / 255;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        fputs("FRAME\n", file);
+        fwrite(encoder->luma, 1, size, file);
+        fwrite(encoder->chroma, 1, size, file);
+        fwrite(encoder->chroma, 1, size, file);
+    }
+}
+
+static void put_byte(struct encoder *encoder, uint8_t byte) {
+    encoder->block[encoder->block_size++] = byte;
+
+    if (encoder->block_size == sizeof(encoder->block)) {
+        fputc(encoder->block_size, encoder->capture->file);
+        fwrite(encoder->block, 1, encoder->block_size, encoder->capture->file);
+        encoder->block_size = 0;
+    }
+}
+
+/**
+ * Appends a code of the given number of bits, least significant bit first.
+ */
+static void put_code(struct encoder *encoder, int code, int size) {
+    encoder->bits |= (uint32_t)code << encoder->bit_count;
+    encoder->bit_count += size;
+
+    while (encoder->bit_count >= 8) {
+        put_byte(encoder, encoder->bits & 0xFF);
+        encoder->bits >>= 8;
+        encoder->bit_count -= 8;
+    }
+}
+
+/**
+ * Writes the last frame as one GIF image shown for the given number of
+ * hundredths of a second.
+ */
+static void write_gif(struct encoder *encoder, uint64_t delay) {
+    FILE *file = encoder->capture->file;
+    int width = encoder->capture->width;
+    int height = encoder->capture->height;
+    int size = LZW_MIN_CODE_SIZE + 1;
+    int next = LZW_END;
+    int prefix = -1;
+
+    delay = delay < 0xFFFF ? delay : 0xFFFF;
+
+    // Graphic control extension with the delay, and an image descriptor of
+    // the whole screen.
+    const uint8_t header[] = {
+        0x21, 0xF9, 0x04, 0x00, delay & 0xFF, delay >> 8, 0x00, 0x00,
+        0x2C, 0x00, 0x00, 0x00, 0x00,
+        width & 0xFF, width >> 8, height & 0xFF, height >> 8, 0x00,
+        LZW_MIN_CODE_SIZE
+    };
+
+    fwrite(header, 1, sizeof(header), file);
+
+    memset(encoder->children, 0, sizeof(encoder->children));
+    encoder->bits = 0;
+    encoder->bit_count = 0;
+    encoder->block_size = 0;
+
+    put_code(encoder, LZW_CLEAR, size);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int colour = encoder->pixels[y * width + x];
+
+            if (prefix == -1) {
+                prefix = colour;
+                continue;
+            }
+
+            if (encoder->children[prefix][colour] != 0) {
+                prefix = encoder->children[prefix][colour];
+                continue;
+            }
+
+            put_code(encoder, prefix, size);
+
+            encoder->children[prefix][colour] = ++next;
+
+            // The decoder adds its codes one step later, and widens them as
+            // soon as the next one would not fit.
+            if (next >= (1 << size)) {
+                size++;
+            }
+
+            if (next == LZW_MAX_CODE) {
+                put_code(encoder, LZW_CLEAR, size);
+                memset(encoder->children, 0, sizeof(encoder->children));
+                size = LZW_MIN_CODE_SIZE + 1;
+                next = LZW_END;
+            }
+
+            prefix = colour;
+        }
+    }
+
+    put_code(encoder, prefix, size);
+    put_code(encoder, LZW_END, size);
+
+    if (encoder->bit_count > 0) {
+        put_byte(encoder, encoder->bits & 0xFF);
+    }
+
+    if (encoder->block_size > 0) {
+        fputc(encoder->block_size, file);
+        fwrite(encoder->block, 1, encoder->block_size, file);
+    }
+
+    fputc(0, file);
+}
+
+/**
+ * Returns the time at which a frame is shown, in hundredths of a second.
+ */
+static uint64_t centiseconds(uint64_t frame) {
+    return frame * 100 / TIMER_HZ;
+}
+
+/**
+ * Writes the last frame, which is shown until the given frame.
+ */
+static void flush(struct encoder *encoder, uint64_t end) {
+    if (!encoder->pending) {
+        return;
+    }
+
+    if (encoder->capture->format == CAPTURE_Y4M) {
+        write_y4m(encoder, end - encoder->start);
+    } else {
+        write_gif(encoder, centiseconds(end) - centiseconds(encoder->start));
+    }
+}
+
+static void encode(struct encoder *encoder, const struct chippy_capture_frame *frame) {
+    // A GIF frame that would be shown too briefly is replaced by the next one.
+    if (encoder->pending
+        && encoder->capture->format == CAPTURE_GIF
+        && centiseconds(frame->frame) - centiseconds(encoder->start) < GIF_MIN_DELAY) {
+        expand(encoder->capture, frame, encoder->pixels);
+        return;
+    }
+
+    flush(encoder, frame->frame);
+    expand(encoder->capture, frame, encoder->pixels);
+
+    encoder->start = frame->frame;
+    encoder->pending = 1;
+}
+
+/**
+ * Encodes the oldest queued frame, and releases its slot right away so that
+ * the machine does not drop frames while the rest are encoded.
+ */
+static size_t encode_next(void *argument, size_t tail, size_t head) {
+    struct encoder *encoder = argument;
+
+    (void)head;
+    encode(encoder, &encoder->capture->ring[tail & (CAPTURE_FRAMES - 1)]);
+
+    return tail + 1;
+}
+
+/**
+ * Writes the header of the video.
+ */
+static int write_header(struct chippy_capture *capture) {
+    if (capture->format == CAPTURE_Y4M) {
+        return fprintf(capture->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", capture->width, capture->height, TIMER_HZ) < 0;
+    }
+
+    // The logical screen with a global colour table of 4 colours, and an
+    // application extension that loops the animation forever.
+    const uint8_t header[] = {
+        'G', 'I', 'F', '8', '9', 'a',
+        capture->width & 0xFF, capture->width >> 8, capture->height & 0xFF, capture->height >> 8, 0xF1, 0x00, 0x00,
+        palette[0], palette[0], palette[0], palette[1], palette[1], palette[1],
+        palette[2], palette[2], palette[2], palette[3], palette[3], palette[3],
+        0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+        0x03, 0x01, 0x00, 0x00, 0x00
+    };
+
+    return fwrite(header, 1, sizeof(header), capture->file) != sizeof(header);
+}
+
+struct chippy_capture *chippy_capture_open(const char *path, enum chippy_capture_format format, int scale) {
+    if (scale < 0 || scale > CAPTURE_MAX_SCALE) {
+        return NULL;
+    }
+
+    struct chippy_capture *capture = calloc(1, sizeof(struct chippy_capture));
+    struct encoder *encoder = calloc(1, sizeof(struct encoder));
+
+    if (capture == NULL || encoder == NULL) {
+        goto error;
+    }
+
+    if (scale == 0) {
+        scale = format == CAPTURE_GIF ? CAPTURE_GIF_SCALE : CAPTURE_Y4M_SCALE;
+    }
+
+    capture->format = format;
+    capture->scale = scale;
+    capture->width = HIRES_SCREEN_W * scale;
+    capture->height = HIRES_SCREEN_H * scale;
+    capture->file = fopen(path, "wb");
+    encoder->capture = capture;
+
+    memset(encoder->chroma, 128, sizeof(encoder->chroma));
+
+    if (capture->file == NULL || write_header(capture) != 0) {
+        goto error;
+    }
+
+    if (drain_start(&capture->drain, encode_next, encoder) != 0) {
+        goto error;
+    }
+
+    return capture;
+
+error:
+    if (capture != NULL && capture->file != NULL) {
+        fclose(capture->file);
+    }
+
+    free(encoder);
+    free(capture);
+
+    return NULL;
+}
+
+void chippy_capture_frame(struct chippy_capture *capture, const struct chippy *machine) {
+    size_t head = capture->drain.head;
+    const struct chippy_capture_frame *last = &capture->ring[(head - 1) & (CAPTURE_FRAMES - 1)];
+    uint64_t frame = capture->frames++;
+
+    // The framebuffer has not changed since the last frame when its generation
+    // is the same, and may still look the same when it is not.
+    if (head != 0
+        && last->hires == machine->hires
+        && (machine->gfx_generation == capture->generation
+            || memcmp(last->gfx, machine->gfx, sizeof(last->gfx)) == 0)) {
+        capture->generation = machine->gfx_generation;
+        return;
+    }
+
+    if (head - drain_tail(&capture->drain) == CAPTURE_FRAMES) {
+        capture->dropped++;
+        return;
+    }
+
+    struct chippy_capture_frame *slot = &capture->ring[head & (CAPTURE_FRAMES - 1)];
+
+    memcpy(slot->gfx, machine->gfx, sizeof(slot->gfx));
+    slot->hires = machine->hires;
+    slot->frame = frame;
+
+    capture->generation = machine->gfx_generation;
+
+    drain_publish(&capture->drain, head + 1);
+}
+
+int chippy_capture_close(struct chippy_capture *capture) {
+    struct encoder *encoder = capture->drain.context;
+    int status = EXIT_SUCCESS;
+
+    drain_stop(&capture->drain);
+
+    // Only now is it known for how long the last frame is shown.
+    flush(encoder, capture->frames);
+
+    if (capture->format == CAPTURE_GIF) {
+        fputc(0x3B, capture->file);
+    }
+
+    if (ferror(capture->file)) {
+        status = EXIT_FAILURE;
+    }
+
+    if (fclose(capture->file) != 0) {
+        status = EXIT_FAILURE;
+    }
+
+    free(encoder);
+    free(capture);
+
+    return status;
+}
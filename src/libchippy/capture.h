@@ -0,0 +1,110 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chippy.h"
+#include "drain.h"
+
+/**
+ * The number of frames that can be queued for the encoder, which must be a
+ * power of two.
+ */
+#define CAPTURE_FRAMES 64
+
+/**
+ * The largest size of a high resolution pixel in the video. Low resolution
+ * pixels are twice as large, so the video has the same size in both modes.
+ */
+#define CAPTURE_MAX_SCALE 4
+
+#define CAPTURE_MAX_W (HIRES_SCREEN_W * CAPTURE_MAX_SCALE)
+#define CAPTURE_MAX_H (HIRES_SCREEN_H * CAPTURE_MAX_SCALE)
+
+/**
+ * The default sizes of a high resolution pixel. Y4M is written at the native
+ * resolution, as it is uncompressed and players scale it anyway. GIFs are
+ * mostly shown at their own size, where a native frame would be too small to
+ * read, and compress repeated pixels well.
+ */
+#define CAPTURE_Y4M_SCALE 1
+#define CAPTURE_GIF_SCALE 4
+
+/**
+ * The formats a video can be written in.
+ */
+enum chippy_capture_format {
+    CAPTURE_Y4M,                        // Uncompressed YUV4MPEG2, at TIMER_HZ frames per second
+    CAPTURE_GIF                         // Animated GIF, which shows a frame for at least 1/50 s
+};
+
+/**
+ * A framebuffer as it was presented.
+ */
+struct chippy_capture_frame {
+    uint64_t gfx[GFX_PLANES][HIRES_SCREEN_H][GFX_WORDS];
+    uint64_t frame;                     // The number of the first frame that showed it
+    uint8_t hires;
+};
+
+/**
+ * A video of the frames presented by a machine. Frames are copied into a ring
+ * buffer, and a background thread encodes them. A frame that looks like the
+ * one before it is not queued at all, but shows the previous one for longer.
+ * When the encoder falls behind by CAPTURE_FRAMES frames, the machine drops
+ * frames rather than wait for it.
+ */
+struct chippy_capture {
+    struct chippy_capture_frame ring[CAPTURE_FRAMES];
+    struct drain drain;                 // Encoder thread, with frames queued and encoded
+
+    uint64_t frames;                    // Frames presented
+    uint64_t generation;                // gfx_generation of the last frame queued
+    uint64_t dropped;                   // Frames dropped because the queue was full
+
+    enum chippy_capture_format format;
+    int scale;                          // Size of a high resolution pixel
+    int width;                          // Size of the video, in pixels
+    int height;
+    FILE *file;
+};
+
+/**
+ * Opens a file to write a video to, and starts its encoder thread.
+ *
+ * @param path   The filepath to write the video to.
+ * @param format The format to write the video in.
+ * @param scale  The size of a high resolution pixel, up to CAPTURE_MAX_SCALE,
+ *               or 0 for the default of the format.
+ *
+ * @return Returns the capture, or NULL when the file could not be created or
+ *         the scale is out of range.
+ */
+struct chippy_capture *chippy_capture_open(const char *path, enum chippy_capture_format format, int scale);
+
+/**
+ * Adds the framebuffer of the machine as the next frame of the video. Never
+ * blocks: when the encoder is too far behind, the previous frame is shown for
+ * longer instead, and the frame is counted as dropped.
+ */
+void chippy_capture_frame(struct chippy_capture *capture, const struct chippy *machine);
+
+/**
+ * Encodes the remaining frames and closes the file.
+ *
+ * @return Returns EXIT_SUCCESS, or EXIT_FAILURE when the video could not be
+ *         written.
+ */
+int chippy_capture_close(struct chippy_capture *capture);
+
+#endif
@@ -8,238 +8,743 @@
  */
 
 #include "chippy.h"
+#include "jit.h"
+#include "ops.h"
+#include "profile.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define NNN(opcode) (opcode & 0x0FFF)
-#define KK(opcode)  (opcode & 0x00FF)
-#define N(opcode)   (opcode & 0x000F)
-#define X(opcode)   ((opcode >> 8) & 0x000F)
-#define Y(opcode)   ((opcode >> 4) & 0x000F)
-#define P(opcode)   (opcode >> 12)
+/**
+ * The fontset is a group of sprites reprisenting the hexadecimal digits 0
+ * through F. These sprites are 5 bytes long, or 8x5 pixels.
+ *
+ * The fontset should be stored in the interpreter area of the RAM (0x000 to
+ * 0x1FF).
+ */
+static const uint8_t fontset[80] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+/**
+ * The SUPER-CHIP font of 8x10 sprites for the digits 0 through 9, extended by
+ * XO-CHIP with the digits A through F. It follows the small font in the
+ * interpreter area.
+ */
+static const uint8_t big_fontset[160] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
 
 void chippy_init(struct chippy *machine) {
-    memcpy(machine->ram, fontset, sizeof(fontset));
+    memset(machine->ram, 0, sizeof(machine->ram));
+    memcpy(machine->ram + FONT_ADDRESS, fontset, sizeof(fontset));
+    memcpy(machine->ram + BIG_FONT_ADDRESS, big_fontset, sizeof(big_fontset));
+    memset(machine->V, 0, sizeof(machine->V));
     memset(machine->stack, 0, sizeof(machine->stack));
+    memset(machine->gfx, 0, sizeof(machine->gfx));
+    machine->keys = 0;
+    memset(machine->flags, 0, sizeof(machine->flags));
+    memset(machine->pattern, 0xF0, sizeof(machine->pattern));
+    machine->pitch = DEFAULT_PITCH;
+    machine->hires = 0;
+    machine->planes = 1;
+    machine->gfx_dirty = GFX_ALL_ROWS;
+    machine->gfx_generation = 0;
+    machine->I = 0;
     machine->pc = PROGRAM_START;
     machine->sp = 0;
     machine->wait_key = -1;
+    machine->wait_held = 0;
+
+    machine->dt = 0;
+    machine->st = 0;
+    machine->dt_cycle = 0;
+    machine->st_cycle = 0;
+    machine->cycles = 0;
+    machine->cycles_per_tick = DEFAULT_CYCLES_PER_TICK;
+
+    chippy_seed(machine, 0);
+
+    memset(machine->decoded, 0, sizeof(machine->decoded));
+
+    memset(machine->dirty, 0xFF, sizeof(machine->dirty));
+    machine->snapshot = NULL;
+    machine->snapshot_generation = 0;
+
+    machine->engine = JIT_SUPPORTED ? CHIPPY_ENGINE_JIT : CHIPPY_ENGINE_INTERPRETER;
+    machine->skip_idle = 1;
+    machine->jit = NULL;
+    machine->profile = NULL;
+    machine->trace = NULL;
+}
+
+void chippy_reset(struct chippy *machine) {
+    struct chippy_jit *jit = machine->jit;
+
+    chippy_init(machine);
+
+    if (jit != NULL) {
+        machine->jit = jit;
+        jit_invalidate(jit, 0, RAM_SIZE);
+    }
+}
+
+void chippy_seed(struct chippy *machine, uint64_t seed) {
+    // The xorshift state must not be zero, so the seed is scrambled first.
+    seed += UINT64_C(0x9E3779B97F4A7C15);
+    seed = (seed ^ (seed >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    seed = (seed ^ (seed >> 27)) * UINT64_C(0x94D049BB133111EB);
+    seed ^= seed >> 31;
+
+    machine->rng = seed != 0 ? seed : 1;
 }
 
 int chippy_load_rom(struct chippy *machine, const char *rom) {
+    // One byte more than fits is read, to tell a ROM that fills the program
+    // area from one that is too large.
+    uint8_t data[MAX_ROM_SIZE + 1];
     FILE *f = fopen(rom, "rb");
 
     if (f == NULL) {
-        fclose(f);
-        return EXIT_FAILURE;
+        return CHIPPY_ROM_UNREADABLE;
     }
 
-    fread(machine->ram + PROGRAM_START, 1, RAM_SIZE - PROGRAM_START, f);
+    size_t size = fread(data, 1, sizeof(data), f);
+    int error = ferror(f);
 
     fclose(f);
 
-    return EXIT_SUCCESS;
-}
+    if (error) {
+        return CHIPPY_ROM_UNREADABLE;
+    }
 
-int chippy_step(struct chippy *machine) {
-    uint16_t opcode = machine->ram[machine->pc] << 8
-                    | machine->ram[machine->pc + 1];
+    if (size == 0) {
+        return CHIPPY_ROM_EMPTY;
+    }
 
-    if (machine->wait_key != -1) {
-        machine->wait_key = -1;
+    if (size > MAX_ROM_SIZE) {
+        return CHIPPY_ROM_TOO_LARGE;
     }
 
-    machine->pc += 2;
+    memcpy(machine->ram + PROGRAM_START, data, size);
+    chippy_invalidate(machine, PROGRAM_START, size);
+
+    return CHIPPY_ROM_OK;
+}
+
+const char *chippy_rom_error_string(int error) {
+    switch (error) {
+        case CHIPPY_ROM_OK:         return "success";
+        case CHIPPY_ROM_UNREADABLE: return "could not read ROM";
+        case CHIPPY_ROM_EMPTY:      return "ROM is empty";
+        case CHIPPY_ROM_TOO_LARGE:  return "ROM does not fit in memory";
+    }
 
+    return "unknown error";
+}
+
+uint8_t chippy_decode_op(uint16_t opcode) {
     switch (opcode & 0xF000) {
         case 0x0000:
-            switch (opcode & 0x00FF) {
-                case 0x00E0: // CLS: Clears the screen.
-                    memset(machine->gfx, 0, sizeof(machine->gfx));
-                    break;
+            switch (KK(opcode)) {
+                case 0x00E0: return OP_CLS;
+                case 0x00EE: return OP_RET;
+                case 0x00FB: return OP_SCR;
+                case 0x00FC: return OP_SCL;
+                case 0x00FD: return OP_EXIT;
+                case 0x00FE: return OP_LOW;
+                case 0x00FF: return OP_HIGH;
+            }
 
-                case 0x00EE: // RET: Return from a subroutine.
-                    machine->pc = machine->stack[--machine->sp];
-                    break;
+            switch (opcode & 0xFFF0) {
+                case 0x00C0: return OP_SCD;
+                case 0x00D0: return OP_SCU;
             }
-            break;
+            return OP_NOP;
+
+        case 0x1000: return OP_JP;
+        case 0x2000: return OP_CALL;
+        case 0x3000: return OP_SE_XKK;
+        case 0x4000: return OP_SNE_XKK;
+
+        case 0x5000:
+            switch (N(opcode)) {
+                case 0x0000: return OP_SE_XY;
+                case 0x0002: return OP_SAVE_XY;
+                case 0x0003: return OP_LOAD_XY;
+            }
+            return OP_NOP;
 
-        case 0x1000: // JP: Jump to location NNN.
-            machine->pc = NNN(opcode);
-            break;
+        case 0x6000: return OP_LD_XKK;
+        case 0x7000: return OP_ADD_XKK;
 
-        case 0x2000: // CALL: Call subroutine at NNN.
-            machine->stack[machine->sp++] = machine->pc;
-            machine->pc = NNN(opcode);
-            break;
+        case 0x8000:
+            switch (N(opcode)) {
+                case 0x0001: return OP_LD_XY;
+                case 0x0002: return OP_OR;
+                case 0x0003: return OP_XOR;
+                case 0x0004: return OP_ADD_XY;
+                case 0x0005: return OP_SUB;
+                case 0x0006: return OP_SHR;
+                case 0x0007: return OP_SUBN;
+                case 0x000E: return OP_SHL;
+            }
+            return OP_NOP;
 
-        case 0x3000: // SE: Skip next instruction if VX == KK.
-            if (machine->V[X(opcode)] == KK(opcode)) {
-                machine->pc += 2;
+        case 0x9000: return OP_SNE_XY;
+        case 0xA000: return OP_LD_I;
+        case 0xB000: return OP_JP_V0;
+        case 0xC000: return OP_RND;
+        case 0xD000: return OP_DRW;
+
+        case 0xE000:
+            switch (KK(opcode)) {
+                case 0x009E: return OP_SKP;
+                case 0x00A1: return OP_SKNP;
             }
-            break;
+            return OP_NOP;
 
-        case 0x4000: // SNE: Skip next instruction if VX != KK.
-            if (machine->V[X(opcode)] != KK(opcode)) {
-                machine->pc += 2;
+        case 0xF000:
+            if (opcode == 0xF000) {
+                return OP_LD_I_LONG;
             }
-            break;
 
-        case 0x5000: // SE: Skip next instruction if VX == VY.
-            if (machine->V[X(opcode)] == machine->V[Y(opcode)]) {
-                machine->pc += 2;
+            if (opcode == 0xF002) {
+                return OP_AUDIO;
             }
-            break;
 
-        case 0x6000: // LD: Set VX = KK.
-            machine->V[X(opcode)] = KK(opcode);
-            break;
+            switch (KK(opcode)) {
+                case 0x0001: return OP_PLANE;
+                case 0x0007: return OP_LD_X_DT;
+                case 0x000A: return OP_LD_X_K;
+                case 0x0015: return OP_LD_DT_X;
+                case 0x0018: return OP_LD_ST_X;
+                case 0x001E: return OP_ADD_I;
+                case 0x0029: return OP_LD_F;
+                case 0x0030: return OP_LD_HF;
+                case 0x0033: return OP_LD_B;
+                case 0x003A: return OP_PITCH;
+                case 0x0055: return OP_LD_MEM_X;
+                case 0x0065: return OP_LD_X_MEM;
+                case 0x0075: return OP_LD_R_X;
+                case 0x0085: return OP_LD_X_R;
+            }
+            return OP_NOP;
+    }
 
-        case 0x7000: // ADD: Set VX = VX + KK.
-            machine->V[X(opcode)] += KK(opcode);
-            break;
+    return OP_NOP;
+}
 
-        case 0x8000:
-            switch (opcode & 0x000F) {
-                case 0x0001: // LD: Set VX = VY.
-                    machine->V[X(opcode)] = machine->V[Y(opcode)];
-                    break;
+static void decode(struct chippy *machine, uint16_t address, struct chippy_insn *insn) {
+    uint16_t opcode = machine->ram[address & (RAM_SIZE - 1)] << 8
+                    | machine->ram[(address + 1) & (RAM_SIZE - 1)];
 
-                case 0x0002: // OR: Set VX = VX | VY.
-                    machine->V[X(opcode)] |= machine->V[Y(opcode)];
-                    break;
+    ops_decode(opcode, insn);
+}
 
-                case 0x0003: // XOR: Set VX = VX ^ VY.
-                    machine->V[X(opcode)] ^= machine->V[Y(opcode)];
-                    break;
+/**
+ * Discards the decoded and translated instructions overlapping the given
+ * memory range, without marking it as written to.
+ */
+static void discard(struct chippy *machine, uint16_t address, uint32_t length) {
+    // The instruction starting one byte before the range overlaps it as well.
+    for (uint32_t i = 0; i <= length; i++) {
+        machine->decoded[(address - 1 + i) & (RAM_SIZE - 1)].op = OP_DECODE;
+    }
 
-                case 0x0004: // ADD: Set VX = VX + VY, set VF = carry.
-                    machine->V[0xF] = (machine->V[X(opcode)] + machine->V[Y(opcode)]) > 255;
-                    machine->V[X(opcode)] += machine->V[Y(opcode)];
-                    break;
+    if (machine->jit != NULL) {
+        jit_invalidate(machine->jit, address, length);
+    }
+}
 
-                case 0x0005: // SUB: Set VX = VX - VY, set VF = NOT borrow.
-                    machine->V[0xF] = machine->V[X(opcode)] > machine->V[Y(opcode)];
-                    machine->V[X(opcode)] -= machine->V[Y(opcode)];
-                    break;
+void chippy_invalidate(struct chippy *machine, uint16_t address, uint32_t length) {
+    discard(machine, address, length);
 
-                case 0x0006: // SHR: Set VX = VX >> 1, set VF = LSB.
-                    machine->V[0xF] = machine->V[X(opcode)] & 1;
-                    machine->V[X(opcode)] >>= 1;
-                    break;
+    if (length == 0) {
+        return;
+    }
 
-                case 0x0007: // SUBN: Set VX = VY - VX, set VF = NOT borrow.
-                    machine->V[0xF] = machine->V[Y(opcode)] > machine->V[X(opcode)];
-                    machine->V[X(opcode)] = machine->V[Y(opcode)] - machine->V[X(opcode)];
-                    break;
+    uint32_t first = address / RAM_PAGE_SIZE;
+    uint32_t last = first + ((address % RAM_PAGE_SIZE) + length - 1) / RAM_PAGE_SIZE;
 
-                case 0x000E: // SHL: Set VX = VX << 1, set VF = MSB.
-                    machine->V[0xF] = (machine->V[X(opcode)] & 0x80) != 0;
-                    machine->V[X(opcode)] <<= 1;
-                    break;
-            }
-            break;
+    for (uint32_t page = first; page <= last; page++) {
+        uint32_t wrapped = page % RAM_PAGES;
 
-        case 0x9000: // SNE: Skip next instruction if VX != VY.
-            if (machine->V[X(opcode)] != machine->V[Y(opcode)]) {
-                machine->pc += 2;
-            }
-            break;
+        machine->dirty[wrapped / 64] |= UINT64_C(1) << (wrapped % 64);
+    }
+}
+
+/**
+ * Ends the wait of a machine at FX0A when a key was pressed since it started
+ * waiting, and stores the key in VX. Keys that were held when the wait started
+ * only count once they were released.
+ *
+ * @return Returns 1 when the machine is still waiting, otherwise 0.
+ */
+static int still_waiting(struct chippy *machine) {
+    uint16_t pressed = machine->keys & ~machine->wait_held;
+
+    machine->wait_held &= machine->keys;
 
-        case 0xA000: // LD: Set I = NNN.
-            machine->I = NNN(opcode);
-            break;
+    if (pressed == 0) {
+        return 1;
+    }
 
-        case 0xB000: // JP: Jump to location NNN + V0.
-            machine->pc = NNN(opcode) + machine->V[0];
-            break;
+    // The lowest key wins when several were pressed at once.
+    machine->V[machine->wait_key] = __builtin_ctz(pressed);
+    machine->wait_key = -1;
 
-        case 0xC000: // RND: Set VX = random byte & KK.
-            machine->V[X(opcode)] = rand() & KK(opcode);
-            break;
+    return 0;
+}
 
-        case 0xD000: // DRW: Display N-byte sprite starting at address I at (VX, VY), set VF = collision.
-            for (int y = 0; y < N(opcode); y++) {
-                uint8_t sprite = machine->ram[machine->I + y];
+#define INTERPRET interpret
+#define PROFILE 0
+#define TRACE 0
+#include "interpret.h"
+#undef TRACE
+#undef PROFILE
+#undef INTERPRET
+
+#define INTERPRET interpret_traced
+#define PROFILE 0
+#define TRACE 1
+#include "interpret.h"
+#undef TRACE
+#undef PROFILE
+#undef INTERPRET
+
+#if defined(CHIPPY_PROFILER)
+#define INTERPRET interpret_profiled
+#define PROFILE 1
+#define TRACE 0
+#include "interpret.h"
+#undef TRACE
+#undef PROFILE
+#undef INTERPRET
+#endif
 
-                for (int x = 0; x < 8; x++) {
-                    int pixel = (sprite & (1 << (7 - x))) != 0;
-                    int xpos = machine->V[X(opcode)] + x;
-                    int ypos = machine->V[Y(opcode)] + y;
-                    int pos = SCREEN_W * ypos + xpos;
+/**
+ * Interprets the given number of cycles, on the traced or profiled
+ * interpreter when a trace or profiler is attached.
+ */
+static int run_interpreter(struct chippy *machine, unsigned long cycles) {
+    if (machine->trace != NULL) {
+        return interpret_traced(machine, cycles);
+    }
+
+#if defined(CHIPPY_PROFILER)
+    if (machine->profile != NULL) {
+        return interpret_profiled(machine, cycles);
+    }
+#endif
 
-                    machine->V[0xF] |= machine->gfx[pos] & pixel;
-                    machine->gfx[pos] ^= pixel;
-                }
+    return interpret(machine, cycles);
+}
+
+int chippy_step(struct chippy *machine) {
+    if (machine->wait_key != -1 && still_waiting(machine)) {
+        machine->cycles++;
+        return CHIPPY_WAITING;
+    }
+
+    return run_interpreter(machine, 1);
+}
+
+uint8_t chippy_get_delay_timer(const struct chippy *machine) {
+    return ops_timer_value(machine->dt, machine->dt_cycle, machine->cycles, machine->cycles_per_tick);
+}
+
+uint8_t chippy_get_sound_timer(const struct chippy *machine) {
+    return ops_timer_value(machine->st, machine->st_cycle, machine->cycles, machine->cycles_per_tick);
+}
+
+uint64_t chippy_get_sound_end(const struct chippy *machine) {
+    if (machine->st == 0) {
+        return machine->st_cycle;
+    }
+
+    // The timer counts down on tick boundaries, not st cycles after being set.
+    return (machine->st_cycle / machine->cycles_per_tick + machine->st) * machine->cycles_per_tick;
+}
+
+uint64_t chippy_cycles_until_tick(const struct chippy *machine) {
+    return machine->cycles_per_tick - machine->cycles % machine->cycles_per_tick;
+}
+
+/**
+ * The longest loop, in cycles, that chippy_run_cycles() recognizes as idle.
+ */
+#define IDLE_MAX_PERIOD 16
+
+/**
+ * The minimum number of cycles between two attempts to recognize an idle loop,
+ * which bounds the cost of the attempts for programs that are busy.
+ */
+#define IDLE_INTERVAL 65536
+
+/**
+ * The results of an attempt to skip an idle loop.
+ */
+enum idle_result {
+    IDLE_BUSY,                          // Not in a loop of idle instructions
+    IDLE_CHANGED,                       // In such a loop, but the registers changed
+    IDLE_SKIPPED                        // Iterations were skipped
+};
+
+/**
+ * Returns whether an instruction leaves no trace when it is executed again with
+ * the same registers: it only reads memory and the timers, and writes nothing
+ * but registers that are compared between iterations.
+ */
+static int idle_op(uint8_t op) {
+    switch (op) {
+        case OP_NOP:
+        case OP_RET:
+        case OP_JP:
+        case OP_CALL:
+        case OP_SE_XKK:
+        case OP_SNE_XKK:
+        case OP_SE_XY:
+        case OP_LD_XKK:
+        case OP_ADD_XKK:
+        case OP_LD_XY:
+        case OP_OR:
+        case OP_XOR:
+        case OP_ADD_XY:
+        case OP_SUB:
+        case OP_SHR:
+        case OP_SUBN:
+        case OP_SHL:
+        case OP_SNE_XY:
+        case OP_LD_I:
+        case OP_JP_V0:
+        case OP_SKP:
+        case OP_SKNP:
+        case OP_LD_X_DT:
+        case OP_ADD_I:
+        case OP_LD_F:
+        case OP_LD_X_MEM:
+        case OP_EXIT:
+        case OP_LOAD_XY:
+        case OP_LD_I_LONG:
+        case OP_LD_HF:
+        case OP_LD_X_R:
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Executes one iteration of the loop at the program counter, if the machine is
+ * in a loop of idle instructions, and skips as many further iterations as
+ * possible.
+ *
+ * An iteration that ends in the same registers it started with will repeat
+ * identically for as long as the delay timer reads the same, so iterations are
+ * skipped up to the next tick, or up to the end of the budget when the delay
+ * timer is already zero. Skipped iterations only advance the cycle counter.
+ *
+ * @return Returns one of enum idle_result. The cycles that were executed or
+ *         skipped are subtracted from the budget either way.
+ */
+static enum idle_result skip_idle_loop(struct chippy *machine, unsigned long *cycles) {
+    uint8_t V[16];
+    uint16_t stack[16];
+    uint16_t pc = machine->pc;
+    uint16_t I = machine->I;
+    uint16_t sp = machine->sp;
+    uint64_t tick = (machine->cycles / machine->cycles_per_tick + 1) * machine->cycles_per_tick;
+    uint8_t dt = chippy_get_delay_timer(machine);
+    unsigned long period = 0;
+
+    memcpy(V, machine->V, sizeof(V));
+    memcpy(stack, machine->stack, sizeof(stack));
+
+    do {
+        uint16_t address = machine->pc & (RAM_SIZE - 1);
+
+        if (period == *cycles || period == IDLE_MAX_PERIOD) {
+            *cycles -= period;
+            return IDLE_BUSY;
+        }
+
+        if (!idle_op(chippy_decode_op(machine->ram[address] << 8 | machine->ram[(address + 1) & (RAM_SIZE - 1)]))) {
+            *cycles -= period;
+            return IDLE_BUSY;
+        }
+
+        interpret(machine, 1);
+        period++;
+    } while (machine->pc != pc);
+
+    *cycles -= period;
+
+    if (machine->I != I
+        || machine->sp != sp
+        || memcmp(machine->V, V, sizeof(V)) != 0
+        || memcmp(machine->stack, stack, sizeof(stack)) != 0) {
+        return IDLE_CHANGED;
+    }
+
+    uint64_t iterations = *cycles / period;
+
+    // The timer must read the same in the iteration that was executed and in
+    // all that are skipped.
+    if (dt != 0) {
+        if (machine->cycles > tick) {
+            return IDLE_CHANGED;
+        }
+
+        iterations = (tick - machine->cycles) / period < iterations ? (tick - machine->cycles) / period : iterations;
+    }
+
+    if (iterations == 0) {
+        return IDLE_CHANGED;
+    }
+
+    machine->cycles += iterations * period;
+    *cycles -= iterations * period;
+
+    return IDLE_SKIPPED;
+}
+
+/**
+ * Runs the selected engine for the given number of cycles.
+ */
+static int run_engine(struct chippy *machine, unsigned long cycles) {
+    if (machine->engine == CHIPPY_ENGINE_JIT && machine->jit == NULL) {
+        machine->jit = jit_create();
+    }
+
+    while (cycles > 0) {
+        if (machine->jit != NULL && machine->engine == CHIPPY_ENGINE_JIT) {
+            cycles = jit_run(machine, cycles);
+
+            if (machine->wait_key != -1) {
+                machine->cycles += cycles;
+                return CHIPPY_WAITING;
             }
-            break;
 
-        case 0xE000:
-            switch (opcode & 0x000F) {
-                case 0x009E: // SKP: Skip next instruction if key with the value of VX is pressed.
-                    break;
+            if (cycles == 0) {
+                break;
+            }
 
-                case 0x00A1: // SKNP: Skip next instruction if key with the value of VX is not pressed.
-                    break;
+            // The JIT stopped at something it cannot translate.
+            if (interpret(machine, 1) == CHIPPY_WAITING) {
+                machine->cycles += cycles - 1;
+                return CHIPPY_WAITING;
             }
-            break;
 
-        case 0xF000:
-            switch (opcode & 0x000F) {
-                case 0x0007: // LD: Set VX = delay timer value.
-                    machine->V[X(opcode)] = machine->dt;
-                    break;
+            cycles--;
+        } else {
+            return interpret(machine, cycles);
+        }
+    }
 
-                case 0x000A: // LD: Wait for a key press, store the value of the key in VX.
-                    machine->wait_key = X(opcode);
-                    break;
+    return EXIT_SUCCESS;
+}
 
-                case 0x0015: // LD: Set delay timer = VX.
-                    machine->dt = machine->V[X(opcode)];
-                    break;
+int chippy_run_cycles(struct chippy *machine, unsigned long cycles) {
+    if (cycles == 0) {
+        return EXIT_SUCCESS;
+    }
 
-                case 0x0018: // LD: Set sound timer = VX.
-                    machine->st = machine->V[X(opcode)];
-                    break;
+    if (machine->wait_key != -1 && still_waiting(machine)) {
+        machine->cycles += cycles;
+        return CHIPPY_WAITING;
+    }
 
-                case 0x001E: // ADD: Set I = I + VX.
-                    machine->I += machine->V[X(opcode)];
-                    break;
+    // Translated code cannot be traced or profiled, and the trace and profile
+    // must contain every instruction.
+    if (machine->trace != NULL || machine->profile != NULL) {
+        return run_interpreter(machine, cycles);
+    }
 
-                case 0x0029: // LD: Set I = location of sprite for digit VX.
-                    machine->I = machine->V[X(opcode)] * 5;
-                    break;
+    if (!machine->skip_idle) {
+        return run_engine(machine, cycles);
+    }
+
+    while (cycles > 0) {
+        // Idle loops are looked for after a tick at least IDLE_INTERVAL
+        // cycles away. A loop that just read a new timer value changes its
+        // registers once, so it gets a second chance.
+        int chances = 2;
 
-                case 0x0033: // LD: Store BCD representation of VX in memory locations I, I+1 and I+2.
-                    machine->ram[machine->I] = X(opcode) / 100;
-                    machine->ram[machine->I + 1] = (X(opcode) / 10) % 10;
-                    machine->ram[machine->I + 2] = X(opcode) % 10;
+        while (cycles > 0 && chances > 0) {
+            switch (skip_idle_loop(machine, &cycles)) {
+                case IDLE_SKIPPED:
+                    chances = 2;
                     break;
 
-                case 0x0055: // LD: Store registers V0 through VX in memory starting at address I.
-                    for (int i = 0; i <= X(opcode); i++) {
-                        machine->ram[machine->I + i] = machine->V[i];
-                    }
+                case IDLE_CHANGED:
+                    chances--;
                     break;
 
-                case 0x0065: // LD: Read registers V0 through VX from memory starting at address I.
-                    for (int i = 0; i <= X(opcode); i++) {
-                        machine->V[i] = machine->ram[machine->I + i];
-                    }
+                case IDLE_BUSY:
+                    chances = 0;
                     break;
             }
-            break;
+        }
+
+        uint64_t until = chippy_cycles_until_tick(machine);
+
+        if (until < IDLE_INTERVAL) {
+            until += (IDLE_INTERVAL - until + machine->cycles_per_tick - 1) / machine->cycles_per_tick * machine->cycles_per_tick;
+        }
+
+        unsigned long slice = until < cycles ? until : cycles;
+
+        if (slice > 0) {
+            int status = run_engine(machine, slice);
+
+            if (status == CHIPPY_WAITING) {
+                machine->cycles += cycles - slice;
+                return CHIPPY_WAITING;
+            }
+        }
 
-        default:
-            printf("Invalid opcode 0x%X at address 0x%X.\n", opcode, machine->pc - 2);
-            return EXIT_FAILURE;
+        cycles -= slice;
     }
 
     return EXIT_SUCCESS;
 }
 
+static uint64_t generations = 0;
+
+static uint64_t next_generation(void) {
+#if defined(__GNUC__)
+    return __atomic_add_fetch(&generations, 1, __ATOMIC_RELAXED);
+#else
+    return ++generations;
+#endif
+}
+
+/**
+ * Returns whether the dirty pages of the machine refer to the given snapshot.
+ */
+static int based_on(const struct chippy *machine, const struct chippy_snapshot *snapshot) {
+    return machine->snapshot == snapshot && machine->snapshot_generation == snapshot->generation;
+}
+
+void chippy_snapshot(struct chippy *machine, struct chippy_snapshot *snapshot) {
+    if (based_on(machine, snapshot)) {
+        for (uint32_t page = 0; page < RAM_PAGES; page++) {
+            if (machine->dirty[page / 64] & UINT64_C(1) << (page % 64)) {
+                memcpy(snapshot->ram + page * RAM_PAGE_SIZE, machine->ram + page * RAM_PAGE_SIZE, RAM_PAGE_SIZE);
+            }
+        }
+    } else {
+        memcpy(snapshot->ram, machine->ram, sizeof(snapshot->ram));
+    }
+
+    memcpy(snapshot->V, machine->V, sizeof(snapshot->V));
+    snapshot->dt = machine->dt;
+    snapshot->st = machine->st;
+    snapshot->dt_cycle = machine->dt_cycle;
+    snapshot->st_cycle = machine->st_cycle;
+    snapshot->cycles = machine->cycles;
+    snapshot->cycles_per_tick = machine->cycles_per_tick;
+    snapshot->pc = machine->pc;
+    snapshot->I = machine->I;
+    snapshot->sp = machine->sp;
+    memcpy(snapshot->stack, machine->stack, sizeof(snapshot->stack));
+    memcpy(snapshot->gfx, machine->gfx, sizeof(snapshot->gfx));
+    snapshot->hires = machine->hires;
+    snapshot->planes = machine->planes;
+    snapshot->keys = machine->keys;
+    snapshot->wait_key = machine->wait_key;
+    snapshot->wait_held = machine->wait_held;
+    memcpy(snapshot->flags, machine->flags, sizeof(snapshot->flags));
+    memcpy(snapshot->pattern, machine->pattern, sizeof(snapshot->pattern));
+    snapshot->pitch = machine->pitch;
+    snapshot->rng = machine->rng;
+
+    // Other machines restored from this snapshot can no longer rely on their
+    // dirty pages, so the snapshot gets a new generation. Generations are
+    // unique, so that a new snapshot at the address of a freed one is never
+    // mistaken for it.
+    snapshot->generation = next_generation();
+
+    memset(machine->dirty, 0, sizeof(machine->dirty));
+    machine->snapshot = snapshot;
+    machine->snapshot_generation = snapshot->generation;
+}
+
+void chippy_restore(struct chippy *machine, const struct chippy_snapshot *snapshot) {
+    if (based_on(machine, snapshot)) {
+        for (uint32_t page = 0; page < RAM_PAGES; page++) {
+            if (machine->dirty[page / 64] & UINT64_C(1) << (page % 64)) {
+                memcpy(machine->ram + page * RAM_PAGE_SIZE, snapshot->ram + page * RAM_PAGE_SIZE, RAM_PAGE_SIZE);
+                discard(machine, page * RAM_PAGE_SIZE, RAM_PAGE_SIZE);
+            }
+        }
+    } else {
+        memcpy(machine->ram, snapshot->ram, sizeof(machine->ram));
+        discard(machine, 0, RAM_SIZE);
+    }
+
+    memcpy(machine->V, snapshot->V, sizeof(machine->V));
+    machine->dt = snapshot->dt;
+    machine->st = snapshot->st;
+    machine->dt_cycle = snapshot->dt_cycle;
+    machine->st_cycle = snapshot->st_cycle;
+    machine->cycles = snapshot->cycles;
+    machine->cycles_per_tick = snapshot->cycles_per_tick;
+    machine->pc = snapshot->pc;
+    machine->I = snapshot->I;
+    machine->sp = snapshot->sp;
+    memcpy(machine->stack, snapshot->stack, sizeof(machine->stack));
+    memcpy(machine->gfx, snapshot->gfx, sizeof(machine->gfx));
+    chippy_invalidate_gfx(machine, GFX_ALL_ROWS);
+    machine->hires = snapshot->hires;
+    machine->planes = snapshot->planes;
+    machine->keys = snapshot->keys;
+    machine->wait_key = snapshot->wait_key;
+    machine->wait_held = snapshot->wait_held;
+    memcpy(machine->flags, snapshot->flags, sizeof(machine->flags));
+    memcpy(machine->pattern, snapshot->pattern, sizeof(machine->pattern));
+    machine->pitch = snapshot->pitch;
+    machine->rng = snapshot->rng;
+
+    memset(machine->dirty, 0, sizeof(machine->dirty));
+    machine->snapshot = snapshot;
+    machine->snapshot_generation = snapshot->generation;
+}
+
 void chippy_destroy(struct chippy *machine) {
+    jit_destroy(machine->jit);
     free(machine);
 }
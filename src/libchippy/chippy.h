@@ -11,6 +11,7 @@
 #define __CHIPPY_H__
 
 #include <stdint.h>
+#include <stdio.h>
 
 /**
  * The location where CHIP-8 programs start. The first 512 bytes (0x000 to
@@ -21,55 +22,174 @@
 
 /**
  * This is the maximum amount of addressable memory by the machine. The CHIP-8
- * language is capable of accessing up to 4kB of RAM.
+ * language is capable of accessing up to 4kB of RAM, and XO-CHIP programs up
+ * to 64kB. CHIP-8 and SUPER-CHIP programs only use the first 4kB.
  */
-#define RAM_SIZE 0x1000
+#define RAM_SIZE 0x10000
+
+/**
+ * The largest ROM that fits in memory after the interpreter area.
+ */
+#define MAX_ROM_SIZE (RAM_SIZE - PROGRAM_START)
+
+/**
+ * For snapshots, RAM is divided into pages of 256 bytes. Only the pages that
+ * were written to since a snapshot are copied back when restoring it.
+ */
+#define RAM_PAGE_SIZE 0x100
+#define RAM_PAGES (RAM_SIZE / RAM_PAGE_SIZE)
 
 /**
  * The original implementation of the CHIP-8 language used a 64x32-pixel
- * monochrome display.
+ * monochrome display. SUPER-CHIP added a 128x64-pixel high resolution mode,
+ * and XO-CHIP a second bitplane, for four colours.
  */
 #define SCREEN_W 64
 #define SCREEN_H 32
+#define HIRES_SCREEN_W 128
+#define HIRES_SCREEN_H 64
+#define GFX_PLANES 2
+
+/**
+ * The addresses of the 8x5 hexadecimal font and the 8x10 SUPER-CHIP font in
+ * the interpreter area.
+ */
+#define FONT_ADDRESS 0x000
+#define BIG_FONT_ADDRESS 0x050
+
+/**
+ * The delay and sound timers count down at 60 Hz. Time is measured in
+ * instruction cycles, so a tick lasts cycles_per_tick cycles, which defaults
+ * to the number of instructions the original interpreters executed per tick.
+ */
+#define TIMER_HZ 60
+#define DEFAULT_CYCLES_PER_TICK 11
+
+/**
+ * XO-CHIP plays a pattern of AUDIO_PATTERN_BITS one-bit samples while the
+ * sound timer runs, at 4000 * 2^((pitch - 64) / 48) samples per second. The
+ * default pattern is a square wave, which sounds at 500 Hz at the default
+ * pitch.
+ */
+#define AUDIO_PATTERN_SIZE 16
+#define AUDIO_PATTERN_BITS (AUDIO_PATTERN_SIZE * 8)
+#define DEFAULT_PITCH 64
 
 /**
- * The fontset is a group of sprites reprisenting the hexadecimal digits 0
- * through F. These sprites are 5 bytes long, or 8x5 pixels.
- *
- * The fontset should be stored in the interpreter area of the RAM (0x000 to
- * 0x1FF).
- */
-static uint8_t fontset[80] = {
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+ * Each row of a bitplane is stored as GFX_WORDS 64-bit words, where the most
+ * significant bit of the first word is the leftmost pixel. In low resolution
+ * only the first word of the first SCREEN_H rows is used, so drawing costs the
+ * same as on a 64x32 display.
+ */
+#define GFX_WORDS (HIRES_SCREEN_W / 64)
+#define GFX_ROW_BIT(x) (UINT64_C(0x8000000000000000) >> ((x) % 64))
+
+/**
+ * Changed framebuffer rows are tracked as a mask with bit N for row N, which
+ * covers the HIRES_SCREEN_H rows of the high resolution mode.
+ */
+#define GFX_ALL_ROWS UINT64_MAX
+
+/**
+ * Returned by chippy_step() and chippy_run_cycles() when the machine is waiting
+ * for a key press at FX0A. Time passes while a machine waits, so the remaining
+ * cycles are spent and the timers keep counting down. The machine continues
+ * once a key that was not held when it started waiting is pressed.
+ */
+#define CHIPPY_WAITING 2
+
+/**
+ * The engines that can execute instructions in chippy_run_cycles(). The JIT
+ * compiler translates basic blocks into native code on x86-64 hosts, and falls
+ * back to the interpreter for anything it cannot translate.
+ */
+enum chippy_engine {
+    CHIPPY_ENGINE_INTERPRETER,
+    CHIPPY_ENGINE_JIT
 };
 
-typedef int (*keyboard_poller)(int);
+/**
+ * The results of loading a ROM. Every error is non-zero.
+ */
+enum chippy_rom_error {
+    CHIPPY_ROM_OK = 0,
+    CHIPPY_ROM_UNREADABLE,              // The file could not be opened or read
+    CHIPPY_ROM_EMPTY,                   // The file is empty
+    CHIPPY_ROM_TOO_LARGE                // The file is larger than MAX_ROM_SIZE
+};
+
+/**
+ * A pre-decoded instruction. Every address in RAM has one slot, which is filled
+ * the first time the instruction at that address is executed. The operands are
+ * extracted once, so executing a cached instruction only needs a single
+ * indirect jump to its handler.
+ */
+struct chippy_insn {
+    uint8_t op;                         // Handler index, 0 when not yet decoded
+    uint8_t x;                          // Register X
+    uint8_t y;                          // Register Y
+    uint8_t n;                          // Lowest nibble
+    uint8_t kk;                         // Lowest byte
+    uint16_t nnn;                       // Lowest 12 bits
+};
+
+/**
+ * A copy of the architectural state of a machine, taken by chippy_snapshot().
+ * Caches and host settings such as the engine are not part of a snapshot.
+ */
+struct chippy_snapshot {
+    uint8_t ram[RAM_SIZE];
+    uint8_t V[16];
+
+    uint8_t dt;
+    uint8_t st;
+
+    uint64_t dt_cycle;
+    uint64_t st_cycle;
+
+    uint64_t cycles;
+    uint32_t cycles_per_tick;
+
+    uint16_t pc;
+    uint16_t I;
+
+    uint16_t sp;
+    uint16_t stack[16];
+
+    uint64_t gfx[GFX_PLANES][HIRES_SCREEN_H][GFX_WORDS];
+    uint8_t hires;
+    uint8_t planes;
+    uint16_t keys;
+
+    int8_t wait_key;
+    uint16_t wait_held;
+
+    uint8_t flags[16];
+
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+    uint8_t pitch;
+
+    uint64_t rng;
+
+    uint64_t generation;                // Unique number, renewed every time it is taken
+};
 
 /**
  * This is the main data structure for holding information and state about the
  * machine.
  */
 struct chippy {
-    uint8_t ram[RAM_SIZE];              // Memory (4kB)
+    uint8_t ram[RAM_SIZE];              // Memory (64kB)
     uint8_t V[16];                      // 16 general purpose 8-bit registers
 
-    uint8_t dt;                         // Delay timer
-    uint8_t st;                         // Sound timer
+    uint8_t dt;                         // Delay timer, as last set
+    uint8_t st;                         // Sound timer, as last set
+
+    uint64_t dt_cycle;                  // Cycle at which the delay timer was set
+    uint64_t st_cycle;                  // Cycle at which the sound timer was set
+
+    uint64_t cycles;                    // Number of cycles executed
+    uint32_t cycles_per_tick;           // Number of cycles per timer tick
 
     uint16_t pc;                        // Program counter
     uint16_t I;                         // Index register
@@ -77,41 +197,309 @@ struct chippy {
     uint16_t sp;                        // Stack pointer
     uint16_t stack[16];                 // Stack
 
-    uint8_t gfx[SCREEN_W * SCREEN_H];   // Graphics buffer
-    uint8_t key[16];                    // Keypad
+    uint64_t gfx[GFX_PLANES][HIRES_SCREEN_H][GFX_WORDS]; // Bitplanes, GFX_WORDS words per row
+    uint8_t hires;                      // Whether the display is in 128x64 mode
+    uint8_t planes;                     // Bitplanes selected for drawing, a mask
+    uint64_t gfx_dirty;                 // Rows changed since the frontend cleared this
+    uint64_t gfx_generation;            // Incremented every time the framebuffer may change
+    uint16_t keys;                      // Keypad, bit N is set while key N is held
 
-    int8_t wait_key;                    // Whether to wait until a key press
+    int8_t wait_key;                    // Register to store a key press in, -1 when not waiting
+    uint16_t wait_held;                 // Keys held while waiting, which do not count as a press
 
-    keyboard_poller keydown;            // Keyboard poller
+    uint8_t flags[16];                  // SUPER-CHIP persistent flag registers
+
+    uint8_t pattern[AUDIO_PATTERN_SIZE]; // XO-CHIP audio pattern, most significant bit first
+    uint8_t pitch;                      // XO-CHIP audio pitch
+
+    uint64_t rng;                       // Random number generator state
+
+    struct chippy_insn decoded[RAM_SIZE]; // Decoded instruction cache
+
+    uint64_t dirty[(RAM_PAGES + 63) / 64]; // RAM pages written since the snapshot
+    const struct chippy_snapshot *snapshot; // Snapshot the dirty pages refer to
+    uint64_t snapshot_generation;       // Generation of that snapshot
+
+    enum chippy_engine engine;          // Engine used by chippy_run_cycles()
+    int skip_idle;                      // Whether chippy_run_cycles() skips idle loops
+    struct chippy_jit *jit;             // JIT compiler state, created on use
+
+    struct chippy_profile *profile;     // Profiler, NULL when not profiling
+    struct chippy_trace *trace;         // Execution trace, NULL when not tracing
 };
 
 /**
- * Initializes a machine data structure. This function can
- * also be called to reinitialize the machine.
+ * Returns the width of the display in its current mode.
+ *
+ * @param machine The machine to query.
+ *
+ * @return Returns SCREEN_W or HIRES_SCREEN_W.
+ */
+static inline int chippy_screen_width(const struct chippy *machine) {
+    return machine->hires ? HIRES_SCREEN_W : SCREEN_W;
+}
+
+/**
+ * Returns the height of the display in its current mode.
+ *
+ * @param machine The machine to query.
+ *
+ * @return Returns SCREEN_H or HIRES_SCREEN_H.
+ */
+static inline int chippy_screen_height(const struct chippy *machine) {
+    return machine->hires ? HIRES_SCREEN_H : SCREEN_H;
+}
+
+/**
+ * Returns the colour of the pixel at the given position.
+ *
+ * @param machine The machine to read the graphics buffer of.
+ * @param x       The column, from 0 to chippy_screen_width() - 1.
+ * @param y       The row, from 0 to chippy_screen_height() - 1.
+ *
+ * @return Returns the bits of the pixel in the first and second bitplane as
+ *         bits 0 and 1, so 1 for a set pixel on a monochrome display.
+ */
+static inline int chippy_get_pixel(const struct chippy *machine, int x, int y) {
+    return ((machine->gfx[0][y][x / 64] & GFX_ROW_BIT(x)) != 0)
+         | ((machine->gfx[1][y][x / 64] & GFX_ROW_BIT(x)) != 0) << 1;
+}
+
+/**
+ * Initializes a newly allocated machine data structure. The engine defaults to
+ * the JIT compiler where it is supported, and the random number generator to
+ * seed 0. A machine that was initialized before is reinitialized with
+ * chippy_reset() instead.
  *
  * @param machine The machine to be initialized.
  */
 void chippy_init(struct chippy *machine);
 
 /**
- * Reads a ROM file and loads it into the memory of the machine.
+ * Reinitializes a machine, as chippy_init() does. The JIT compiler state the
+ * machine already has is kept, without any of its translations, so that it is
+ * neither leaked nor created again.
+ *
+ * @param machine The machine to be reinitialized.
+ */
+void chippy_reset(struct chippy *machine);
+
+/**
+ * Seeds the random number generator used by the RND instruction. Machines
+ * with the same seed and input behave identically.
+ *
+ * @param machine The machine to seed.
+ * @param seed    The seed, any value is valid.
+ */
+void chippy_seed(struct chippy *machine, uint64_t seed);
+
+/**
+ * Reads a ROM file and loads it into the memory of the machine. To start many
+ * machines with the same ROM, see chippy_library_open() instead.
  *
  * @param machine The machine to load the ROM into.
  * @param rom     The filepath to the ROM to load.
  *
- * @return Returns 0 on success, otherwise 1.
+ * @return Returns 0 on success, otherwise one of enum chippy_rom_error. The
+ *         memory of the machine is left untouched on failure.
  */
 int chippy_load_rom(struct chippy *machine, const char *rom);
 
+/**
+ * Returns a description of an error returned when loading a ROM.
+ *
+ * @param error The error, one of enum chippy_rom_error.
+ *
+ * @return Returns a static string.
+ */
+const char *chippy_rom_error_string(int error);
+
 /**
  * Performs exactly one instruction cycle.
  *
  * @param machine The machine to step.
  *
- * @return Returns 0 on success, otherwise 1.
+ * @return Returns CHIPPY_WAITING when the machine is waiting for a key press,
+ *         otherwise 0. Unknown opcodes are skipped, so a run never fails.
  */
 int chippy_step(struct chippy *machine);
 
+/**
+ * Performs the given number of instruction cycles with the engine selected in
+ * the machine. The result is the same as calling chippy_step() that many times.
+ *
+ * Unless disabled with skip_idle, loops that only poll the delay timer or keys
+ * without side effects are detected when the timers tick, and the iterations
+ * until the next tick are skipped instead of executed.
+ *
+ * @param machine The machine to run.
+ * @param cycles  The number of cycles to perform.
+ *
+ * @return Returns CHIPPY_WAITING when the machine is waiting for a key press,
+ *         otherwise 0. Unknown opcodes are skipped, so a run never fails.
+ */
+int chippy_run_cycles(struct chippy *machine, unsigned long cycles);
+
+/**
+ * Returns the current value of the delay timer. Timers are not decremented
+ * while the machine runs, but derived from the cycle at which they were set.
+ *
+ * @param machine The machine to read the timer of.
+ *
+ * @return Returns the current value of the delay timer.
+ */
+uint8_t chippy_get_delay_timer(const struct chippy *machine);
+
+/**
+ * Returns the current value of the sound timer.
+ *
+ * @param machine The machine to read the timer of.
+ *
+ * @return Returns the current value of the sound timer.
+ */
+uint8_t chippy_get_sound_timer(const struct chippy *machine);
+
+/**
+ * Returns the cycle at which the sound timer reaches zero. The sound plays from
+ * the cycle the timer was set at until this cycle.
+ *
+ * @param machine The machine to read the timer of.
+ *
+ * @return Returns the cycle, which is the cycle the timer was set at when it
+ *         was set to zero.
+ */
+uint64_t chippy_get_sound_end(const struct chippy *machine);
+
+/**
+ * Returns the number of cycles until the timers tick next. Running the machine
+ * for fewer cycles than this cannot change the timer values.
+ *
+ * @param machine The machine to query.
+ *
+ * @return Returns the number of cycles, at least 1.
+ */
+uint64_t chippy_cycles_until_tick(const struct chippy *machine);
+
+/**
+ * Records that rows of the framebuffer changed. This has to be called after
+ * writing to the framebuffer of a machine directly, and is called by the
+ * instructions that draw, scroll or clear the screen.
+ *
+ * @param machine The machine whose framebuffer was written to.
+ * @param rows    The rows that changed, as a mask with bit N for row N.
+ */
+static inline void chippy_invalidate_gfx(struct chippy *machine, uint64_t rows) {
+    machine->gfx_dirty |= rows;
+    machine->gfx_generation++;
+}
+
+/**
+ * Discards the decoded and translated instructions overlapping the given memory range. This
+ * has to be called after writing to the RAM of a machine directly, so that the
+ * new instructions are decoded again. Writes made by the machine itself are
+ * tracked automatically.
+ *
+ * @param machine The machine whose RAM was written to.
+ * @param address The first address that was written to.
+ * @param length  The number of bytes that were written.
+ */
+void chippy_invalidate(struct chippy *machine, uint16_t address, uint32_t length);
+
+/**
+ * Copies the state of a machine into a snapshot. Taking a snapshot again into
+ * the snapshot that the machine was last restored from, or taken into, only
+ * copies the RAM pages that were written to in the meantime.
+ *
+ * @param machine  The machine to take a snapshot of.
+ * @param snapshot The snapshot to write to.
+ */
+void chippy_snapshot(struct chippy *machine, struct chippy_snapshot *snapshot);
+
+/**
+ * Restores the state of a machine from a snapshot. When the machine was last
+ * restored from, or taken into, the same snapshot, only the RAM pages that
+ * were written to since are copied back. Otherwise all of RAM is copied.
+ *
+ * @param machine  The machine to restore.
+ * @param snapshot The snapshot to restore from, which may be shared by any
+ *                 number of machines.
+ */
+void chippy_restore(struct chippy *machine, const struct chippy_snapshot *snapshot);
+
+/**
+ * Creates a profiler. Attaching it to a machine by setting machine->profile
+ * makes the machine run on a profiled interpreter instead of its engine,
+ * which counts the executions and host time of every opcode, the executions
+ * of every address, and the cycles spent in every chain of subroutine calls.
+ * Machines without a profiler run without any profiling overhead.
+ *
+ * @return Returns the profiler, or NULL when out of memory or when the
+ *         library was built without the profiler.
+ */
+struct chippy_profile *chippy_profile_create(void);
+
+/**
+ * Writes one line per executed opcode class with its name, number of
+ * executions and host time in nanoseconds, separated by tabs, most expensive
+ * first.
+ *
+ * @param profile The profiler to report on.
+ * @param out     The stream to write to.
+ */
+void chippy_profile_write_opcodes(const struct chippy_profile *profile, FILE *out);
+
+/**
+ * Writes one line per executed address with the address and its number of
+ * executions, separated by a tab, in order of address.
+ *
+ * @param profile The profiler to report on.
+ * @param out     The stream to write to.
+ */
+void chippy_profile_write_pcs(const struct chippy_profile *profile, FILE *out);
+
+/**
+ * Writes the cycles spent in every chain of subroutine calls in the folded
+ * format read by flamegraph tools. Every line is a chain of frames separated
+ * by semicolons, starting with "main" and followed by the addresses of the
+ * called subroutines, and then the number of cycles spent in the last frame.
+ *
+ * @param profile The profiler to report on.
+ * @param prefix  A frame to put before every chain, or NULL for none.
+ * @param out     The stream to write to.
+ */
+void chippy_profile_write_folded(const struct chippy_profile *profile, const char *prefix, FILE *out);
+
+/**
+ * Frees the profiler. It must no longer be attached to any machine.
+ *
+ * @param profile The profiler to destroy.
+ */
+void chippy_profile_destroy(struct chippy_profile *profile);
+
+/**
+ * Opens a file to trace the execution of a machine to. Attaching the trace to
+ * a machine by setting machine->trace makes the machine run on a traced
+ * interpreter instead of its engine, which records the address, opcode and
+ * changed registers of every instruction in a compact binary format. Records
+ * are written to the file by a background thread. A traced machine is not
+ * profiled. Traces can be read with the chippy-trace tool.
+ *
+ * @param path The filepath to write the trace to.
+ *
+ * @return Returns the trace, or NULL when the file could not be created.
+ */
+struct chippy_trace *chippy_trace_open(const char *path);
+
+/**
+ * Writes the remaining records of a trace and closes its file. The trace must
+ * no longer be attached to a running machine.
+ *
+ * @param trace The trace to close.
+ *
+ * @return Returns 0 on success, or 1 when writing to the file failed.
+ */
+int chippy_trace_close(struct chippy_trace *trace);
+
 /**
  * Frees the memory allocated for the machine.
  *
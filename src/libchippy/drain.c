@@ -0,0 +1,89 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include "drain.h"
+
+/**
+ * Consumes items as they are published, until the drain is stopped and the
+ * ring is empty.
+ */
+static void *drain_thread(void *argument) {
+    struct drain *drain = argument;
+
+    for (;;) {
+        // Read stop before head, so that a set stop guarantees the final head
+        // is seen.
+        int stop = __atomic_load_n(&drain->stop, __ATOMIC_ACQUIRE);
+        size_t head = __atomic_load_n(&drain->head, __ATOMIC_ACQUIRE);
+        size_t tail = drain->tail;
+
+        if (head != tail) {
+            __atomic_store_n(&drain->tail, drain->function(drain->context, tail, head), __ATOMIC_RELEASE);
+            continue;
+        }
+
+        if (stop) {
+            return NULL;
+        }
+
+        // Announce the sleep before checking head once more, which pairs with
+        // drain_publish() so that an item published in between is not missed.
+        pthread_mutex_lock(&drain->lock);
+        __atomic_store_n(&drain->sleeping, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&drain->head, __ATOMIC_SEQ_CST) == tail
+            && !__atomic_load_n(&drain->stop, __ATOMIC_SEQ_CST)) {
+            pthread_cond_wait(&drain->wake, &drain->lock);
+        }
+
+        __atomic_store_n(&drain->sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&drain->lock);
+    }
+}
+
+int drain_start(struct drain *drain, drain_function function, void *context) {
+    drain->head = 0;
+    drain->tail = 0;
+    drain->function = function;
+    drain->context = context;
+    drain->sleeping = 0;
+    drain->stop = 0;
+
+    if (pthread_mutex_init(&drain->lock, NULL) != 0) {
+        return 1;
+    }
+
+    if (pthread_cond_init(&drain->wake, NULL) != 0) {
+        pthread_mutex_destroy(&drain->lock);
+        return 1;
+    }
+
+    if (pthread_create(&drain->thread, NULL, drain_thread, drain) != 0) {
+        pthread_cond_destroy(&drain->wake);
+        pthread_mutex_destroy(&drain->lock);
+        return 1;
+    }
+
+    return 0;
+}
+
+void drain_wake(struct drain *drain) {
+    pthread_mutex_lock(&drain->lock);
+    pthread_cond_signal(&drain->wake);
+    pthread_mutex_unlock(&drain->lock);
+}
+
+void drain_stop(struct drain *drain) {
+    __atomic_store_n(&drain->stop, 1, __ATOMIC_SEQ_CST);
+    drain_wake(drain);
+
+    pthread_join(drain->thread, NULL);
+    pthread_cond_destroy(&drain->wake);
+    pthread_mutex_destroy(&drain->lock);
+}
@@ -0,0 +1,89 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __DRAIN_H__
+#define __DRAIN_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * Consumes the items from tail up to head, which are positions that only ever
+ * grow and are reduced to indices by the caller.
+ *
+ * @return Returns the position up to which the items were consumed, which may
+ *         be before head to release them one at a time.
+ */
+typedef size_t (*drain_function)(void *context, size_t tail, size_t head);
+
+/**
+ * A background thread that drains a ring buffer filled by one producer. The
+ * producer publishes head and the thread publishes tail, and the thread sleeps
+ * on a condition variable while the ring is empty. The producer only takes the
+ * lock to wake it, which it only does when the thread is asleep.
+ */
+struct drain {
+    size_t head;                        // Items published by the producer
+    size_t tail;                        // Items consumed by the thread
+
+    drain_function function;
+    void *context;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int sleeping;                       // Set while the thread waits for items
+    int stop;                           // Set when the drain is stopped
+};
+
+/**
+ * Starts the thread of an empty ring.
+ *
+ * @param drain    The drain to start.
+ * @param function The function that consumes the items.
+ * @param context  The first argument of the function.
+ *
+ * @return Returns 0 on success, or 1 when the thread could not be started.
+ */
+int drain_start(struct drain *drain, drain_function function, void *context);
+
+/**
+ * Waits until the thread has consumed every item that was published, and
+ * stops it.
+ */
+void drain_stop(struct drain *drain);
+
+/**
+ * Wakes the thread to consume the items that were published.
+ */
+void drain_wake(struct drain *drain);
+
+/**
+ * Publishes the items before head to the thread. Must only be called by the
+ * producer.
+ */
+static inline void drain_publish(struct drain *drain, size_t head) {
+    // Sequentially consistent, so that the thread either sees the new head
+    // before it goes to sleep, or is seen to be asleep.
+    __atomic_store_n(&drain->head, head, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&drain->sleeping, __ATOMIC_SEQ_CST)) {
+        drain_wake(drain);
+    }
+}
+
+/**
+ * Returns the position up to which the thread has consumed the items, which
+ * the producer may then reuse.
+ */
+static inline size_t drain_tail(struct drain *drain) {
+    return __atomic_load_n(&drain->tail, __ATOMIC_ACQUIRE);
+}
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include "input.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void chippy_input_init(struct chippy_input *input) {
+    memset(input, 0, sizeof(struct chippy_input));
+}
+
+void chippy_input_push(struct chippy_input *input, uint64_t time, int key, int down) {
+    uint16_t bit = 1 << (key & 0xF);
+    uint16_t keys = input->keys;
+
+    // Only the producer writes the keys, so they need no atomic update.
+    __atomic_store_n(&input->keys, down ? keys | bit : keys & ~bit, __ATOMIC_RELEASE);
+
+    size_t head = input->head;
+
+    if (head - __atomic_load_n(&input->tail, __ATOMIC_ACQUIRE) == INPUT_CAPACITY) {
+        __atomic_store_n(&input->overflowed, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    struct chippy_key_event *event = &input->events[head & (INPUT_CAPACITY - 1)];
+
+    event->time = time;
+    event->key = key & 0xF;
+    event->down = down != 0;
+
+    __atomic_store_n(&input->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int chippy_input_run(struct chippy *machine, struct chippy_input *input, unsigned long cycles, uint64_t start, uint64_t end) {
+    size_t head = __atomic_load_n(&input->head, __ATOMIC_ACQUIRE);
+    unsigned long done = 0;
+    uint16_t fresh = 0;
+    int status = EXIT_SUCCESS;
+
+    while (input->tail != head) {
+        const struct chippy_key_event *event = &input->events[input->tail & (INPUT_CAPACITY - 1)];
+        uint16_t bit = 1 << event->key;
+        unsigned long at = 0;
+
+        if (event->time >= end) {
+            break;
+        }
+
+        if (event->time > start) {
+            at = (event->time - start) * cycles / (end - start);
+        }
+
+        // A key released in the cycle it was pressed in is held for one.
+        if (!event->down && (fresh & bit) && at <= done && done < cycles) {
+            at = done + 1;
+        }
+
+        if (at > done) {
+            status = chippy_run_cycles(machine, at - done);
+            done = at;
+            fresh = 0;
+        }
+
+        if (event->down) {
+            machine->keys |= bit;
+            fresh |= bit;
+        } else {
+            machine->keys &= ~bit;
+        }
+
+        __atomic_store_n(&input->tail, input->tail + 1, __ATOMIC_RELEASE);
+    }
+
+    // Events were dropped, so the keypad only agrees with the producer again
+    // once every event before the drop was applied.
+    if (input->tail == head && __atomic_exchange_n(&input->overflowed, 0, __ATOMIC_ACQ_REL)) {
+        machine->keys = chippy_input_keys(input);
+    }
+
+    if (done < cycles) {
+        status = chippy_run_cycles(machine, cycles - done);
+    }
+
+    return status;
+}
+
+void chippy_input_sync(struct chippy *machine, struct chippy_input *input) {
+    __atomic_store_n(&input->overflowed, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&input->tail, __atomic_load_n(&input->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+
+    machine->keys = chippy_input_keys(input);
+}
@@ -0,0 +1,106 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __INPUT_H__
+#define __INPUT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chippy.h"
+
+/**
+ * The number of key events that can be queued, which must be a power of two.
+ */
+#define INPUT_CAPACITY 256
+
+/**
+ * A key of the keypad that was pressed or released.
+ */
+struct chippy_key_event {
+    uint64_t time;                      // Host time of the event, in nanoseconds
+    uint8_t key;                        // Keypad value
+    uint8_t down;                       // Whether the key was pressed or released
+};
+
+/**
+ * Keypad input on its way from the host to a machine. One producer, such as an
+ * input thread or event callback, pushes timestamped events, and the thread
+ * that runs the machine applies them in chippy_input_run(). The producer must
+ * not block on a slow frame, so a full queue drops the event rather than wait.
+ *
+ * The producer also keeps the keys that are held as a bitmask, which is used
+ * to recover when events were lost because the queue was full.
+ */
+struct chippy_input {
+    struct chippy_key_event events[INPUT_CAPACITY];
+    size_t head;                        // Events pushed, published
+    size_t tail;                        // Events applied
+
+    uint16_t keys;                      // Keys held, bit N for key N
+    int overflowed;                     // Set when an event was dropped
+};
+
+/**
+ * Initializes an empty queue with no keys held.
+ *
+ * @param input The queue to initialize.
+ */
+void chippy_input_init(struct chippy_input *input);
+
+/**
+ * Records that a key was pressed or released. Must only be called by the
+ * producer. When the queue is full the event is dropped, and the consumer
+ * copies the held keys once it caught up.
+ *
+ * @param input The queue to push to.
+ * @param time  The host time of the event in nanoseconds, not before that of
+ *              the previous event.
+ * @param key   The keypad value, from 0x0 to 0xF.
+ * @param down  Whether the key was pressed, or released.
+ */
+void chippy_input_push(struct chippy_input *input, uint64_t time, int key, int down);
+
+/**
+ * Returns the keys that the producer last saw held, as a bitmask with bit N
+ * for key N. May be called from any thread.
+ *
+ * @param input The queue to query.
+ */
+static inline uint16_t chippy_input_keys(const struct chippy_input *input) {
+    return __atomic_load_n(&input->keys, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Performs the given number of cycles on a machine that emulate the host time
+ * from start to end, and applies every queued event from before end to the
+ * keypad of the machine at the cycle that matches its time. Events from before
+ * start are applied first. A key that is pressed and released within the same
+ * cycle stays held for at least one cycle, so that short taps are not lost.
+ *
+ * @param machine The machine to run.
+ * @param input   The queue to take events from.
+ * @param cycles  The number of cycles to perform.
+ * @param start   The host time of the first cycle, in nanoseconds.
+ * @param end     The host time after the last cycle, in nanoseconds.
+ *
+ * @return Returns the status of the last run, like chippy_run_cycles().
+ */
+int chippy_input_run(struct chippy *machine, struct chippy_input *input, unsigned long cycles, uint64_t start, uint64_t end);
+
+/**
+ * Discards every queued event and copies the held keys into the machine, e.g.
+ * after the machine was restored to an earlier state.
+ *
+ * @param machine The machine to update.
+ * @param input   The queue to drain.
+ */
+void chippy_input_sync(struct chippy *machine, struct chippy_input *input);
+
+#endif
@@ -0,0 +1,411 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+/*
+ * The interpreter loop. This file is included by chippy.c once for every
+ * variant of the interpreter, with INTERPRET defined as the name of the
+ * function. PROFILE and TRACE are defined as 1 to call the profiler or trace
+ * hooks around every instruction, or as 0 to leave them out entirely.
+ */
+
+/*
+ * The interpreter loop is written once and compiled either as a threaded
+ * interpreter using computed gotos (a GNU C extension), where every handler
+ * ends in its own indirect jump to the next handler, or as a plain switch.
+ */
+#if defined(__GNUC__)
+#define HANDLER(op) handle_##op:
+#define DISPATCH()  goto *handlers[insn->op]
+#define NEXT()      do { if (--cycles == 0) goto done; FETCH(); DISPATCH(); } while (0)
+#else
+#define HANDLER(op) case op:
+#define DISPATCH()  goto dispatch
+#define NEXT()      do { if (--cycles == 0) goto done; goto next; } while (0)
+#endif
+
+#define FETCH() do {                                                \
+        insn = &machine->decoded[machine->pc & (RAM_SIZE - 1)];     \
+        PROFILE_FETCH();                                            \
+        TRACE_FETCH();                                              \
+        machine->pc += 2;                                           \
+    } while (0)
+
+#if PROFILE
+#define PROFILE_BEGIN()      struct chippy_insn *previous = NULL; profile_begin(machine->profile, machine)
+#define PROFILE_FETCH()      do { profile_fetch(machine->profile, machine->pc, previous); previous = insn; } while (0)
+#define PROFILE_CALL(target) profile_call(machine->profile, target)
+#define PROFILE_RET()        profile_ret(machine->profile)
+#define PROFILE_END()        profile_end(machine->profile, insn)
+#else
+#define PROFILE_BEGIN()
+#define PROFILE_FETCH()
+#define PROFILE_CALL(target)
+#define PROFILE_RET()
+#define PROFILE_END()
+#endif
+
+#if TRACE
+#define TRACE_BEGIN() uint16_t traced_pc = 0, traced_opcode = 0; int traced = 0; trace_begin(machine->trace, machine)
+#define TRACE_FETCH() do {                                                                  \
+        if (traced) {                                                                       \
+            trace_record(machine->trace, machine, traced_pc, traced_opcode);                \
+        }                                                                                   \
+        traced = 1;                                                                         \
+        traced_pc = machine->pc;                                                            \
+        traced_opcode = machine->ram[machine->pc & (RAM_SIZE - 1)] << 8                     \
+                      | machine->ram[(machine->pc + 1) & (RAM_SIZE - 1)];                   \
+    } while (0)
+#define TRACE_END() do {                                                                    \
+        trace_record(machine->trace, machine, traced_pc, traced_opcode);                    \
+        trace_end(machine->trace);                                                          \
+    } while (0)
+#else
+#define TRACE_BEGIN()
+#define TRACE_FETCH()
+#define TRACE_END()
+#endif
+
+#define VX machine->V[insn->x]
+#define VY machine->V[insn->y]
+
+/**
+ * The cycle at which the current instruction executes. The cycle counter of
+ * the machine is only brought up to date when the interpreter returns.
+ */
+#define NOW() (machine->cycles + (total - cycles))
+
+/**
+ * Executes the given number of instruction cycles, which must be at least one.
+ * When the machine starts waiting for a key press, the remaining cycles are
+ * spent waiting.
+ */
+static int INTERPRET(struct chippy *machine, unsigned long total) {
+    unsigned long cycles = total;
+    struct chippy_insn *insn;
+    int status = EXIT_SUCCESS;
+
+    PROFILE_BEGIN();
+    TRACE_BEGIN();
+
+#if defined(__GNUC__)
+    static const void *handlers[OP_COUNT] = {
+        &&handle_OP_DECODE,   &&handle_OP_NOP,      &&handle_OP_CLS,
+        &&handle_OP_RET,      &&handle_OP_JP,       &&handle_OP_CALL,
+        &&handle_OP_SE_XKK,   &&handle_OP_SNE_XKK,  &&handle_OP_SE_XY,
+        &&handle_OP_LD_XKK,   &&handle_OP_ADD_XKK,  &&handle_OP_LD_XY,
+        &&handle_OP_OR,       &&handle_OP_XOR,      &&handle_OP_ADD_XY,
+        &&handle_OP_SUB,      &&handle_OP_SHR,      &&handle_OP_SUBN,
+        &&handle_OP_SHL,      &&handle_OP_SNE_XY,   &&handle_OP_LD_I,
+        &&handle_OP_JP_V0,    &&handle_OP_RND,      &&handle_OP_DRW,
+        &&handle_OP_SKP,      &&handle_OP_SKNP,     &&handle_OP_LD_X_DT,
+        &&handle_OP_LD_X_K,   &&handle_OP_LD_DT_X,  &&handle_OP_LD_ST_X,
+        &&handle_OP_ADD_I,    &&handle_OP_LD_F,     &&handle_OP_LD_B,
+        &&handle_OP_LD_MEM_X, &&handle_OP_LD_X_MEM, &&handle_OP_SCD,
+        &&handle_OP_SCU,      &&handle_OP_SCR,      &&handle_OP_SCL,
+        &&handle_OP_EXIT,     &&handle_OP_LOW,      &&handle_OP_HIGH,
+        &&handle_OP_SAVE_XY,  &&handle_OP_LOAD_XY,  &&handle_OP_LD_I_LONG,
+        &&handle_OP_PLANE,    &&handle_OP_LD_HF,    &&handle_OP_LD_R_X,
+        &&handle_OP_LD_X_R,   &&handle_OP_AUDIO,    &&handle_OP_PITCH
+    };
+
+    FETCH();
+    DISPATCH();
+#else
+next:
+    FETCH();
+
+dispatch:
+    switch (insn->op) {
+#endif
+
+    HANDLER(OP_DECODE)
+        decode(machine, machine->pc - 2, insn);
+        DISPATCH();
+
+    HANDLER(OP_NOP)
+        NEXT();
+
+    HANDLER(OP_CLS) // CLS: Clears the screen.
+        ops_clear(machine->gfx, machine->hires, machine->planes);
+        chippy_invalidate_gfx(machine, GFX_ALL_ROWS);
+        NEXT();
+
+    HANDLER(OP_RET) // RET: Return from a subroutine.
+        // The stack wraps around, like in the lockstep engine, rather than
+        // running off its end.
+        machine->pc = machine->stack[--machine->sp & 0xF];
+        PROFILE_RET();
+        NEXT();
+
+    HANDLER(OP_JP) // JP: Jump to location NNN.
+        machine->pc = insn->nnn;
+        NEXT();
+
+    HANDLER(OP_CALL) // CALL: Call subroutine at NNN.
+        machine->stack[machine->sp++ & 0xF] = machine->pc;
+        machine->pc = insn->nnn;
+        PROFILE_CALL(insn->nnn);
+        NEXT();
+
+    HANDLER(OP_SE_XKK) // SE: Skip next instruction if VX == KK.
+        if (VX == insn->kk) {
+            machine->pc += ops_skip(machine->ram, machine->pc);
+        }
+        NEXT();
+
+    HANDLER(OP_SNE_XKK) // SNE: Skip next instruction if VX != KK.
+        if (VX != insn->kk) {
+            machine->pc += ops_skip(machine->ram, machine->pc);
+        }
+        NEXT();
+
+    HANDLER(OP_SE_XY) // SE: Skip next instruction if VX == VY.
+        if (VX == VY) {
+            machine->pc += ops_skip(machine->ram, machine->pc);
+        }
+        NEXT();
+
+    HANDLER(OP_LD_XKK) // LD: Set VX = KK.
+        VX = insn->kk;
+        NEXT();
+
+    HANDLER(OP_ADD_XKK) // ADD: Set VX = VX + KK.
+        VX += insn->kk;
+        NEXT();
+
+    HANDLER(OP_LD_XY) // LD: Set VX = VY.
+        VX = VY;
+        NEXT();
+
+    HANDLER(OP_OR) // OR: Set VX = VX | VY.
+        VX |= VY;
+        NEXT();
+
+    HANDLER(OP_XOR) // XOR: Set VX = VX ^ VY.
+        VX ^= VY;
+        NEXT();
+
+    HANDLER(OP_ADD_XY) // ADD: Set VX = VX + VY, set VF = carry.
+        machine->V[0xF] = (VX + VY) > 255;
+        VX += VY;
+        NEXT();
+
+    HANDLER(OP_SUB) // SUB: Set VX = VX - VY, set VF = NOT borrow.
+        machine->V[0xF] = VX > VY;
+        VX -= VY;
+        NEXT();
+
+    HANDLER(OP_SHR) // SHR: Set VX = VX >> 1, set VF = LSB.
+        machine->V[0xF] = VX & 1;
+        VX >>= 1;
+        NEXT();
+
+    HANDLER(OP_SUBN) // SUBN: Set VX = VY - VX, set VF = NOT borrow.
+        machine->V[0xF] = VY > VX;
+        VX = VY - VX;
+        NEXT();
+
+    HANDLER(OP_SHL) // SHL: Set VX = VX << 1, set VF = MSB.
+        machine->V[0xF] = (VX & 0x80) != 0;
+        VX <<= 1;
+        NEXT();
+
+    HANDLER(OP_SNE_XY) // SNE: Skip next instruction if VX != VY.
+        if (VX != VY) {
+            machine->pc += ops_skip(machine->ram, machine->pc);
+        }
+        NEXT();
+
+    HANDLER(OP_LD_I) // LD: Set I = NNN.
+        machine->I = insn->nnn;
+        NEXT();
+
+    HANDLER(OP_JP_V0) // JP: Jump to location NNN + V0.
+        machine->pc = insn->nnn + machine->V[0];
+        NEXT();
+
+    HANDLER(OP_RND) // RND: Set VX = random byte & KK.
+        VX = ops_random_byte(&machine->rng) & insn->kk;
+        NEXT();
+
+    HANDLER(OP_DRW) // DRW: Display N-byte sprite, or 16x16 sprite when N = 0, starting at address I at (VX, VY), set VF = collision.
+        // The rows are marked first, as VY can be VF, which the collision
+        // flag overwrites.
+        chippy_invalidate_gfx(machine, ops_draw_rows(machine->hires, VY, insn->n));
+        machine->V[0xF] = ops_draw(machine->gfx, machine->hires, machine->planes, machine->ram, machine->I, VX, VY, insn->n);
+        NEXT();
+
+    HANDLER(OP_SKP) // SKP: Skip next instruction if key with the value of VX is pressed.
+        if (machine->keys & (1 << (VX & 0xF))) {
+            machine->pc += ops_skip(machine->ram, machine->pc);
+        }
+        NEXT();
+
+    HANDLER(OP_SKNP) // SKNP: Skip next instruction if key with the value of VX is not pressed.
+        if (!(machine->keys & (1 << (VX & 0xF)))) {
+            machine->pc += ops_skip(machine->ram, machine->pc);
+        }
+        NEXT();
+
+    HANDLER(OP_LD_X_DT) // LD: Set VX = delay timer value.
+        VX = ops_timer_value(machine->dt, machine->dt_cycle, NOW(), machine->cycles_per_tick);
+        NEXT();
+
+    HANDLER(OP_LD_X_K) // LD: Wait for a key press, store the value of the key in VX.
+        machine->wait_key = insn->x;
+        machine->wait_held = machine->keys;
+        status = CHIPPY_WAITING;
+        goto done;
+
+    HANDLER(OP_LD_DT_X) // LD: Set delay timer = VX.
+        machine->dt = VX;
+        machine->dt_cycle = NOW();
+        NEXT();
+
+    HANDLER(OP_LD_ST_X) // LD: Set sound timer = VX.
+        machine->st = VX;
+        machine->st_cycle = NOW();
+        NEXT();
+
+    HANDLER(OP_ADD_I) // ADD: Set I = I + VX.
+        machine->I += VX;
+        NEXT();
+
+    HANDLER(OP_LD_F) // LD: Set I = location of sprite for digit VX.
+        machine->I = VX * 5;
+        NEXT();
+
+    HANDLER(OP_LD_B) // LD: Store BCD representation of VX in memory locations I, I+1 and I+2.
+        machine->ram[machine->I] = VX / 100;
+        machine->ram[(machine->I + 1) & (RAM_SIZE - 1)] = (VX / 10) % 10;
+        machine->ram[(machine->I + 2) & (RAM_SIZE - 1)] = VX % 10;
+        chippy_invalidate(machine, machine->I, 3);
+        NEXT();
+
+    HANDLER(OP_LD_MEM_X) // LD: Store registers V0 through VX in memory starting at address I.
+        for (int i = 0; i <= insn->x; i++) {
+            machine->ram[(machine->I + i) & (RAM_SIZE - 1)] = machine->V[i];
+        }
+        chippy_invalidate(machine, machine->I, insn->x + 1);
+        NEXT();
+
+    HANDLER(OP_LD_X_MEM) // LD: Read registers V0 through VX from memory starting at address I.
+        for (int i = 0; i <= insn->x; i++) {
+            machine->V[i] = machine->ram[(machine->I + i) & (RAM_SIZE - 1)];
+        }
+        NEXT();
+
+    HANDLER(OP_SCD) // SCD: Scroll the selected planes down N rows.
+        ops_scroll_vertical(machine->gfx, machine->hires, machine->planes, insn->n);
+        chippy_invalidate_gfx(machine, GFX_ALL_ROWS);
+        NEXT();
+
+    HANDLER(OP_SCU) // SCU: Scroll the selected planes up N rows.
+        ops_scroll_vertical(machine->gfx, machine->hires, machine->planes, -insn->n);
+        chippy_invalidate_gfx(machine, GFX_ALL_ROWS);
+        NEXT();
+
+    HANDLER(OP_SCR) // SCR: Scroll the selected planes 4 pixels right.
+        ops_scroll_horizontal(machine->gfx, machine->hires, machine->planes, 0);
+        chippy_invalidate_gfx(machine, GFX_ALL_ROWS);
+        NEXT();
+
+    HANDLER(OP_SCL) // SCL: Scroll the selected planes 4 pixels left.
+        ops_scroll_horizontal(machine->gfx, machine->hires, machine->planes, 1);
+        chippy_invalidate_gfx(machine, GFX_ALL_ROWS);
+        NEXT();
+
+    HANDLER(OP_EXIT) // EXIT: Stop the program, by executing this instruction forever.
+        machine->pc -= 2;
+        NEXT();
+
+    HANDLER(OP_LOW) // LOW: Switch to 64x32 and clear the screen.
+        machine->hires = 0;
+        ops_clear(machine->gfx, 1, 0x3);
+        chippy_invalidate_gfx(machine, GFX_ALL_ROWS);
+        NEXT();
+
+    HANDLER(OP_HIGH) // HIGH: Switch to 128x64 and clear the screen.
+        machine->hires = 1;
+        ops_clear(machine->gfx, 1, 0x3);
+        chippy_invalidate_gfx(machine, GFX_ALL_ROWS);
+        NEXT();
+
+    HANDLER(OP_SAVE_XY) // SAVE: Store registers VX through VY, in either order, in memory starting at address I.
+        for (int i = 0, step = insn->x <= insn->y ? 1 : -1; i <= (insn->y - insn->x) * step; i++) {
+            machine->ram[(machine->I + i) & (RAM_SIZE - 1)] = machine->V[insn->x + i * step];
+        }
+        chippy_invalidate(machine, machine->I, abs(insn->y - insn->x) + 1);
+        NEXT();
+
+    HANDLER(OP_LOAD_XY) // LOAD: Read registers VX through VY, in either order, from memory starting at address I.
+        for (int i = 0, step = insn->x <= insn->y ? 1 : -1; i <= (insn->y - insn->x) * step; i++) {
+            machine->V[insn->x + i * step] = machine->ram[(machine->I + i) & (RAM_SIZE - 1)];
+        }
+        NEXT();
+
+    HANDLER(OP_LD_I_LONG) // LD: Set I = NNNN, the 16-bit word that follows.
+        machine->I = machine->ram[machine->pc & (RAM_SIZE - 1)] << 8 | machine->ram[(machine->pc + 1) & (RAM_SIZE - 1)];
+        machine->pc += 2;
+        NEXT();
+
+    HANDLER(OP_PLANE) // PLANE: Select the bitplanes N for drawing.
+        machine->planes = insn->x & 0x3;
+        NEXT();
+
+    HANDLER(OP_LD_HF) // LD: Set I = location of 8x10 sprite for digit VX.
+        machine->I = BIG_FONT_ADDRESS + (VX & 0xF) * 10;
+        NEXT();
+
+    HANDLER(OP_LD_R_X) // LD: Store registers V0 through VX in the flag registers.
+        memcpy(machine->flags, machine->V, insn->x + 1);
+        NEXT();
+
+    HANDLER(OP_LD_X_R) // LD: Read registers V0 through VX from the flag registers.
+        memcpy(machine->V, machine->flags, insn->x + 1);
+        NEXT();
+
+    HANDLER(OP_AUDIO) // AUDIO: Load the audio pattern from memory starting at address I.
+        for (int i = 0; i < AUDIO_PATTERN_SIZE; i++) {
+            machine->pattern[i] = machine->ram[(machine->I + i) & (RAM_SIZE - 1)];
+        }
+        NEXT();
+
+    HANDLER(OP_PITCH) // PITCH: Set the audio pitch = VX.
+        machine->pitch = VX;
+        NEXT();
+
+#if !defined(__GNUC__)
+    }
+#endif
+
+done:
+    PROFILE_END();
+    TRACE_END();
+
+    machine->cycles += total;
+
+    return status;
+}
+
+#undef PROFILE_BEGIN
+#undef PROFILE_FETCH
+#undef PROFILE_CALL
+#undef PROFILE_RET
+#undef PROFILE_END
+#undef TRACE_BEGIN
+#undef TRACE_FETCH
+#undef TRACE_END
+#undef NOW
+#undef VX
+#undef VY
+#undef FETCH
+#undef NEXT
+#undef DISPATCH
+#undef HANDLER
@@ -0,0 +1,534 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include "ops.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if JIT_SUPPORTED
+
+#include <sys/mman.h>
+
+/**
+ * The size of the executable code buffer. When it runs out of space, every
+ * translated block is discarded and translation starts over.
+ */
+#define CODE_SIZE (1 << 20)
+
+/**
+ * The maximum number of instructions translated into a single block, and an
+ * upper bound on the number of bytes such a block can take.
+ */
+#define BLOCK_INSNS 64
+#define BLOCK_BYTES 8192
+
+/**
+ * The page size of x86-64. Only the pages a new block is written to are made
+ * writable while it is translated, as changing the protection of the whole
+ * buffer for every block is slower than the translation itself.
+ */
+#define CODE_PAGE 4096
+
+#define OFFSET_V(x) ((int32_t)(offsetof(struct chippy, V) + (x)))
+#define OFFSET_PC   ((int32_t)offsetof(struct chippy, pc))
+#define OFFSET_I    ((int32_t)offsetof(struct chippy, I))
+#define OFFSET_CYCLES ((int32_t)offsetof(struct chippy, cycles))
+#define OFFSET_KEYS ((int32_t)offsetof(struct chippy, keys))
+
+/*
+ * Condition codes, as used in the Jcc and SETcc instructions.
+ */
+#define CC_C  0x2
+#define CC_NC 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_A  0x7
+
+/*
+ * Register numbers, as used in the ModRM byte.
+ */
+#define REG_AL 0
+#define REG_CL 1
+
+/**
+ * A translated block. It receives the machine and the cycle budget, stores the
+ * program counter of the next instruction to execute in the machine, adds the
+ * cycles it executed to the cycle counter and returns the remaining budget.
+ *
+ * While a block runs, r12 holds the remaining budget and rbp the budget at the
+ * last time the cycle counter was brought up to date.
+ */
+typedef unsigned long (*jit_block)(struct chippy *machine, unsigned long cycles);
+
+struct chippy_jit {
+    uint8_t *code;                      // Executable code buffer
+    size_t used;                        // Bytes used in the code buffer
+
+    jit_block blocks[RAM_SIZE];         // Translated blocks, keyed by address
+    uint8_t translated[RAM_SIZE];       // Whether an address is translated
+
+    volatile uint8_t flushed;           // Whether blocks were discarded
+};
+
+static void emit8(uint8_t **p, uint8_t value) {
+    *(*p)++ = value;
+}
+
+static void emit16(uint8_t **p, uint16_t value) {
+    memcpy(*p, &value, sizeof(value));
+    *p += sizeof(value);
+}
+
+static void emit32(uint8_t **p, uint32_t value) {
+    memcpy(*p, &value, sizeof(value));
+    *p += sizeof(value);
+}
+
+static void emit64(uint8_t **p, uint64_t value) {
+    memcpy(*p, &value, sizeof(value));
+    *p += sizeof(value);
+}
+
+/**
+ * Emits a ModRM byte addressing [rbx + disp32], where rbx holds the machine.
+ */
+static void emit_machine(uint8_t **p, uint8_t reg, int32_t disp) {
+    emit8(p, 0x80 | (reg << 3) | 0x3);
+    emit32(p, (uint32_t)disp);
+}
+
+static void emit_jmp(uint8_t **p, uint8_t *target) {
+    emit8(p, 0xE9);
+    emit32(p, (uint32_t)(target - (*p + 4)));
+}
+
+static void emit_jcc(uint8_t **p, uint8_t cc, uint8_t *target) {
+    emit8(p, 0x0F);
+    emit8(p, 0x80 | cc);
+    emit32(p, (uint32_t)(target - (*p + 4)));
+}
+
+static void emit_setcc_vf(uint8_t **p, uint8_t cc) {
+    emit8(p, 0x0F);
+    emit8(p, 0x90 | cc);
+    emit_machine(p, 0, OFFSET_V(0xF));
+}
+
+static void emit_load(uint8_t **p, uint8_t reg, uint8_t x) {
+    emit8(p, 0x8A);
+    emit_machine(p, reg, OFFSET_V(x));
+}
+
+static void emit_store(uint8_t **p, uint8_t reg, uint8_t x) {
+    emit8(p, 0x88);
+    emit_machine(p, reg, OFFSET_V(x));
+}
+
+static void emit_set_pc(uint8_t **p, uint16_t pc) {
+    emit8(p, 0x66);
+    emit8(p, 0xC7);
+    emit_machine(p, 0, OFFSET_PC);
+    emit16(p, pc);
+}
+
+/**
+ * Leaves the block at the given address when the cycle budget is exhausted,
+ * and otherwise consumes one cycle.
+ */
+static void emit_cycle(uint8_t **p, uint16_t addr, uint8_t *epilogue) {
+    emit8(p, 0x4D); emit8(p, 0x85); emit8(p, 0xE4);     // test r12, r12
+    emit8(p, 0x75); emit8(p, 14);                       // jnz +14
+    emit_set_pc(p, addr);
+    emit_jmp(p, epilogue);
+    emit8(p, 0x49); emit8(p, 0xFF); emit8(p, 0xCC);     // dec r12
+}
+
+/**
+ * Leaves the block after a skip instruction, whose comparison set the flags.
+ */
+static void emit_skip(uint8_t **p, uint8_t no_skip, uint16_t addr, uint8_t *epilogue) {
+    emit_set_pc(p, addr + 2);
+    emit_jcc(p, no_skip, epilogue);
+    emit_set_pc(p, addr + 4);
+    emit_jmp(p, epilogue);
+}
+
+/**
+ * Executes the instruction at the given address with the interpreter. Unless
+ * the instruction ends the block, the block is left when the instruction did
+ * not fall through or when it caused translated blocks to be discarded.
+ */
+static void emit_fallback(uint8_t **p, struct chippy_jit *jit, uint16_t addr, int terminator, uint8_t *epilogue) {
+    // Brings the cycle counter up to date, except for the current instruction,
+    // which the interpreter counts itself.
+    emit8(p, 0x48); emit8(p, 0x89); emit8(p, 0xE8);     // mov rax, rbp
+    emit8(p, 0x4C); emit8(p, 0x29); emit8(p, 0xE0);     // sub rax, r12
+    emit8(p, 0x48); emit8(p, 0xFF); emit8(p, 0xC8);     // dec rax
+    emit8(p, 0x48); emit8(p, 0x01);                     // add [cycles], rax
+    emit_machine(p, REG_AL, OFFSET_CYCLES);
+    emit8(p, 0x4C); emit8(p, 0x89); emit8(p, 0xE5);     // mov rbp, r12
+
+    emit_set_pc(p, addr);
+    emit8(p, 0x48); emit8(p, 0x89); emit8(p, 0xDF);     // mov rdi, rbx
+    emit8(p, 0x48); emit8(p, 0xB8);                     // mov rax, chippy_step
+    emit64(p, (uint64_t)(uintptr_t)&chippy_step);
+    emit8(p, 0xFF); emit8(p, 0xD0);                     // call rax
+
+    if (terminator) {
+        emit_jmp(p, epilogue);
+        return;
+    }
+
+    emit8(p, 0x66); emit8(p, 0x81);                     // cmp word [pc], addr + 2
+    emit_machine(p, 7, OFFSET_PC);
+    emit16(p, addr + 2);
+    emit_jcc(p, CC_NE, epilogue);
+
+    emit8(p, 0x48); emit8(p, 0xB8);                     // mov rax, &jit->flushed
+    emit64(p, (uint64_t)(uintptr_t)&jit->flushed);
+    emit8(p, 0x80); emit8(p, 0x38); emit8(p, 0x00);     // cmp byte [rax], 0
+    emit_jcc(p, CC_NE, epilogue);
+}
+
+/**
+ * Discards every translated block. The code itself is only overwritten once
+ * the running block has returned.
+ */
+static void flush(struct chippy_jit *jit) {
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->translated, 0, sizeof(jit->translated));
+    jit->flushed = 1;
+}
+
+/**
+ * Translates the basic block starting at the given address.
+ */
+static jit_block compile(struct chippy_jit *jit, struct chippy *machine, uint16_t start) {
+    if (CODE_SIZE - jit->used < BLOCK_BYTES) {
+        flush(jit);
+        jit->used = 0;
+    }
+
+    uint8_t *window = jit->code + (jit->used & ~(CODE_PAGE - 1));
+    size_t window_size = jit->code + jit->used + BLOCK_BYTES - window;
+
+    window_size = (window_size + CODE_PAGE - 1) & ~(size_t)(CODE_PAGE - 1);
+
+    if (mprotect(window, window_size, PROT_READ | PROT_WRITE) != 0) {
+        return NULL;
+    }
+
+    uint8_t *epilogue = jit->code + jit->used;
+    uint8_t *p = epilogue;
+
+    emit8(&p, 0x48); emit8(&p, 0x89); emit8(&p, 0xE8);  // mov rax, rbp
+    emit8(&p, 0x4C); emit8(&p, 0x29); emit8(&p, 0xE0);  // sub rax, r12
+    emit8(&p, 0x48); emit8(&p, 0x01);                   // add [cycles], rax
+    emit_machine(&p, REG_AL, OFFSET_CYCLES);
+    emit8(&p, 0x4C); emit8(&p, 0x89); emit8(&p, 0xE0);  // mov rax, r12
+    emit8(&p, 0x5D);                                    // pop rbp
+    emit8(&p, 0x41); emit8(&p, 0x5C);                   // pop r12
+    emit8(&p, 0x5B);                                    // pop rbx
+    emit8(&p, 0xC3);                                    // ret
+
+    uint8_t *entry = p;
+
+    emit8(&p, 0x53);                                    // push rbx
+    emit8(&p, 0x41); emit8(&p, 0x54);                   // push r12
+    emit8(&p, 0x55);                                    // push rbp
+    emit8(&p, 0x48); emit8(&p, 0x89); emit8(&p, 0xFB);  // mov rbx, rdi
+    emit8(&p, 0x49); emit8(&p, 0x89); emit8(&p, 0xF4);  // mov r12, rsi
+    emit8(&p, 0x48); emit8(&p, 0x89); emit8(&p, 0xF5);  // mov rbp, rsi
+
+    uint8_t *body = p;
+    uint32_t addr = start;
+
+    for (int count = 0; ; count++, addr += 2) {
+        if (count == BLOCK_INSNS || addr > RAM_SIZE - 2) {
+            emit_set_pc(&p, addr);
+            emit_jmp(&p, epilogue);
+            break;
+        }
+
+        uint16_t opcode = machine->ram[addr] << 8 | machine->ram[addr + 1];
+        uint8_t x = X(opcode);
+        uint8_t y = Y(opcode);
+        uint8_t op = chippy_decode_op(opcode);
+
+        // Instructions that set VF are only translated when VX and VY are
+        // other registers, as the interpreter defines the order of the writes.
+        int writes_vf = x == 0xF || y == 0xF;
+        int ends = 0;
+
+        // A skip over F000 NNNN skips four bytes, which is left to the
+        // interpreter. Skips cover the next instruction, so that writing a
+        // long instruction there later discards the block.
+        if (ops_is_skip(op) && ops_skip(machine->ram, addr + 2) != 2) {
+            emit_cycle(&p, addr, epilogue);
+            emit_fallback(&p, jit, addr, 1, epilogue);
+            addr += 4;
+            break;
+        }
+
+        emit_cycle(&p, addr, epilogue);
+
+        switch (op) {
+            case OP_NOP:
+                break;
+
+            case OP_JP:
+                // Loops back to the start of the block stay inside the block.
+                if (NNN(opcode) == start) {
+                    emit_jmp(&p, body);
+                } else {
+                    emit_set_pc(&p, NNN(opcode));
+                    emit_jmp(&p, epilogue);
+                }
+                ends = 1;
+                break;
+
+            case OP_SE_XKK:
+            case OP_SNE_XKK:
+                emit8(&p, 0x80);                        // cmp byte [VX], KK
+                emit_machine(&p, 7, OFFSET_V(x));
+                emit8(&p, KK(opcode));
+                emit_skip(&p, op == OP_SE_XKK ? CC_NE : CC_E, addr, epilogue);
+                ends = 2;
+                break;
+
+            case OP_SKP:
+            case OP_SKNP:
+                emit8(&p, 0x0F); emit8(&p, 0xB6);       // movzx eax, byte [VX]
+                emit_machine(&p, REG_AL, OFFSET_V(x));
+                emit8(&p, 0x83); emit8(&p, 0xE0);       // and eax, 0xF
+                emit8(&p, 0x0F);
+                emit8(&p, 0x66); emit8(&p, 0x0F);       // bt word [keys], ax
+                emit8(&p, 0xA3);
+                emit_machine(&p, REG_AL, OFFSET_KEYS);
+                emit_skip(&p, op == OP_SKP ? CC_NC : CC_C, addr, epilogue);
+                ends = 2;
+                break;
+
+            case OP_SE_XY:
+            case OP_SNE_XY:
+                emit_load(&p, REG_AL, x);
+                emit8(&p, 0x3A);                        // cmp al, [VY]
+                emit_machine(&p, REG_AL, OFFSET_V(y));
+                emit_skip(&p, op == OP_SE_XY ? CC_NE : CC_E, addr, epilogue);
+                ends = 2;
+                break;
+
+            case OP_LD_XKK:
+                emit8(&p, 0xC6);                        // mov byte [VX], KK
+                emit_machine(&p, 0, OFFSET_V(x));
+                emit8(&p, KK(opcode));
+                break;
+
+            case OP_ADD_XKK:
+                emit8(&p, 0x80);                        // add byte [VX], KK
+                emit_machine(&p, 0, OFFSET_V(x));
+                emit8(&p, KK(opcode));
+                break;
+
+            case OP_LD_XY:
+                emit_load(&p, REG_AL, y);
+                emit_store(&p, REG_AL, x);
+                break;
+
+            case OP_OR:
+            case OP_XOR:
+                emit_load(&p, REG_AL, y);
+                emit8(&p, op == OP_OR ? 0x08 : 0x30);   // or/xor [VX], al
+                emit_machine(&p, REG_AL, OFFSET_V(x));
+                break;
+
+            case OP_ADD_XY:
+            case OP_SUB:
+            case OP_SUBN:
+                if (writes_vf) {
+                    emit_fallback(&p, jit, addr, 0, epilogue);
+                    break;
+                }
+
+                emit_load(&p, REG_AL, x);
+                emit_load(&p, REG_CL, y);
+
+                if (op == OP_ADD_XY) {
+                    emit8(&p, 0x00); emit8(&p, 0xC8);   // add al, cl
+                    emit_setcc_vf(&p, CC_C);
+                    emit_store(&p, REG_AL, x);
+                } else if (op == OP_SUB) {
+                    emit8(&p, 0x38); emit8(&p, 0xC8);   // cmp al, cl
+                    emit_setcc_vf(&p, CC_A);
+                    emit8(&p, 0x28); emit8(&p, 0xC8);   // sub al, cl
+                    emit_store(&p, REG_AL, x);
+                } else {
+                    emit8(&p, 0x38); emit8(&p, 0xC1);   // cmp cl, al
+                    emit_setcc_vf(&p, CC_A);
+                    emit8(&p, 0x28); emit8(&p, 0xC1);   // sub cl, al
+                    emit_store(&p, REG_CL, x);
+                }
+                break;
+
+            case OP_SHR:
+            case OP_SHL:
+                if (writes_vf) {
+                    emit_fallback(&p, jit, addr, 0, epilogue);
+                    break;
+                }
+
+                emit_load(&p, REG_AL, x);
+                emit8(&p, 0xD0);                        // shr/shl al, 1
+                emit8(&p, op == OP_SHR ? 0xE8 : 0xE0);
+                emit_setcc_vf(&p, CC_C);
+                emit_store(&p, REG_AL, x);
+                break;
+
+            case OP_LD_I:
+                emit8(&p, 0x66); emit8(&p, 0xC7);       // mov word [I], NNN
+                emit_machine(&p, 0, OFFSET_I);
+                emit16(&p, NNN(opcode));
+                break;
+
+            case OP_ADD_I:
+                emit8(&p, 0x0F); emit8(&p, 0xB6);       // movzx eax, byte [VX]
+                emit_machine(&p, REG_AL, OFFSET_V(x));
+                emit8(&p, 0x66); emit8(&p, 0x01);       // add word [I], ax
+                emit_machine(&p, REG_AL, OFFSET_I);
+                break;
+
+            case OP_CALL:
+            case OP_RET:
+            case OP_JP_V0:
+            case OP_DRW:
+            case OP_LD_X_K:
+            case OP_LD_B:
+            case OP_LD_MEM_X:
+                emit_fallback(&p, jit, addr, 1, epilogue);
+                ends = 1;
+                break;
+
+            default:
+                emit_fallback(&p, jit, addr, 0, epilogue);
+                break;
+        }
+
+        if (ends) {
+            addr += 2 * ends;
+            break;
+        }
+    }
+
+    if (mprotect(window, window_size, PROT_READ | PROT_EXEC) != 0) {
+        return NULL;
+    }
+
+    jit->used = p - jit->code;
+    jit->blocks[start] = (jit_block)(uintptr_t)entry;
+    memset(jit->translated + start, 1, (addr < RAM_SIZE ? addr : RAM_SIZE) - start);
+
+    return jit->blocks[start];
+}
+
+struct chippy_jit *jit_create(void) {
+    struct chippy_jit *jit = calloc(1, sizeof(struct chippy_jit));
+
+    if (jit == NULL) {
+        return NULL;
+    }
+
+    jit->code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+
+    return jit;
+}
+
+unsigned long jit_run(struct chippy *machine, unsigned long cycles) {
+    struct chippy_jit *jit = machine->jit;
+
+    while (cycles > 0) {
+        uint16_t pc = machine->pc;
+
+        if (pc > RAM_SIZE - 2) {
+            break;
+        }
+
+        jit_block block = jit->blocks[pc];
+
+        if (block == NULL && (block = compile(jit, machine, pc)) == NULL) {
+            break;
+        }
+
+        jit->flushed = 0;
+        cycles = block(machine, cycles);
+
+        // FX0A is executed by the interpreter, and stops the machine.
+        if (machine->wait_key != -1) {
+            break;
+        }
+    }
+
+    return cycles;
+}
+
+void jit_invalidate(struct chippy_jit *jit, uint16_t address, uint32_t length) {
+    int hit = 0;
+
+    for (uint32_t i = 0; i < length; i++) {
+        hit |= jit->translated[(address + i) & (RAM_SIZE - 1)];
+    }
+
+    // Blocks are not tracked individually, so any write into translated code
+    // discards all of them.
+    if (hit) {
+        flush(jit);
+    }
+}
+
+void jit_destroy(struct chippy_jit *jit) {
+    if (jit == NULL) {
+        return;
+    }
+
+    munmap(jit->code, CODE_SIZE);
+    free(jit);
+}
+
+#else
+
+struct chippy_jit *jit_create(void) {
+    return NULL;
+}
+
+unsigned long jit_run(struct chippy *machine, unsigned long cycles) {
+    (void)machine;
+
+    return cycles;
+}
+
+void jit_invalidate(struct chippy_jit *jit, uint16_t address, uint32_t length) {
+    (void)jit;
+    (void)address;
+    (void)length;
+}
+
+void jit_destroy(struct chippy_jit *jit) {
+    (void)jit;
+}
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "chippy.h"
+
+/**
+ * Whether the JIT compiler supports the host. On other hosts the functions
+ * below are still available, but never execute any cycles.
+ */
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+/**
+ * Creates the JIT state for a machine.
+ *
+ * @return Returns the JIT state, or NULL when the JIT is not available.
+ */
+struct chippy_jit *jit_create(void);
+
+/**
+ * Runs translated basic blocks until the given number of cycles has been
+ * executed, until an instruction is reached that cannot be translated, or until
+ * the machine starts waiting for a key press.
+ *
+ * @param machine The machine to run, which must have its JIT state created.
+ * @param cycles  The maximum number of cycles to execute.
+ *
+ * @return Returns the number of cycles that were not executed.
+ */
+unsigned long jit_run(struct chippy *machine, unsigned long cycles);
+
+/**
+ * Discards the translated blocks overlapping the given memory range.
+ *
+ * @param jit     The JIT state of the machine whose RAM was written to.
+ * @param address The first address that was written to.
+ * @param length  The number of bytes that were written.
+ */
+void jit_invalidate(struct chippy_jit *jit, uint16_t address, uint32_t length);
+
+/**
+ * Frees the JIT state and its code buffer.
+ *
+ * @param jit The JIT state to destroy.
+ */
+void jit_destroy(struct chippy_jit *jit);
+
+#endif
@@ -0,0 +1,191 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "library.h"
+#include "ops.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Hashes the contents of a ROM with 64-bit FNV-1a.
+ */
+static uint64_t hash(const uint8_t *data, size_t size) {
+    uint64_t h = UINT64_C(0xCBF29CE484222325);
+
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ data[i]) * UINT64_C(0x100000001B3);
+    }
+
+    return h;
+}
+
+struct chippy_library *chippy_library_create(void) {
+    struct chippy_library *library = calloc(1, sizeof(struct chippy_library));
+
+    if (library == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&library->lock, NULL);
+
+    return library;
+}
+
+/**
+ * Maps a file into memory read-only.
+ *
+ * @return Returns 0 on success, otherwise one of enum chippy_rom_error.
+ */
+static int map(const char *path, const uint8_t **data, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1) {
+        return CHIPPY_ROM_UNREADABLE;
+    }
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return CHIPPY_ROM_UNREADABLE;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        return CHIPPY_ROM_EMPTY;
+    }
+
+    if (st.st_size > MAX_ROM_SIZE) {
+        close(fd);
+        return CHIPPY_ROM_TOO_LARGE;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return CHIPPY_ROM_UNREADABLE;
+    }
+
+    *data = mapping;
+    *size = st.st_size;
+
+    return CHIPPY_ROM_OK;
+}
+
+/**
+ * Creates a ROM from mapped contents, and decodes the instruction at every
+ * offset whose two bytes are both part of the contents.
+ */
+static struct chippy_rom *create_rom(const uint8_t *data, size_t size, uint64_t h) {
+    struct chippy_rom *rom = malloc(sizeof(struct chippy_rom));
+
+    if (rom == NULL) {
+        return NULL;
+    }
+
+    rom->decoded = malloc(size * sizeof(struct chippy_insn));
+
+    if (rom->decoded == NULL) {
+        free(rom);
+        return NULL;
+    }
+
+    for (size_t i = 0; i + 1 < size; i++) {
+        ops_decode(data[i] << 8 | data[i + 1], &rom->decoded[i]);
+    }
+
+    rom->data = data;
+    rom->size = size;
+    rom->hash = h;
+    rom->next = NULL;
+
+    return rom;
+}
+
+int chippy_library_open(struct chippy_library *library, const char *path, const struct chippy_rom **rom) {
+    const uint8_t *data;
+    size_t size;
+    int error = map(path, &data, &size);
+
+    if (error != CHIPPY_ROM_OK) {
+        return error;
+    }
+
+    uint64_t h = hash(data, size);
+    struct chippy_rom **bucket = &library->buckets[h % LIBRARY_BUCKETS];
+
+    pthread_mutex_lock(&library->lock);
+
+    for (struct chippy_rom *existing = *bucket; existing != NULL; existing = existing->next) {
+        if (existing->hash == h && existing->size == size && memcmp(existing->data, data, size) == 0) {
+            pthread_mutex_unlock(&library->lock);
+            munmap((void *)data, size);
+
+            *rom = existing;
+
+            return CHIPPY_ROM_OK;
+        }
+    }
+
+    struct chippy_rom *created = create_rom(data, size, h);
+
+    if (created == NULL) {
+        pthread_mutex_unlock(&library->lock);
+        munmap((void *)data, size);
+
+        return CHIPPY_ROM_UNREADABLE;
+    }
+
+    created->next = *bucket;
+    *bucket = created;
+
+    pthread_mutex_unlock(&library->lock);
+
+    *rom = created;
+
+    return CHIPPY_ROM_OK;
+}
+
+void chippy_load(struct chippy *machine, const struct chippy_rom *rom) {
+    memcpy(machine->ram + PROGRAM_START, rom->data, rom->size);
+
+    // Invalidating also discards what the JIT translated, and marks the pages
+    // as written. The decoded instructions of the ROM are copied in after.
+    chippy_invalidate(machine, PROGRAM_START, rom->size);
+
+    memcpy(machine->decoded + PROGRAM_START, rom->decoded, (rom->size - 1) * sizeof(struct chippy_insn));
+}
+
+void chippy_library_destroy(struct chippy_library *library) {
+    for (int i = 0; i < LIBRARY_BUCKETS; i++) {
+        struct chippy_rom *rom = library->buckets[i];
+
+        while (rom != NULL) {
+            struct chippy_rom *next = rom->next;
+
+            munmap((void *)rom->data, rom->size);
+
+            free(rom->decoded);
+            free(rom);
+
+            rom = next;
+        }
+    }
+
+    pthread_mutex_destroy(&library->lock);
+    free(library);
+}
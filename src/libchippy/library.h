@@ -0,0 +1,85 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __LIBRARY_H__
+#define __LIBRARY_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "chippy.h"
+
+/**
+ * A read-only ROM image, shared by every machine that loads it. Next to the
+ * contents, the instructions at every address of the image are decoded once,
+ * so that machines loading the ROM start with a filled instruction cache.
+ */
+struct chippy_rom {
+    const uint8_t *data;                // Contents of the ROM
+    size_t size;                        // Size of the contents
+    uint64_t hash;                      // Hash of the contents
+
+    struct chippy_insn *decoded;        // Decoded instruction at every offset
+
+    struct chippy_rom *next;            // Next ROM in the same bucket
+};
+
+/**
+ * The number of buckets in the table of ROMs, indexed by content hash.
+ */
+#define LIBRARY_BUCKETS 64
+
+/**
+ * A set of ROMs, each stored once by content. Opening a file whose contents
+ * are already in the library returns the existing ROM. Libraries can be
+ * shared between threads.
+ */
+struct chippy_library {
+    struct chippy_rom *buckets[LIBRARY_BUCKETS];
+    pthread_mutex_t lock;
+};
+
+/**
+ * Creates an empty library.
+ *
+ * @return Returns the library, or NULL when out of memory.
+ */
+struct chippy_library *chippy_library_create(void);
+
+/**
+ * Maps a ROM file into memory and adds it to the library, unless a ROM with
+ * the same contents is already in it. ROMs stay valid until the library is
+ * destroyed.
+ *
+ * @param library The library to add the ROM to.
+ * @param path    The filepath to the ROM to open.
+ * @param rom     Receives the ROM.
+ *
+ * @return Returns 0 on success, otherwise one of enum chippy_rom_error.
+ */
+int chippy_library_open(struct chippy_library *library, const char *path, const struct chippy_rom **rom);
+
+/**
+ * Loads a ROM from a library into the memory of a machine, together with its
+ * decoded instructions. This only copies memory, so it is much faster than
+ * chippy_load_rom().
+ *
+ * @param machine The machine to load the ROM into.
+ * @param rom     The ROM to load.
+ */
+void chippy_load(struct chippy *machine, const struct chippy_rom *rom);
+
+/**
+ * Frees all ROMs in the library, and the library itself.
+ *
+ * @param library The library to destroy.
+ */
+void chippy_library_destroy(struct chippy_library *library);
+
+#endif
@@ -0,0 +1,585 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include "lockstep.h"
+#include "ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Rows of lanes are handled with GNU C vector extensions, which the compiler
+ * lowers to SSE2 or AVX2 instructions. On x86-64 Linux the stepper is compiled
+ * for both, and the best version is picked when the library is loaded.
+ */
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) && !defined(__clang__)
+#define LOCKSTEP_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define LOCKSTEP_CLONES
+#endif
+
+typedef uint8_t lane8 __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef int8_t mask8 __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef uint16_t lane16 __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+typedef int16_t mask16 __attribute__((vector_size(LOCKSTEP_LANES * 2)));
+
+#define LOAD(type, row) ({ type v_; memcpy(&v_, (row), sizeof(v_)); v_; })
+#define STORE(row, v)   do { __typeof__(v) v_ = (v); memcpy((row), &v_, sizeof(v_)); } while (0)
+
+#define SELECT8(m, a, b)  ((lane8)(((mask8)(a) & (m)) | ((mask8)(b) & ~(m))))
+#define SELECT16(m, a, b) ((lane16)(((mask16)(a) & (m)) | ((mask16)(b) & ~(m))))
+
+#define WIDEN(v) __builtin_convertvector((v), lane16)
+
+#define FOR_EACH_LANE(lane) for (int lane = 0; lane < LOCKSTEP_LANES; lane++) if (m16[lane])
+
+void chippy_lockstep_init(struct chippy_lockstep *lockstep, int lanes) {
+    memset(lockstep, 0, sizeof(struct chippy_lockstep));
+
+    lockstep->lanes = lanes;
+    lockstep->cycles_per_tick = DEFAULT_CYCLES_PER_TICK;
+}
+
+void chippy_lockstep_load(struct chippy_lockstep *lockstep, int lane, const struct chippy *machine) {
+    for (int i = 0; i < 16; i++) {
+        lockstep->V[i][lane] = machine->V[i];
+        lockstep->stack[i][lane] = machine->stack[i];
+        lockstep->flags[i][lane] = machine->flags[i];
+    }
+
+    for (int i = 0; i < AUDIO_PATTERN_SIZE; i++) {
+        lockstep->pattern[i][lane] = machine->pattern[i];
+    }
+
+    lockstep->pc[lane] = machine->pc;
+    lockstep->I[lane] = machine->I;
+    lockstep->sp[lane] = machine->sp;
+    lockstep->dt[lane] = machine->dt;
+    lockstep->st[lane] = machine->st;
+    lockstep->dt_cycle[lane] = machine->dt_cycle;
+    lockstep->st_cycle[lane] = machine->st_cycle;
+    lockstep->cycles[lane] = machine->cycles;
+    lockstep->keys[lane] = machine->keys;
+    lockstep->wait_key[lane] = machine->wait_key;
+    lockstep->wait_held[lane] = machine->wait_held;
+    lockstep->rng[lane] = machine->rng;
+    lockstep->cycles_per_tick = machine->cycles_per_tick;
+    lockstep->hires[lane] = machine->hires;
+    lockstep->planes[lane] = machine->planes;
+    lockstep->pitch[lane] = machine->pitch;
+
+    memcpy(lockstep->gfx[lane], machine->gfx, sizeof(machine->gfx));
+    memcpy(lockstep->ram[lane], machine->ram, sizeof(machine->ram));
+
+    for (int i = 0; lane != 0 && i < RAM_SIZE; i++) {
+        lockstep->written[i] |= lockstep->ram[lane][i] != lockstep->ram[0][i];
+    }
+}
+
+void chippy_lockstep_store(const struct chippy_lockstep *lockstep, int lane, struct chippy *machine) {
+    for (int i = 0; i < 16; i++) {
+        machine->V[i] = lockstep->V[i][lane];
+        machine->stack[i] = lockstep->stack[i][lane];
+        machine->flags[i] = lockstep->flags[i][lane];
+    }
+
+    for (int i = 0; i < AUDIO_PATTERN_SIZE; i++) {
+        machine->pattern[i] = lockstep->pattern[i][lane];
+    }
+
+    machine->pc = lockstep->pc[lane];
+    machine->I = lockstep->I[lane];
+    machine->sp = lockstep->sp[lane];
+    machine->dt = lockstep->dt[lane];
+    machine->st = lockstep->st[lane];
+    machine->dt_cycle = lockstep->dt_cycle[lane];
+    machine->st_cycle = lockstep->st_cycle[lane];
+    machine->cycles = lockstep->cycles[lane];
+    machine->keys = lockstep->keys[lane];
+    machine->wait_key = lockstep->wait_key[lane];
+    machine->wait_held = lockstep->wait_held[lane];
+    machine->rng = lockstep->rng[lane];
+    machine->cycles_per_tick = lockstep->cycles_per_tick;
+    machine->hires = lockstep->hires[lane];
+    machine->planes = lockstep->planes[lane];
+    machine->pitch = lockstep->pitch[lane];
+
+    memcpy(machine->gfx, lockstep->gfx[lane], sizeof(machine->gfx));
+    chippy_invalidate_gfx(machine, GFX_ALL_ROWS);
+    memcpy(machine->ram, lockstep->ram[lane], sizeof(machine->ram));
+
+    chippy_invalidate(machine, 0, RAM_SIZE);
+}
+
+/**
+ * Writes a byte into the memory of a lane. The lanes may no longer agree on
+ * the contents of the address afterwards.
+ */
+static inline void poke(struct chippy_lockstep *lockstep, int lane, uint16_t address, uint8_t value) {
+    address &= RAM_SIZE - 1;
+
+    lockstep->ram[lane][address] = value;
+    lockstep->written[address] = 1;
+}
+
+/**
+ * Returns whether the given instruction can leave lanes that executed it
+ * together at different addresses, or stop some of them.
+ */
+static inline int diverges(uint8_t op) {
+    switch (op) {
+        case OP_RET:
+        case OP_SE_XKK:
+        case OP_SNE_XKK:
+        case OP_SE_XY:
+        case OP_SNE_XY:
+        case OP_SKP:
+        case OP_SKNP:
+        case OP_JP_V0:
+        case OP_LD_X_K:
+            return 1;
+    }
+
+    return 0;
+}
+
+LOCKSTEP_CLONES
+int chippy_lockstep_run(struct chippy_lockstep *lockstep, unsigned long cycles) {
+    unsigned long left[LOCKSTEP_LANES] = { 0 };
+    unsigned long pending = 0;
+    unsigned long limit = 0;
+    mask16 m16 = { 0 };
+    mask8 m8 = { 0 };
+    int uniform = 0;
+    int first = 0;
+    uint16_t leader = 0;
+
+    for (int lane = 0; lane < lockstep->lanes; lane++) {
+        left[lane] = cycles;
+
+        if (lockstep->wait_key[lane] == -1) {
+            continue;
+        }
+
+        // Keys only change between runs, so a waiting lane either continues
+        // with a key pressed since it started waiting, or spends all cycles
+        // waiting.
+        uint16_t pressed = lockstep->keys[lane] & ~lockstep->wait_held[lane];
+
+        lockstep->wait_held[lane] &= lockstep->keys[lane];
+
+        if (pressed != 0) {
+            lockstep->V[lockstep->wait_key[lane]][lane] = __builtin_ctz(pressed);
+            lockstep->wait_key[lane] = -1;
+        } else {
+            lockstep->cycles[lane] += cycles;
+            left[lane] = 0;
+        }
+    }
+
+    // The cycle counters of the lanes in the current mask are only brought up
+    // to date when the mask changes, or when an instruction reads them.
+#define FLUSH() do {                                    \
+        FOR_EACH_LANE(lane) {                           \
+            lockstep->cycles[lane] += pending;          \
+            left[lane] -= pending;                      \
+        }                                               \
+        limit -= pending;                               \
+        pending = 0;                                    \
+    } while (0)
+
+    for (;;) {
+        // Lanes that reconverged after taking different paths can have a
+        // different number of cycles left, so the lanes run together until the
+        // first of them is done.
+        if (uniform && pending == limit) {
+            uniform = 0;
+        }
+
+        if (uniform) {
+            // All remaining lanes executed the previous instruction together
+            // and continued at the same address.
+            leader = lockstep->pc[first];
+        } else {
+            int live = 0;
+            int count = 0;
+
+            FLUSH();
+
+            first = -1;
+
+            for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+                if (left[lane] != 0 && (first == -1 || lockstep->pc[lane] < leader)) {
+                    leader = lockstep->pc[lane];
+                    first = lane;
+                }
+            }
+
+            if (first == -1) {
+                break;
+            }
+
+            limit = left[first];
+
+            for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+                m16[lane] = left[lane] != 0 && lockstep->pc[lane] == leader ? -1 : 0;
+                live += left[lane] != 0;
+                count += m16[lane] != 0;
+
+                if (left[lane] != 0 && left[lane] < limit) {
+                    limit = left[lane];
+                }
+            }
+
+            m8 = __builtin_convertvector(m16, mask8);
+            uniform = count == live;
+        }
+
+        uint16_t address = leader & (RAM_SIZE - 1);
+        uint16_t next = (leader + 1) & (RAM_SIZE - 1);
+        uint16_t opcode = lockstep->ram[first][address] << 8 | lockstep->ram[first][next];
+
+        // Only instructions at addresses that were written to can differ
+        // between lanes.
+        if (lockstep->written[address] | lockstep->written[next]) {
+            FLUSH();
+
+            FOR_EACH_LANE(lane) {
+                if ((lockstep->ram[lane][address] << 8 | lockstep->ram[lane][next]) != opcode) {
+                    m16[lane] = 0;
+                    uniform = 0;
+                }
+            }
+
+            m8 = __builtin_convertvector(m16, mask8);
+        }
+
+        uint8_t op = chippy_decode_op(opcode);
+        uint8_t x = X(opcode);
+        uint8_t y = Y(opcode);
+        uint8_t kk = KK(opcode);
+        uint16_t nnn = NNN(opcode);
+
+        lane8 vx = LOAD(lane8, lockstep->V[x]);
+        lane8 vy = LOAD(lane8, lockstep->V[y]);
+        lane16 pc = LOAD(lane16, lockstep->pc);
+        lane16 I = LOAD(lane16, lockstep->I);
+        mask8 skip = { 0 };
+        lane8 skipped = { 0 };
+
+        pc = SELECT16(m16, (lane16){ 0 } + (uint16_t)(leader + 2), pc);
+
+        switch (op) {
+            case OP_NOP:
+                break;
+
+            case OP_CLS:
+                FOR_EACH_LANE(lane) {
+                    ops_clear(lockstep->gfx[lane], lockstep->hires[lane], lockstep->planes[lane]);
+                }
+                break;
+
+            case OP_RET:
+                FOR_EACH_LANE(lane) {
+                    pc[lane] = lockstep->stack[--lockstep->sp[lane] & 0xF][lane];
+                }
+                break;
+
+            case OP_JP:
+                pc = SELECT16(m16, (lane16){ 0 } + nnn, pc);
+                break;
+
+            case OP_CALL:
+                FOR_EACH_LANE(lane) {
+                    lockstep->stack[lockstep->sp[lane]++ & 0xF][lane] = pc[lane];
+                }
+                pc = SELECT16(m16, (lane16){ 0 } + nnn, pc);
+                break;
+
+            case OP_SE_XKK:
+                skip = vx == kk;
+                break;
+
+            case OP_SNE_XKK:
+                skip = vx != kk;
+                break;
+
+            case OP_SE_XY:
+                skip = vx == vy;
+                break;
+
+            case OP_SNE_XY:
+                skip = vx != vy;
+                break;
+
+            case OP_SKP:
+            case OP_SKNP:
+                FOR_EACH_LANE(lane) {
+                    skip[lane] = -(((lockstep->keys[lane] >> (vx[lane] & 0xF)) & 1) == (op == OP_SKP));
+                }
+                break;
+
+            case OP_LD_XKK:
+                STORE(lockstep->V[x], SELECT8(m8, (lane8){ 0 } + kk, vx));
+                break;
+
+            case OP_ADD_XKK:
+                STORE(lockstep->V[x], SELECT8(m8, vx + kk, vx));
+                break;
+
+            case OP_LD_XY:
+                STORE(lockstep->V[x], SELECT8(m8, vy, vx));
+                break;
+
+            case OP_OR:
+                STORE(lockstep->V[x], SELECT8(m8, vx | vy, vx));
+                break;
+
+            case OP_XOR:
+                STORE(lockstep->V[x], SELECT8(m8, vx ^ vy, vx));
+                break;
+
+            // The instructions below write VF before VX, and read VX and VY
+            // again in between, exactly like the interpreter does.
+            case OP_ADD_XY:
+                STORE(lockstep->V[0xF], SELECT8(m8, (lane8)((lane8)(vx + vy) < vx) & 1, LOAD(lane8, lockstep->V[0xF])));
+                vx = LOAD(lane8, lockstep->V[x]);
+                vy = LOAD(lane8, lockstep->V[y]);
+                STORE(lockstep->V[x], SELECT8(m8, vx + vy, vx));
+                break;
+
+            case OP_SUB:
+                STORE(lockstep->V[0xF], SELECT8(m8, (lane8)(vx > vy) & 1, LOAD(lane8, lockstep->V[0xF])));
+                vx = LOAD(lane8, lockstep->V[x]);
+                vy = LOAD(lane8, lockstep->V[y]);
+                STORE(lockstep->V[x], SELECT8(m8, vx - vy, vx));
+                break;
+
+            case OP_SHR:
+                STORE(lockstep->V[0xF], SELECT8(m8, vx & 1, LOAD(lane8, lockstep->V[0xF])));
+                vx = LOAD(lane8, lockstep->V[x]);
+                STORE(lockstep->V[x], SELECT8(m8, vx >> 1, vx));
+                break;
+
+            case OP_SUBN:
+                STORE(lockstep->V[0xF], SELECT8(m8, (lane8)(vy > vx) & 1, LOAD(lane8, lockstep->V[0xF])));
+                vx = LOAD(lane8, lockstep->V[x]);
+                vy = LOAD(lane8, lockstep->V[y]);
+                STORE(lockstep->V[x], SELECT8(m8, vy - vx, vx));
+                break;
+
+            case OP_SHL:
+                STORE(lockstep->V[0xF], SELECT8(m8, vx >> 7, LOAD(lane8, lockstep->V[0xF])));
+                vx = LOAD(lane8, lockstep->V[x]);
+                STORE(lockstep->V[x], SELECT8(m8, vx << 1, vx));
+                break;
+
+            case OP_LD_I:
+                I = SELECT16(m16, (lane16){ 0 } + nnn, I);
+                break;
+
+            case OP_JP_V0:
+                pc = SELECT16(m16, WIDEN(LOAD(lane8, lockstep->V[0])) + nnn, pc);
+                break;
+
+            case OP_RND:
+                FOR_EACH_LANE(lane) {
+                    lockstep->V[x][lane] = ops_random_byte(&lockstep->rng[lane]) & kk;
+                }
+                break;
+
+            case OP_DRW:
+                FOR_EACH_LANE(lane) {
+                    lockstep->V[0xF][lane] = ops_draw(lockstep->gfx[lane], lockstep->hires[lane], lockstep->planes[lane],
+                        lockstep->ram[lane], I[lane], vx[lane], vy[lane], N(opcode));
+                }
+                break;
+
+            case OP_LD_X_DT:
+                FLUSH();
+                FOR_EACH_LANE(lane) {
+                    lockstep->V[x][lane] = ops_timer_value(lockstep->dt[lane], lockstep->dt_cycle[lane], lockstep->cycles[lane], lockstep->cycles_per_tick);
+                }
+                break;
+
+            case OP_LD_X_K:
+                // Keys only change between runs, so the remaining cycles are
+                // spent waiting.
+                FLUSH();
+                FOR_EACH_LANE(lane) {
+                    lockstep->wait_key[lane] = x;
+                    lockstep->wait_held[lane] = lockstep->keys[lane];
+                    lockstep->cycles[lane] += left[lane] - 1;
+                    left[lane] = 1;
+                }
+                break;
+
+            case OP_LD_DT_X:
+                FLUSH();
+                FOR_EACH_LANE(lane) {
+                    lockstep->dt[lane] = vx[lane];
+                    lockstep->dt_cycle[lane] = lockstep->cycles[lane];
+                }
+                break;
+
+            case OP_LD_ST_X:
+                FLUSH();
+                FOR_EACH_LANE(lane) {
+                    lockstep->st[lane] = vx[lane];
+                    lockstep->st_cycle[lane] = lockstep->cycles[lane];
+                }
+                break;
+
+            case OP_ADD_I:
+                I = SELECT16(m16, I + WIDEN(vx), I);
+                break;
+
+            case OP_LD_F:
+                I = SELECT16(m16, WIDEN(vx) * 5, I);
+                break;
+
+            case OP_LD_B:
+                FOR_EACH_LANE(lane) {
+                    poke(lockstep, lane, I[lane], vx[lane] / 100);
+                    poke(lockstep, lane, I[lane] + 1, (vx[lane] / 10) % 10);
+                    poke(lockstep, lane, I[lane] + 2, vx[lane] % 10);
+                }
+                break;
+
+            case OP_LD_MEM_X:
+                FOR_EACH_LANE(lane) {
+                    for (int i = 0; i <= x; i++) {
+                        poke(lockstep, lane, I[lane] + i, lockstep->V[i][lane]);
+                    }
+                }
+                break;
+
+            case OP_LD_X_MEM:
+                FOR_EACH_LANE(lane) {
+                    for (int i = 0; i <= x; i++) {
+                        lockstep->V[i][lane] = lockstep->ram[lane][(I[lane] + i) & (RAM_SIZE - 1)];
+                    }
+                }
+                break;
+
+            case OP_SCD:
+            case OP_SCU:
+                FOR_EACH_LANE(lane) {
+                    ops_scroll_vertical(lockstep->gfx[lane], lockstep->hires[lane], lockstep->planes[lane],
+                        op == OP_SCD ? N(opcode) : -N(opcode));
+                }
+                break;
+
+            case OP_SCR:
+            case OP_SCL:
+                FOR_EACH_LANE(lane) {
+                    ops_scroll_horizontal(lockstep->gfx[lane], lockstep->hires[lane], lockstep->planes[lane], op == OP_SCL);
+                }
+                break;
+
+            case OP_EXIT:
+                pc = SELECT16(m16, (lane16){ 0 } + leader, pc);
+                break;
+
+            case OP_LOW:
+            case OP_HIGH:
+                FOR_EACH_LANE(lane) {
+                    lockstep->hires[lane] = op == OP_HIGH;
+                    ops_clear(lockstep->gfx[lane], 1, 0x3);
+                }
+                break;
+
+            case OP_SAVE_XY:
+                FOR_EACH_LANE(lane) {
+                    for (int i = 0, step = x <= y ? 1 : -1; i <= (y - x) * step; i++) {
+                        poke(lockstep, lane, I[lane] + i, lockstep->V[x + i * step][lane]);
+                    }
+                }
+                break;
+
+            case OP_LOAD_XY:
+                FOR_EACH_LANE(lane) {
+                    for (int i = 0, step = x <= y ? 1 : -1; i <= (y - x) * step; i++) {
+                        lockstep->V[x + i * step][lane] = lockstep->ram[lane][(I[lane] + i) & (RAM_SIZE - 1)];
+                    }
+                }
+                break;
+
+            case OP_LD_I_LONG:
+                // The operand may have been written differently by every lane.
+                FOR_EACH_LANE(lane) {
+                    I[lane] = lockstep->ram[lane][(uint16_t)(leader + 2)] << 8 | lockstep->ram[lane][(uint16_t)(leader + 3)];
+                }
+                pc = SELECT16(m16, (lane16){ 0 } + (uint16_t)(leader + 4), pc);
+                break;
+
+            case OP_PLANE:
+                FOR_EACH_LANE(lane) {
+                    lockstep->planes[lane] = x & 0x3;
+                }
+                break;
+
+            case OP_LD_HF:
+                I = SELECT16(m16, WIDEN(vx & 0xF) * 10 + BIG_FONT_ADDRESS, I);
+                break;
+
+            case OP_LD_R_X:
+                for (int i = 0; i <= x; i++) {
+                    STORE(lockstep->flags[i], SELECT8(m8, LOAD(lane8, lockstep->V[i]), LOAD(lane8, lockstep->flags[i])));
+                }
+                break;
+
+            case OP_LD_X_R:
+                for (int i = 0; i <= x; i++) {
+                    STORE(lockstep->V[i], SELECT8(m8, LOAD(lane8, lockstep->flags[i]), LOAD(lane8, lockstep->V[i])));
+                }
+                break;
+
+            case OP_AUDIO:
+                FOR_EACH_LANE(lane) {
+                    for (int i = 0; i < AUDIO_PATTERN_SIZE; i++) {
+                        lockstep->pattern[i][lane] = lockstep->ram[lane][(I[lane] + i) & (RAM_SIZE - 1)];
+                    }
+                }
+                break;
+
+            case OP_PITCH:
+                STORE(lockstep->pitch, SELECT8(m8, vx, LOAD(lane8, lockstep->pitch)));
+                break;
+        }
+
+        // Skips skip four bytes over F000 NNNN, which may have been written
+        // differently by every lane.
+        if (ops_is_skip(op)) {
+            uint16_t after = leader + 2;
+
+            if (lockstep->written[after] | lockstep->written[(uint16_t)(after + 1)]) {
+                FOR_EACH_LANE(lane) {
+                    skipped[lane] = ops_skip(lockstep->ram[lane], after);
+                }
+            } else {
+                skipped += (uint8_t)ops_skip(lockstep->ram[first], after);
+            }
+        }
+
+        pc += WIDEN((lane8)(skip & m8) & skipped);
+
+        STORE(lockstep->pc, pc);
+        STORE(lockstep->I, I);
+
+        pending++;
+        uniform = uniform && !diverges(op);
+    }
+
+    FLUSH();
+
+#undef FLUSH
+
+    return EXIT_SUCCESS;
+}
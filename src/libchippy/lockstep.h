@@ -0,0 +1,102 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __LOCKSTEP_H__
+#define __LOCKSTEP_H__
+
+#include "chippy.h"
+
+/**
+ * The maximum number of machines stepped together.
+ */
+#define LOCKSTEP_LANES 32
+
+/**
+ * A group of machines in structure-of-arrays layout. Every register is stored
+ * as a row with one entry per machine (lane), so that one vector instruction
+ * executes an opcode for all lanes at once.
+ *
+ * Lanes are meant to run the same program with different input. Lanes whose
+ * program counters diverge are executed in turns, lowest address first, so
+ * that they can converge again.
+ */
+struct chippy_lockstep {
+    uint8_t V[16][LOCKSTEP_LANES];          // General purpose registers
+
+    uint16_t pc[LOCKSTEP_LANES];            // Program counters
+    uint16_t I[LOCKSTEP_LANES];             // Index registers
+    uint16_t sp[LOCKSTEP_LANES];            // Stack pointers
+    uint16_t stack[16][LOCKSTEP_LANES];     // Stacks
+
+    uint8_t dt[LOCKSTEP_LANES];             // Delay timers, as last set
+    uint8_t st[LOCKSTEP_LANES];             // Sound timers, as last set
+    uint64_t dt_cycle[LOCKSTEP_LANES];      // Cycles at which the delay timers were set
+    uint64_t st_cycle[LOCKSTEP_LANES];      // Cycles at which the sound timers were set
+    uint64_t cycles[LOCKSTEP_LANES];        // Numbers of cycles executed
+
+    uint16_t keys[LOCKSTEP_LANES];          // Keypads, bit N is set while key N is held
+    int8_t wait_key[LOCKSTEP_LANES];        // Registers to store a key press in, -1 when not waiting
+    uint16_t wait_held[LOCKSTEP_LANES];     // Keys held when the waits started
+    uint64_t rng[LOCKSTEP_LANES];           // Random number generator states
+
+    uint32_t cycles_per_tick;               // Number of cycles per timer tick
+    int lanes;                              // Number of lanes in use
+
+    uint8_t written[RAM_SIZE];              // Whether lanes may differ at an address
+
+    uint8_t hires[LOCKSTEP_LANES];          // Whether the displays are in 128x64 mode
+    uint8_t planes[LOCKSTEP_LANES];         // Bitplanes selected for drawing
+    uint8_t flags[16][LOCKSTEP_LANES];      // Persistent flag registers
+    uint8_t pattern[AUDIO_PATTERN_SIZE][LOCKSTEP_LANES]; // Audio patterns
+    uint8_t pitch[LOCKSTEP_LANES];          // Audio pitches
+
+    uint64_t gfx[LOCKSTEP_LANES][GFX_PLANES][HIRES_SCREEN_H][GFX_WORDS]; // Graphics buffers
+    uint8_t ram[LOCKSTEP_LANES][RAM_SIZE];  // Memory
+};
+
+/**
+ * Initializes a group of machines. Every lane has to be loaded with
+ * chippy_lockstep_load() before the group is run.
+ *
+ * @param lockstep The group to initialize.
+ * @param lanes    The number of lanes to use, at most LOCKSTEP_LANES.
+ */
+void chippy_lockstep_init(struct chippy_lockstep *lockstep, int lanes);
+
+/**
+ * Copies the state of a machine into a lane.
+ *
+ * @param lockstep The group to load the machine into.
+ * @param lane     The lane to load the machine into.
+ * @param machine  The machine to copy.
+ */
+void chippy_lockstep_load(struct chippy_lockstep *lockstep, int lane, const struct chippy *machine);
+
+/**
+ * Copies the state of a lane back into a machine.
+ *
+ * @param lockstep The group to copy the lane from.
+ * @param lane     The lane to copy.
+ * @param machine  The machine to copy the lane into.
+ */
+void chippy_lockstep_store(const struct chippy_lockstep *lockstep, int lane, struct chippy *machine);
+
+/**
+ * Performs the given number of instruction cycles on every lane. Each lane
+ * ends up in the same state as a machine stepped that many times with
+ * chippy_step().
+ *
+ * @param lockstep The group to run.
+ * @param cycles   The number of cycles to perform per lane.
+ *
+ * @return Returns 0 on success, otherwise 1.
+ */
+int chippy_lockstep_run(struct chippy_lockstep *lockstep, unsigned long cycles);
+
+#endif
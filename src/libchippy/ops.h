@@ -0,0 +1,293 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __OPS_H__
+#define __OPS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chippy.h"
+
+#define NNN(opcode) (opcode & 0x0FFF)
+#define KK(opcode)  (opcode & 0x00FF)
+#define N(opcode)   (opcode & 0x000F)
+#define X(opcode)   ((opcode >> 8) & 0x000F)
+#define Y(opcode)   ((opcode >> 4) & 0x000F)
+#define P(opcode)   (opcode >> 12)
+
+/**
+ * Handler indices for decoded instructions. OP_DECODE must be zero, so that a
+ * cleared cache slot decodes itself on its first execution.
+ */
+enum {
+    OP_DECODE = 0,
+    OP_NOP,
+    OP_CLS,
+    OP_RET,
+    OP_JP,
+    OP_CALL,
+    OP_SE_XKK,
+    OP_SNE_XKK,
+    OP_SE_XY,
+    OP_LD_XKK,
+    OP_ADD_XKK,
+    OP_LD_XY,
+    OP_OR,
+    OP_XOR,
+    OP_ADD_XY,
+    OP_SUB,
+    OP_SHR,
+    OP_SUBN,
+    OP_SHL,
+    OP_SNE_XY,
+    OP_LD_I,
+    OP_JP_V0,
+    OP_RND,
+    OP_DRW,
+    OP_SKP,
+    OP_SKNP,
+    OP_LD_X_DT,
+    OP_LD_X_K,
+    OP_LD_DT_X,
+    OP_LD_ST_X,
+    OP_ADD_I,
+    OP_LD_F,
+    OP_LD_B,
+    OP_LD_MEM_X,
+    OP_LD_X_MEM,
+    OP_SCD,
+    OP_SCU,
+    OP_SCR,
+    OP_SCL,
+    OP_EXIT,
+    OP_LOW,
+    OP_HIGH,
+    OP_SAVE_XY,
+    OP_LOAD_XY,
+    OP_LD_I_LONG,
+    OP_PLANE,
+    OP_LD_HF,
+    OP_LD_R_X,
+    OP_LD_X_R,
+    OP_AUDIO,
+    OP_PITCH,
+    OP_COUNT
+};
+
+/**
+ * Maps an opcode to the index of the handler that executes it.
+ *
+ * @param opcode The opcode to decode.
+ *
+ * @return Returns the handler index, OP_NOP for unknown opcodes.
+ */
+uint8_t chippy_decode_op(uint16_t opcode);
+
+/**
+ * Decodes an opcode into a cache slot.
+ */
+static inline void ops_decode(uint16_t opcode, struct chippy_insn *insn) {
+    insn->op = chippy_decode_op(opcode);
+    insn->x = X(opcode);
+    insn->y = Y(opcode);
+    insn->n = N(opcode);
+    insn->kk = KK(opcode);
+    insn->nnn = NNN(opcode);
+}
+
+/**
+ * Returns the next random byte of a xorshift64* generator.
+ */
+static inline uint8_t ops_random_byte(uint64_t *rng) {
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+
+    return (*rng * UINT64_C(0x2545F4914F6CDD1D)) >> 56;
+}
+
+/**
+ * Returns the value of a timer that was set to the given value at the given
+ * cycle. Timers tick on every multiple of cycles_per_tick.
+ */
+static inline uint8_t ops_timer_value(uint8_t value, uint64_t set, uint64_t now, uint32_t cycles_per_tick) {
+    uint64_t ticks = now / cycles_per_tick - set / cycles_per_tick;
+
+    return ticks < value ? value - ticks : 0;
+}
+
+/**
+ * A framebuffer of GFX_PLANES bitplanes, each HIRES_SCREEN_H rows of GFX_WORDS
+ * words.
+ */
+typedef uint64_t ops_gfx[GFX_PLANES][HIRES_SCREEN_H][GFX_WORDS];
+
+/**
+ * Returns whether the given handler index is an instruction that may skip the
+ * next instruction.
+ */
+static inline int ops_is_skip(uint8_t op) {
+    return op == OP_SE_XKK || op == OP_SNE_XKK || op == OP_SE_XY || op == OP_SNE_XY
+        || op == OP_SKP || op == OP_SKNP;
+}
+
+/**
+ * Returns the number of bytes that an instruction writes to memory at I, or 0
+ * when it does not write to memory.
+ */
+static inline uint32_t ops_store_size(uint8_t op, uint16_t opcode) {
+    switch (op) {
+        case OP_LD_B:     return 3;
+        case OP_LD_MEM_X: return X(opcode) + 1;
+        case OP_SAVE_XY:  return (X(opcode) > Y(opcode) ? X(opcode) - Y(opcode) : Y(opcode) - X(opcode)) + 1;
+        default:          return 0;
+    }
+}
+
+/**
+ * Returns the number of bytes that a skip instruction skips to get past the
+ * instruction at the given address, which is 4 for F000 NNNN and 2 otherwise.
+ */
+static inline uint16_t ops_skip(const uint8_t *ram, uint16_t pc) {
+    return ram[pc & (RAM_SIZE - 1)] == 0xF0 && ram[(pc + 1) & (RAM_SIZE - 1)] == 0x00 ? 4 : 2;
+}
+
+/**
+ * Draws a sprite from address I at (VX, VY) into the selected bitplanes. An
+ * N-byte sprite is 8xN pixels, and N = 0 draws a 16x16 sprite of 32 bytes. The
+ * sprites for the selected planes follow each other in memory. The sprite
+ * starts at a wrapped position and is clipped at the right and bottom edges of
+ * the screen.
+ *
+ * @return Returns 1 when a set pixel was erased, otherwise 0.
+ */
+static inline uint8_t ops_draw(ops_gfx gfx, int hires, int planes, const uint8_t *ram, uint16_t I, uint8_t vx, uint8_t vy, uint8_t n) {
+    int width = hires ? HIRES_SCREEN_W : SCREEN_W;
+    int height = hires ? HIRES_SCREEN_H : SCREEN_H;
+    int xpos = vx & (width - 1);
+    int ypos = vy & (height - 1);
+    int wide = n == 0;
+    int size = wide ? 32 : n;
+    int rows = (wide ? 16 : n) < height - ypos ? (wide ? 16 : n) : height - ypos;
+    int word = xpos / 64;
+    int shift = xpos % 64;
+    int spill = hires && word + 1 < GFX_WORDS && shift != 0;
+    uint64_t collision = 0;
+
+    for (int plane = 0; plane < GFX_PLANES; plane++) {
+        if (!(planes & (1 << plane))) {
+            continue;
+        }
+
+        for (int y = 0; y < rows; y++) {
+            uint64_t *row = &gfx[plane][ypos + y][word];
+            uint64_t sprite;
+
+            if (wide) {
+                sprite = (uint64_t)(ram[(I + 2 * y) & (RAM_SIZE - 1)] << 8 | ram[(I + 2 * y + 1) & (RAM_SIZE - 1)]) << 48;
+            } else {
+                sprite = (uint64_t)ram[(I + y) & (RAM_SIZE - 1)] << 56;
+            }
+
+            collision |= row[0] & (sprite >> shift);
+            row[0] ^= sprite >> shift;
+
+            // The part that crosses into the next word, which is clipped in
+            // low resolution and at the right edge.
+            if (spill) {
+                collision |= row[1] & (sprite << (64 - shift));
+                row[1] ^= sprite << (64 - shift);
+            }
+        }
+
+        I += size;
+    }
+
+    return collision != 0;
+}
+
+/**
+ * Returns the rows that ops_draw() draws to, as a mask with bit N for row N.
+ */
+static inline uint64_t ops_draw_rows(int hires, uint8_t vy, uint8_t n) {
+    int height = hires ? HIRES_SCREEN_H : SCREEN_H;
+    int ypos = vy & (height - 1);
+    int rows = (n == 0 ? 16 : n) < height - ypos ? (n == 0 ? 16 : n) : height - ypos;
+
+    return ((UINT64_C(1) << rows) - 1) << ypos;
+}
+
+/**
+ * Clears the selected bitplanes. In low resolution, the rows below the screen
+ * are always clear already.
+ */
+static inline void ops_clear(ops_gfx gfx, int hires, int planes) {
+    for (int plane = 0; plane < GFX_PLANES; plane++) {
+        if (planes & (1 << plane)) {
+            memset(gfx[plane], 0, (hires ? HIRES_SCREEN_H : SCREEN_H) * sizeof(gfx[plane][0]));
+        }
+    }
+}
+
+/**
+ * Scrolls the selected bitplanes down by the given number of rows, or up when
+ * it is negative. Whole rows of words are moved at once.
+ */
+static inline void ops_scroll_vertical(ops_gfx gfx, int hires, int planes, int n) {
+    int height = hires ? HIRES_SCREEN_H : SCREEN_H;
+    int distance = n < 0 ? -n : n;
+
+    distance = distance < height ? distance : height;
+
+    for (int plane = 0; plane < GFX_PLANES; plane++) {
+        if (!(planes & (1 << plane))) {
+            continue;
+        }
+
+        size_t moved = (height - distance) * sizeof(gfx[plane][0]);
+
+        if (n > 0) {
+            memmove(gfx[plane][distance], gfx[plane][0], moved);
+            memset(gfx[plane][0], 0, distance * sizeof(gfx[plane][0]));
+        } else {
+            memmove(gfx[plane][0], gfx[plane][distance], moved);
+            memset(gfx[plane][height - distance], 0, distance * sizeof(gfx[plane][0]));
+        }
+    }
+}
+
+/**
+ * Scrolls the selected bitplanes 4 pixels to the right, or to the left when
+ * left is set, by shifting the words of every row.
+ */
+static inline void ops_scroll_horizontal(ops_gfx gfx, int hires, int planes, int left) {
+    for (int plane = 0; plane < GFX_PLANES; plane++) {
+        if (!(planes & (1 << plane))) {
+            continue;
+        }
+
+        for (int y = 0; y < (hires ? HIRES_SCREEN_H : SCREEN_H); y++) {
+            uint64_t *row = gfx[plane][y];
+
+            if (!hires) {
+                row[0] = left ? row[0] << 4 : row[0] >> 4;
+            } else if (left) {
+                row[0] = row[0] << 4 | row[1] >> 60;
+                row[1] <<= 4;
+            } else {
+                row[1] = row[1] >> 4 | row[0] << 60;
+                row[0] >>= 4;
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,285 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "profile.h"
+#include "ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * The deepest chain of calls that is told apart. Deeper calls are counted in
+ * the deepest frame.
+ */
+#define MAX_DEPTH 16
+
+/**
+ * The names of the opcode classes, in the order of the handler indices.
+ */
+static const char *op_names[OP_COUNT] = {
+    "DECODE", "NOP",      "CLS",      "RET",      "JP",       "CALL",
+    "SE_XKK", "SNE_XKK",  "SE_XY",    "LD_XKK",   "ADD_XKK",  "LD_XY",
+    "OR",     "XOR",      "ADD_XY",   "SUB",      "SHR",      "SUBN",
+    "SHL",    "SNE_XY",   "LD_I",     "JP_V0",    "RND",      "DRW",
+    "SKP",    "SKNP",     "LD_X_DT",  "LD_X_K",   "LD_DT_X",  "LD_ST_X",
+    "ADD_I",  "LD_F",     "LD_B",     "LD_MEM_X", "LD_X_MEM", "SCD",
+    "SCU",    "SCR",      "SCL",      "EXIT",     "LOW",      "HIGH",
+    "SAVE_XY", "LOAD_XY", "LD_I_LONG", "PLANE",   "LD_HF",    "LD_R_X",
+    "LD_X_R", "AUDIO",    "PITCH"
+};
+
+/**
+ * A node in the tree of subroutine calls. Node 0 is the root, which is the
+ * code outside of any subroutine.
+ */
+struct node {
+    uint16_t function;                  // Address of the called subroutine
+    uint32_t parent;                    // Index of the calling node
+    uint32_t child;                     // Index of the first callee, 0 if none
+    uint32_t sibling;                   // Index of the next callee of the parent
+    uint64_t cycles;                    // Cycles spent in this node itself
+};
+
+struct chippy_profile {
+    uint64_t op_counts[OP_COUNT];       // Executions of every opcode class
+    uint64_t op_ticks[OP_COUNT];        // Host ticks spent in every opcode class
+    uint64_t pc_counts[RAM_SIZE];       // Executions of every address
+
+    struct node *nodes;                 // Tree of subroutine calls
+    uint32_t node_count;
+    uint32_t node_capacity;
+
+    uint32_t current;                   // Node of the running subroutine
+    uint32_t depth;                     // Depth of the current node
+    uint32_t overflow;                  // Calls deeper than the tree
+
+    uint64_t tick;                      // Ticks at the last fetch
+    uint64_t start_ticks;               // Ticks when the profiler was created
+    uint64_t start_ns;                  // Time when the profiler was created
+};
+
+static uint64_t clock_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Reads the cheapest clock of the host. On x86 this is the time stamp counter,
+ * which is converted to nanoseconds when reporting.
+ */
+static inline uint64_t ticks(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#else
+    return clock_ns();
+#endif
+}
+
+struct chippy_profile *chippy_profile_create(void) {
+#if defined(CHIPPY_PROFILER)
+    struct chippy_profile *profile = calloc(1, sizeof(struct chippy_profile));
+
+    if (profile == NULL) {
+        return NULL;
+    }
+
+    profile->node_capacity = 64;
+    profile->nodes = calloc(profile->node_capacity, sizeof(struct node));
+
+    if (profile->nodes == NULL) {
+        free(profile);
+        return NULL;
+    }
+
+    profile->node_count = 1;
+    profile->start_ticks = ticks();
+    profile->start_ns = clock_ns();
+
+    return profile;
+#else
+    return NULL;
+#endif
+}
+
+void profile_begin(struct chippy_profile *profile, const struct chippy *machine) {
+    profile->current = 0;
+    profile->depth = 0;
+    profile->overflow = 0;
+
+    // Every return address follows the call that pushed it, unless the code
+    // was changed since.
+    for (int i = 0; i < machine->sp && i < 16; i++) {
+        uint16_t site = machine->stack[i] - 2;
+        uint16_t opcode = machine->ram[site & (RAM_SIZE - 1)] << 8 | machine->ram[(site + 1) & (RAM_SIZE - 1)];
+
+        profile_call(profile, P(opcode) == 0x2 ? NNN(opcode) : machine->stack[i]);
+    }
+
+    profile->tick = ticks();
+}
+
+void profile_fetch(struct chippy_profile *profile, uint16_t pc, const struct chippy_insn *previous) {
+    uint64_t now = ticks();
+
+    if (previous != NULL) {
+        profile->op_counts[previous->op]++;
+        profile->op_ticks[previous->op] += now - profile->tick;
+    }
+
+    profile->tick = now;
+    profile->pc_counts[pc & (RAM_SIZE - 1)]++;
+    profile->nodes[profile->current].cycles++;
+}
+
+void profile_call(struct chippy_profile *profile, uint16_t target) {
+    if (profile->depth >= MAX_DEPTH) {
+        profile->overflow++;
+        return;
+    }
+
+    uint32_t previous = 0;
+    uint32_t node = profile->nodes[profile->current].child;
+
+    // The root is never a callee, so 0 marks the end of the list.
+    while (node != 0 && profile->nodes[node].function != target) {
+        previous = node;
+        node = profile->nodes[node].sibling;
+    }
+
+    if (node == 0) {
+        if (profile->node_count == profile->node_capacity) {
+            struct node *nodes = realloc(profile->nodes, 2 * profile->node_capacity * sizeof(struct node));
+
+            if (nodes == NULL) {
+                profile->overflow++;
+                return;
+            }
+
+            profile->nodes = nodes;
+            profile->node_capacity *= 2;
+        }
+
+        node = profile->node_count++;
+
+        profile->nodes[node].function = target;
+        profile->nodes[node].parent = profile->current;
+        profile->nodes[node].child = 0;
+        profile->nodes[node].sibling = 0;
+        profile->nodes[node].cycles = 0;
+
+        if (previous == 0) {
+            profile->nodes[profile->current].child = node;
+        } else {
+            profile->nodes[previous].sibling = node;
+        }
+    }
+
+    profile->current = node;
+    profile->depth++;
+}
+
+void profile_ret(struct chippy_profile *profile) {
+    if (profile->overflow > 0) {
+        profile->overflow--;
+    } else if (profile->depth > 0) {
+        profile->current = profile->nodes[profile->current].parent;
+        profile->depth--;
+    }
+}
+
+void profile_end(struct chippy_profile *profile, const struct chippy_insn *last) {
+    profile->op_counts[last->op]++;
+    profile->op_ticks[last->op] += ticks() - profile->tick;
+}
+
+/**
+ * Returns the number of nanoseconds per tick, measured over the lifetime of
+ * the profiler.
+ */
+static double ns_per_tick(const struct chippy_profile *profile) {
+    uint64_t elapsed_ticks = ticks() - profile->start_ticks;
+    uint64_t elapsed_ns = clock_ns() - profile->start_ns;
+
+    return elapsed_ticks != 0 ? (double)elapsed_ns / elapsed_ticks : 1.0;
+}
+
+void chippy_profile_write_opcodes(const struct chippy_profile *profile, FILE *out) {
+    double scale = ns_per_tick(profile);
+    int order[OP_COUNT];
+
+    for (int i = 0; i < OP_COUNT; i++) {
+        int j = i;
+
+        // Insertion sort by host time, descending.
+        for (; j > 0 && profile->op_ticks[order[j - 1]] < profile->op_ticks[i]; j--) {
+            order[j] = order[j - 1];
+        }
+
+        order[j] = i;
+    }
+
+    for (int i = 0; i < OP_COUNT; i++) {
+        int op = order[i];
+
+        if (profile->op_counts[op] != 0) {
+            fprintf(out, "%s\t%llu\t%.0f\n",
+                op_names[op],
+                (unsigned long long)profile->op_counts[op],
+                profile->op_ticks[op] * scale);
+        }
+    }
+}
+
+void chippy_profile_write_pcs(const struct chippy_profile *profile, FILE *out) {
+    for (int pc = 0; pc < RAM_SIZE; pc++) {
+        if (profile->pc_counts[pc] != 0) {
+            fprintf(out, "0x%03X\t%llu\n", pc, (unsigned long long)profile->pc_counts[pc]);
+        }
+    }
+}
+
+void chippy_profile_write_folded(const struct chippy_profile *profile, const char *prefix, FILE *out) {
+    for (uint32_t i = 0; i < profile->node_count; i++) {
+        uint32_t chain[MAX_DEPTH + 1];
+        int depth = 0;
+
+        if (profile->nodes[i].cycles == 0) {
+            continue;
+        }
+
+        for (uint32_t node = i; node != 0; node = profile->nodes[node].parent) {
+            chain[depth++] = node;
+        }
+
+        if (prefix != NULL) {
+            fprintf(out, "%s;", prefix);
+        }
+
+        fprintf(out, "main");
+
+        while (depth > 0) {
+            fprintf(out, ";0x%03X", profile->nodes[chain[--depth]].function);
+        }
+
+        fprintf(out, " %llu\n", (unsigned long long)profile->nodes[i].cycles);
+    }
+}
+
+void chippy_profile_destroy(struct chippy_profile *profile) {
+    if (profile != NULL) {
+        free(profile->nodes);
+        free(profile);
+    }
+}
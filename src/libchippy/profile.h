@@ -0,0 +1,48 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "chippy.h"
+
+/**
+ * The hooks below are called by the profiled interpreter, which is only
+ * built when CHIPPY_PROFILER is defined, and only used for machines that have
+ * a profiler attached.
+ */
+
+/**
+ * Called when the interpreter is entered. Finds the position in the call tree
+ * from the stack of the machine, which may have changed since it last ran.
+ */
+void profile_begin(struct chippy_profile *profile, const struct chippy *machine);
+
+/**
+ * Called before every instruction, with the instruction executed before it in
+ * the same run, or NULL for the first.
+ */
+void profile_fetch(struct chippy_profile *profile, uint16_t pc, const struct chippy_insn *previous);
+
+/**
+ * Called after a subroutine was called.
+ */
+void profile_call(struct chippy_profile *profile, uint16_t target);
+
+/**
+ * Called after a subroutine returned.
+ */
+void profile_ret(struct chippy_profile *profile);
+
+/**
+ * Called when the interpreter returns, with the last instruction it executed.
+ */
+void profile_end(struct chippy_profile *profile, const struct chippy_insn *last);
+
+#endif
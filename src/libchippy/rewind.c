@@ -0,0 +1,235 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include "rewind.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Every delta in the ring buffer is preceded and followed by its 16-bit
+ * length, so that the ring buffer can be walked from both ends.
+ */
+#define LENGTH_SIZE 2
+#define MAX_DELTA 0xFFFF
+
+/**
+ * The largest compressed delta of a state. A run costs its zero count and its
+ * literal count on top of the literals, so alternating equal and differing
+ * bytes take three bytes for every two, and a first run without zeros takes
+ * two more.
+ */
+#define MAX_ENCODED (sizeof(struct chippy_snapshot) + sizeof(struct chippy_snapshot) / 2 + 8)
+
+int chippy_rewind_init(struct chippy_rewind *rewind, size_t capacity) {
+    rewind->buffer = malloc(capacity);
+    rewind->scratch = malloc(MAX_ENCODED);
+
+    if (rewind->buffer == NULL || rewind->scratch == NULL) {
+        free(rewind->buffer);
+        free(rewind->scratch);
+        return EXIT_FAILURE;
+    }
+
+    rewind->capacity = capacity;
+    rewind->head = 0;
+    rewind->used = 0;
+    rewind->frames = 0;
+    rewind->has_newest = 0;
+
+    // Padding is part of the deltas as well, so it has to start out equal.
+    memset(&rewind->newest, 0, sizeof(rewind->newest));
+    memset(&rewind->next, 0, sizeof(rewind->next));
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Compresses the XOR of two states as a sequence of runs. Every run is the
+ * number of equal bytes as a base-128 varint, followed by the number of
+ * differing bytes and their XOR. Equal bytes at the end are left out.
+ *
+ * @return Returns the size of the compressed delta.
+ */
+static size_t encode(const uint8_t *a, const uint8_t *b, size_t size, uint8_t *out) {
+    size_t pos = 0;
+    size_t length = 0;
+
+    while (pos < size) {
+        size_t zeros = 0;
+
+        // Most of the state is unchanged between frames, so equal bytes are
+        // skipped a word at a time first.
+        for (;;) {
+            uint64_t wa;
+            uint64_t wb;
+
+            if (pos + sizeof(wa) > size) {
+                break;
+            }
+
+            memcpy(&wa, a + pos, sizeof(wa));
+            memcpy(&wb, b + pos, sizeof(wb));
+
+            if (wa != wb) {
+                break;
+            }
+
+            zeros += sizeof(wa);
+            pos += sizeof(wa);
+        }
+
+        while (pos < size && a[pos] == b[pos]) {
+            zeros++;
+            pos++;
+        }
+
+        if (pos == size) {
+            break;
+        }
+
+        do {
+            out[length++] = (zeros & 0x7F) | (zeros > 0x7F ? 0x80 : 0);
+            zeros >>= 7;
+        } while (zeros != 0);
+
+        size_t count = length++;
+        uint8_t literals = 0;
+
+        while (pos < size && literals < 255 && a[pos] != b[pos]) {
+            out[length++] = a[pos] ^ b[pos];
+            literals++;
+            pos++;
+        }
+
+        out[count] = literals;
+    }
+
+    return length;
+}
+
+/**
+ * Applies a compressed delta to a state in place.
+ */
+static void decode(const uint8_t *in, size_t length, uint8_t *state) {
+    size_t pos = 0;
+    size_t i = 0;
+
+    while (i < length) {
+        size_t zeros = 0;
+        int shift = 0;
+
+        do {
+            zeros |= (size_t)(in[i] & 0x7F) << shift;
+            shift += 7;
+        } while (in[i++] & 0x80);
+
+        pos += zeros;
+
+        for (uint8_t literals = in[i++]; literals > 0; literals--) {
+            state[pos++] ^= in[i++];
+        }
+    }
+}
+
+static void ring_write(struct chippy_rewind *rewind, size_t offset, const uint8_t *data, size_t size) {
+    size_t first = rewind->capacity - offset < size ? rewind->capacity - offset : size;
+
+    memcpy(rewind->buffer + offset, data, first);
+    memcpy(rewind->buffer, data + first, size - first);
+}
+
+static void ring_read(const struct chippy_rewind *rewind, size_t offset, uint8_t *data, size_t size) {
+    size_t first = rewind->capacity - offset < size ? rewind->capacity - offset : size;
+
+    memcpy(data, rewind->buffer + offset, first);
+    memcpy(data + first, rewind->buffer, size - first);
+}
+
+static size_t read_length(const struct chippy_rewind *rewind, size_t offset) {
+    uint8_t bytes[LENGTH_SIZE];
+
+    ring_read(rewind, offset % rewind->capacity, bytes, LENGTH_SIZE);
+
+    return bytes[0] | bytes[1] << 8;
+}
+
+static void drop_oldest(struct chippy_rewind *rewind) {
+    size_t size = read_length(rewind, rewind->head) + 2 * LENGTH_SIZE;
+
+    rewind->head = (rewind->head + size) % rewind->capacity;
+    rewind->used -= size;
+    rewind->frames--;
+}
+
+void chippy_rewind_push(struct chippy_rewind *rewind, struct chippy *machine) {
+    chippy_snapshot(machine, &rewind->next);
+
+    if (rewind->has_newest) {
+        size_t length = encode((const uint8_t *)&rewind->next, (const uint8_t *)&rewind->newest,
+            sizeof(struct chippy_snapshot), rewind->scratch);
+        size_t size = length + 2 * LENGTH_SIZE;
+
+        if (length > MAX_DELTA || size > rewind->capacity) {
+            // The delta does not fit, so the older states can no longer be
+            // reached.
+            rewind->head = 0;
+            rewind->used = 0;
+            rewind->frames = 0;
+        } else {
+            uint8_t prefix[LENGTH_SIZE] = { length & 0xFF, length >> 8 };
+
+            while (rewind->capacity - rewind->used < size) {
+                drop_oldest(rewind);
+            }
+
+            size_t tail = (rewind->head + rewind->used) % rewind->capacity;
+
+            ring_write(rewind, tail, prefix, LENGTH_SIZE);
+            ring_write(rewind, (tail + LENGTH_SIZE) % rewind->capacity, rewind->scratch, length);
+            ring_write(rewind, (tail + LENGTH_SIZE + length) % rewind->capacity, prefix, LENGTH_SIZE);
+
+            rewind->used += size;
+            rewind->frames++;
+        }
+    }
+
+    memcpy(&rewind->newest, &rewind->next, sizeof(struct chippy_snapshot));
+    rewind->has_newest = 1;
+}
+
+int chippy_rewind_pop(struct chippy_rewind *rewind, struct chippy *machine) {
+    if (!rewind->has_newest) {
+        return EXIT_FAILURE;
+    }
+
+    if (rewind->frames == 0) {
+        chippy_restore(machine, &rewind->newest);
+        return EXIT_FAILURE;
+    }
+
+    size_t tail = rewind->head + rewind->used;
+    size_t length = read_length(rewind, tail - LENGTH_SIZE);
+
+    ring_read(rewind, (tail - LENGTH_SIZE - length) % rewind->capacity, rewind->scratch, length);
+    decode(rewind->scratch, length, (uint8_t *)&rewind->newest);
+
+    rewind->used -= length + 2 * LENGTH_SIZE;
+    rewind->frames--;
+
+    chippy_restore(machine, &rewind->newest);
+
+    return EXIT_SUCCESS;
+}
+
+void chippy_rewind_destroy(struct chippy_rewind *rewind) {
+    free(rewind->buffer);
+    free(rewind->scratch);
+    free(rewind);
+}
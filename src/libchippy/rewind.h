@@ -0,0 +1,82 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __REWIND_H__
+#define __REWIND_H__
+
+#include <stddef.h>
+
+#include "chippy.h"
+
+/**
+ * The default size of the history, which holds several minutes of frames for
+ * typical programs.
+ */
+#define DEFAULT_REWIND_CAPACITY (512 * 1024)
+
+/**
+ * A history of machine states, one per frame. Only the newest state is kept in
+ * full. Every older state is stored as the XOR of itself and the state after
+ * it, with runs of zero bytes compressed, in a ring buffer of fixed size. When
+ * the buffer is full, the oldest states are dropped.
+ */
+struct chippy_rewind {
+    uint8_t *buffer;                    // Ring buffer of compressed deltas
+    size_t capacity;                    // Size of the ring buffer
+    size_t head;                        // Offset of the oldest delta
+    size_t used;                        // Number of bytes in use
+
+    size_t frames;                      // Number of deltas in the ring buffer
+    int has_newest;                     // Whether a state was pushed yet
+
+    struct chippy_snapshot newest;      // The newest state, in full
+    struct chippy_snapshot next;        // The state being pushed
+
+    uint8_t *scratch;                   // Space for one compressed delta
+};
+
+/**
+ * Initializes an empty history.
+ *
+ * @param rewind   The history to initialize.
+ * @param capacity The size of the ring buffer in bytes.
+ *
+ * @return Returns 0 on success, otherwise 1.
+ */
+int chippy_rewind_init(struct chippy_rewind *rewind, size_t capacity);
+
+/**
+ * Adds the current state of a machine to the history. The cost depends only on
+ * the size of the machine state, not on the length of the history.
+ *
+ * @param rewind  The history to add to.
+ * @param machine The machine whose state to add.
+ */
+void chippy_rewind_push(struct chippy_rewind *rewind, struct chippy *machine);
+
+/**
+ * Drops the newest state from the history, and restores the machine to the
+ * state before it.
+ *
+ * @param rewind  The history to step back in.
+ * @param machine The machine to restore.
+ *
+ * @return Returns 0 on success, or 1 when there is no older state, in which
+ *         case the machine is restored to the oldest state.
+ */
+int chippy_rewind_pop(struct chippy_rewind *rewind, struct chippy *machine);
+
+/**
+ * Frees the ring buffer and the memory allocated for the history.
+ *
+ * @param rewind The history to destroy.
+ */
+void chippy_rewind_destroy(struct chippy_rewind *rewind);
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "trace.h"
+
+#include <sched.h>
+#include <stdlib.h>
+
+/**
+ * Writes the published bytes to the file.
+ */
+static size_t writer(void *argument, size_t tail, size_t head) {
+    struct chippy_trace *trace = argument;
+    size_t start = tail & (TRACE_CAPACITY - 1);
+    size_t size = head - tail;
+    size_t first = size < TRACE_CAPACITY - start ? size : TRACE_CAPACITY - start;
+
+    fwrite(trace->ring + start, 1, first, trace->file);
+    fwrite(trace->ring, 1, size - first, trace->file);
+
+    return head;
+}
+
+struct chippy_trace *chippy_trace_open(const char *path) {
+    struct chippy_trace *trace = calloc(1, sizeof(struct chippy_trace));
+
+    if (trace == NULL) {
+        return NULL;
+    }
+
+    trace->ring = malloc(TRACE_CAPACITY + TRACE_MAX_RECORD);
+    trace->free = TRACE_CAPACITY;
+    trace->file = fopen(path, "wb");
+
+    if (trace->ring == NULL || trace->file == NULL) {
+        goto error;
+    }
+
+    if (fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, trace->file) != TRACE_MAGIC_SIZE) {
+        goto error;
+    }
+
+    if (drain_start(&trace->drain, writer, trace) != 0) {
+        goto error;
+    }
+
+    return trace;
+
+error:
+    if (trace->file != NULL) {
+        fclose(trace->file);
+    }
+
+    free(trace->ring);
+    free(trace);
+
+    return NULL;
+}
+
+int chippy_trace_close(struct chippy_trace *trace) {
+    int status = EXIT_SUCCESS;
+
+    drain_stop(&trace->drain);
+
+    if (ferror(trace->file)) {
+        status = EXIT_FAILURE;
+    }
+
+    if (fclose(trace->file) != 0) {
+        status = EXIT_FAILURE;
+    }
+
+    free(trace->ring);
+    free(trace);
+
+    return status;
+}
+
+void trace_begin(struct chippy_trace *trace, const struct chippy *machine) {
+    uint8_t record[TRACE_SYNC_SIZE];
+
+    // A changed PC needs no sync record, as the next record holds its PC
+    // whenever it does not follow the last one.
+    if (trace->synced
+        && trace->I == machine->I
+        && trace->sp == machine->sp
+        && trace->dt == machine->dt
+        && trace->st == machine->st
+        && trace->dt_cycle == machine->dt_cycle
+        && trace->st_cycle == machine->st_cycle
+        && trace->cycles == machine->cycles
+        && memcmp(trace->V, machine->V, sizeof(trace->V)) == 0) {
+        return;
+    }
+
+    record[0] = TRACE_SYNC;
+    record[1] = machine->pc & 0xFF;
+    record[2] = machine->pc >> 8;
+    record[3] = machine->I & 0xFF;
+    record[4] = machine->I >> 8;
+    record[5] = machine->sp;
+    memcpy(record + 6, machine->V, 16);
+    record[22] = machine->dt;
+    record[23] = machine->st;
+
+    for (int i = 0; i < 8; i++) {
+        record[24 + i] = machine->cycles >> (8 * i);
+    }
+
+    memcpy(trace->V, machine->V, sizeof(trace->V));
+    trace->pc = machine->pc;
+    trace->I = machine->I;
+    trace->sp = machine->sp;
+    trace->dt = machine->dt;
+    trace->st = machine->st;
+    trace->dt_cycle = machine->dt_cycle;
+    trace->st_cycle = machine->st_cycle;
+    trace->cycles = machine->cycles;
+    trace->synced = 1;
+
+    if (trace->free < TRACE_SYNC_SIZE) {
+        trace_wait(trace);
+    }
+
+    for (size_t i = 0; i < TRACE_SYNC_SIZE; i++) {
+        trace->ring[(trace->pending + i) & (TRACE_CAPACITY - 1)] = record[i];
+    }
+
+    trace->pending += TRACE_SYNC_SIZE;
+    trace->free -= TRACE_SYNC_SIZE;
+}
+
+void trace_wait(struct chippy_trace *trace) {
+    // The writer can only drain what was published.
+    drain_publish(&trace->drain, trace->pending);
+
+    for (;;) {
+        size_t tail = drain_tail(&trace->drain);
+
+        trace->free = TRACE_CAPACITY - (trace->pending - tail);
+
+        if (trace->free >= TRACE_MAX_RECORD) {
+            return;
+        }
+
+        sched_yield();
+    }
+}
@@ -0,0 +1,213 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "chippy.h"
+#include "drain.h"
+
+/**
+ * A trace file starts with this magic, followed by records. Every record
+ * starts with a flags byte.
+ *
+ * A sync record (TRACE_SYNC) holds the full register state, and is written
+ * when tracing starts and whenever the machine was changed from outside
+ * between two runs: PC and I (2 bytes each), SP (1 byte), V0 to VF, the delay
+ * and sound timers as last set, and the cycle counter (8 bytes).
+ *
+ * Every other record is one executed instruction, one cycle after the record
+ * before it. It holds, in order: the PC (2 bytes) when it is not 2 past the PC
+ * of the previous instruction, the opcode (2 bytes, big-endian like in
+ * memory), and the registers that the instruction changed. A single changed
+ * V register is stored as its index and value, several as a 16-bit mask and
+ * their values in order. Multi-byte fields other than the opcode are
+ * little-endian.
+ */
+#define TRACE_MAGIC "CHIPTRC1"
+#define TRACE_MAGIC_SIZE 8
+
+#define TRACE_PC      0x01              // The PC follows
+#define TRACE_V       0x02              // One V register changed
+#define TRACE_VS      0x04              // Several V registers changed
+#define TRACE_I       0x08              // I changed
+#define TRACE_SP      0x10              // SP changed
+#define TRACE_DT      0x20              // The delay timer was set
+#define TRACE_ST      0x40              // The sound timer was set
+#define TRACE_SYNC    0x80              // Full register state
+
+#define TRACE_SYNC_SIZE 32
+#define TRACE_MAX_RECORD 32
+
+/**
+ * The size of the ring buffer between a machine and its writer thread, which
+ * must be a power of two. TRACE_MAX_RECORD bytes of slack follow the ring.
+ */
+#define TRACE_CAPACITY (1 << 20)
+
+/**
+ * A trace of one machine. The machine writes records into a ring buffer, and
+ * publishes them once per run rather than once per record, so that the writer
+ * thread is woken at most once per run.
+ */
+struct chippy_trace {
+    uint8_t *ring;                      // Ring buffer of TRACE_CAPACITY bytes and slack
+    struct drain drain;                 // Writer thread, with bytes published and written
+
+    size_t pending;                     // Bytes written by the machine
+    size_t free;                        // Space known to be free after pending
+
+    FILE *file;
+
+    // The registers as of the last record, to find what changed.
+    uint8_t V[16];
+    uint16_t pc;                        // PC of the next instruction
+    uint16_t I;
+    uint16_t sp;
+    uint8_t dt;
+    uint8_t st;
+    uint64_t dt_cycle;
+    uint64_t st_cycle;
+    uint64_t cycles;
+    int synced;                         // Whether a sync record was written
+};
+
+/**
+ * Writes a sync record when the registers of the machine are not those of the
+ * last record, and must be called before the first instruction of a run.
+ */
+void trace_begin(struct chippy_trace *trace, const struct chippy *machine);
+
+/**
+ * Waits until the writer thread has made room for a record.
+ */
+void trace_wait(struct chippy_trace *trace);
+
+/**
+ * Finds the bytes that differ between two words of V registers, without a
+ * branch per register. Byte i is register i on little-endian hosts.
+ *
+ * @return Returns a mask with bit i set when byte i of the difference is set.
+ */
+static inline uint16_t trace_changed(uint64_t difference) {
+    const uint64_t low = UINT64_C(0x7F7F7F7F7F7F7F7F);
+    uint64_t high = (((difference & low) + low) | difference) & ~low;
+
+    // Gathers the top bit of every byte into the top byte.
+    return ((high >> 7) * UINT64_C(0x0102040810204080)) >> 56;
+}
+
+/**
+ * Appends the record of an executed instruction, given the address and opcode
+ * it was fetched with.
+ */
+static inline void trace_record(struct chippy_trace *trace, const struct chippy *machine, uint16_t pc, uint16_t opcode) {
+    uint8_t *record;
+    uint8_t flags = 0;
+    size_t size = 1;
+    uint64_t before[2];
+    uint64_t after[2];
+
+    if (trace->free < TRACE_MAX_RECORD) {
+        trace_wait(trace);
+    }
+
+    // The record is written in place, into the slack past the end of the ring
+    // when it does not fit, and moved to the start afterwards.
+    record = trace->ring + (trace->pending & (TRACE_CAPACITY - 1));
+
+    if (pc != trace->pc) {
+        flags |= TRACE_PC;
+        record[size++] = pc & 0xFF;
+        record[size++] = pc >> 8;
+    }
+
+    record[size++] = opcode >> 8;
+    record[size++] = opcode & 0xFF;
+
+    memcpy(before, trace->V, sizeof(before));
+    memcpy(after, machine->V, sizeof(after));
+
+    if (((before[0] ^ after[0]) | (before[1] ^ after[1])) != 0) {
+        uint16_t mask = trace_changed(before[0] ^ after[0]) | trace_changed(before[1] ^ after[1]) << 8;
+
+        if ((mask & (mask - 1)) == 0) {
+            flags |= TRACE_V;
+            record[size++] = __builtin_ctz(mask);
+            record[size++] = machine->V[__builtin_ctz(mask)];
+        } else {
+            flags |= TRACE_VS;
+            record[size++] = mask & 0xFF;
+            record[size++] = mask >> 8;
+
+            for (int i = 0; i < 16; i++) {
+                if (mask & (1 << i)) {
+                    record[size++] = machine->V[i];
+                }
+            }
+        }
+
+        memcpy(trace->V, machine->V, sizeof(trace->V));
+    }
+
+    if (machine->I != trace->I) {
+        flags |= TRACE_I;
+        record[size++] = machine->I & 0xFF;
+        record[size++] = machine->I >> 8;
+        trace->I = machine->I;
+    }
+
+    if (machine->sp != trace->sp) {
+        flags |= TRACE_SP;
+        record[size++] = machine->sp;
+        trace->sp = machine->sp;
+    }
+
+    // A timer that is set again to the same value is still recorded.
+    if (machine->dt_cycle != trace->dt_cycle || machine->dt != trace->dt) {
+        flags |= TRACE_DT;
+        record[size++] = machine->dt;
+        trace->dt = machine->dt;
+        trace->dt_cycle = machine->dt_cycle;
+    }
+
+    if (machine->st_cycle != trace->st_cycle || machine->st != trace->st) {
+        flags |= TRACE_ST;
+        record[size++] = machine->st;
+        trace->st = machine->st;
+        trace->st_cycle = machine->st_cycle;
+    }
+
+    record[0] = flags;
+
+    trace->pc = pc + 2;
+    trace->cycles++;
+
+    if (record + size > trace->ring + TRACE_CAPACITY) {
+        memcpy(trace->ring, trace->ring + TRACE_CAPACITY, record + size - (trace->ring + TRACE_CAPACITY));
+    }
+
+    trace->pending += size;
+    trace->free -= size;
+}
+
+/**
+ * Makes the records of a run available to the writer thread, and must be
+ * called after the last instruction of a run.
+ */
+static inline void trace_end(struct chippy_trace *trace) {
+    drain_publish(&trace->drain, trace->pending);
+}
+
+#endif
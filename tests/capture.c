@@ -0,0 +1,202 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <check.h>
+#include <libchippy/capture.h>
+#include <libchippy/chippy.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Opens a capture in a new temporary file.
+ */
+static struct chippy_capture *open_capture(char *path, enum chippy_capture_format format, int scale) {
+    strcpy(path, "/tmp/chippy-capture-XXXXXX");
+
+    int fd = mkstemp(path);
+
+    ck_assert_int_ne(fd, -1);
+    close(fd);
+
+    struct chippy_capture *capture = chippy_capture_open(path, format, scale);
+
+    ck_assert_ptr_ne(capture, NULL);
+
+    return capture;
+}
+
+/**
+ * Reads a whole video, and returns its size.
+ */
+static size_t read_capture(const char *path, uint8_t **data) {
+    FILE *f = fopen(path, "rb");
+
+    ck_assert_ptr_ne(f, NULL);
+
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    rewind(f);
+
+    *data = malloc(size);
+    ck_assert_int_eq(fread(*data, 1, size, f), size);
+
+    fclose(f);
+    unlink(path);
+
+    return size;
+}
+
+/**
+ * Sets or clears the top left pixel.
+ */
+static void set_pixel(struct chippy *machine, int on) {
+    machine->gfx[0][0][0] = on ? GFX_ROW_BIT(0) : 0;
+    chippy_invalidate_gfx(machine, 1);
+}
+
+/**
+ * Records four frames as Y4M at the given scale, and checks their pixels.
+ */
+static void check_y4m(int scale, int width, int height) {
+    struct chippy *machine = malloc(sizeof(struct chippy));
+    char path[32];
+
+    chippy_init(machine);
+
+    struct chippy_capture *capture = open_capture(path, CAPTURE_Y4M, scale);
+
+    ck_assert_int_eq(capture->width, width);
+    ck_assert_int_eq(capture->height, height);
+
+    chippy_capture_frame(capture, machine);
+    chippy_capture_frame(capture, machine);
+    set_pixel(machine, 1);
+    chippy_capture_frame(capture, machine);
+
+    // Drawing the same screen again is still a duplicate.
+    set_pixel(machine, 1);
+    chippy_capture_frame(capture, machine);
+
+    ck_assert_int_eq(capture->drain.head, 2);
+    ck_assert_int_eq(capture->dropped, 0);
+    ck_assert_int_eq(chippy_capture_close(capture), EXIT_SUCCESS);
+
+    uint8_t *data;
+    size_t size = read_capture(path, &data);
+    char header[64];
+    size_t frame_size = 6 + 3 * width * height;
+    int pixel = 2 * width / HIRES_SCREEN_W;
+
+    snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, TIMER_HZ);
+
+    ck_assert_int_eq(size, strlen(header) + 4 * frame_size);
+    ck_assert_int_eq(memcmp(data, header, strlen(header)), 0);
+
+    // Every frame is written, and a low resolution pixel is twice as large.
+    for (int i = 0; i < 4; i++) {
+        const uint8_t *frame = data + strlen(header) + i * frame_size;
+
+        ck_assert_int_eq(memcmp(frame, "FRAME\n", 6), 0);
+        ck_assert_int_eq(frame[6], i < 2 ? 16 : 235);
+        ck_assert_int_eq(frame[6 + pixel - 1], i < 2 ? 16 : 235);
+        ck_assert_int_eq(frame[6 + pixel], 16);
+        ck_assert_int_eq(frame[6 + (pixel - 1) * width], i < 2 ? 16 : 235);
+        ck_assert_int_eq(frame[6 + pixel * width], 16);
+        ck_assert_int_eq(frame[6 + width * height], 128);
+    }
+
+    free(data);
+    chippy_destroy(machine);
+}
+
+START_TEST(test_capture_y4m)
+{
+    // Y4M is written at the native resolution by default.
+    check_y4m(0, HIRES_SCREEN_W, HIRES_SCREEN_H);
+    check_y4m(3, 3 * HIRES_SCREEN_W, 3 * HIRES_SCREEN_H);
+
+    ck_assert_ptr_eq(chippy_capture_open("/tmp/chippy-capture-scale", CAPTURE_Y4M, CAPTURE_MAX_SCALE + 1), NULL);
+}
+END_TEST
+
+START_TEST(test_capture_gif)
+{
+    struct chippy *machine = malloc(sizeof(struct chippy));
+    char path[32];
+
+    chippy_init(machine);
+
+    struct chippy_capture *capture = open_capture(path, CAPTURE_GIF, 0);
+
+    chippy_capture_frame(capture, machine);
+    set_pixel(machine, 1);
+    chippy_capture_frame(capture, machine);
+    chippy_capture_frame(capture, machine);
+    machine->hires = 1;
+    chippy_invalidate_gfx(machine, GFX_ALL_ROWS);
+    chippy_capture_frame(capture, machine);
+    chippy_capture_frame(capture, machine);
+    chippy_capture_frame(capture, machine);
+
+    ck_assert_int_eq(capture->drain.head, 3);
+    ck_assert_int_eq(chippy_capture_close(capture), EXIT_SUCCESS);
+
+    uint8_t *data;
+    size_t size = read_capture(path, &data);
+
+    ck_assert_int_eq(memcmp(data, "GIF89a", 6), 0);
+    ck_assert_int_eq(data[6] | data[7] << 8, CAPTURE_GIF_SCALE * HIRES_SCREEN_W);
+    ck_assert_int_eq(data[8] | data[9] << 8, CAPTURE_GIF_SCALE * HIRES_SCREEN_H);
+    ck_assert_int_eq(data[size - 1], 0x3B);
+
+    // The first frame is too brief and is replaced by the second, so that two
+    // images remain, each shown for 3 frames.
+    size_t offset = 13 + 12 + 19;
+    int images = 0;
+
+    while (data[offset] != 0x3B) {
+        ck_assert_int_eq(data[offset], 0x21);
+        ck_assert_int_eq(data[offset + 1], 0xF9);
+        ck_assert_int_eq(data[offset + 4] | data[offset + 5] << 8, 300 / TIMER_HZ);
+        ck_assert_int_eq(data[offset + 8], 0x2C);
+
+        offset += 8 + 10 + 1;
+
+        while (data[offset] != 0) {
+            offset += data[offset] + 1;
+        }
+
+        offset++;
+        images++;
+    }
+
+    ck_assert_int_eq(images, 2);
+    ck_assert_int_eq(offset, size - 1);
+
+    free(data);
+    chippy_destroy(machine);
+}
+END_TEST
+
+Suite *create_capture_suite(void) {
+    Suite *suite = suite_create("Capture");
+    TCase *chain = tcase_create("capture tests");
+
+    suite_add_tcase(suite, chain);
+
+    tcase_add_test(chain, test_capture_y4m);
+    tcase_add_test(chain, test_capture_gif);
+
+    return suite;
+}
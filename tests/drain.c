@@ -0,0 +1,90 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <check.h>
+#include <libchippy/drain.h>
+#include <sched.h>
+#include <stddef.h>
+
+#define ITEMS 1000
+
+/**
+ * The items consumed, in order, one at a time.
+ */
+struct consumer {
+    size_t items[ITEMS];
+    size_t count;
+};
+
+static size_t consume(void *context, size_t tail, size_t head) {
+    struct consumer *consumer = context;
+
+    (void)head;
+    consumer->items[consumer->count++] = tail;
+
+    return tail + 1;
+}
+
+START_TEST(test_drain_wake)
+{
+    static struct consumer consumer;
+    struct drain drain;
+
+    consumer.count = 0;
+    ck_assert_int_eq(drain_start(&drain, consume, &consumer), 0);
+
+    // Every item is published on its own, mostly while the thread sleeps, and
+    // a lost wakeup would hang until the test times out.
+    for (size_t i = 1; i <= ITEMS; i++) {
+        drain_publish(&drain, i);
+
+        while (drain_tail(&drain) != i) {
+            sched_yield();
+        }
+    }
+
+    drain_stop(&drain);
+
+    ck_assert_int_eq(consumer.count, ITEMS);
+}
+END_TEST
+
+START_TEST(test_drain_stop)
+{
+    static struct consumer consumer;
+    struct drain drain;
+
+    consumer.count = 0;
+    ck_assert_int_eq(drain_start(&drain, consume, &consumer), 0);
+
+    // Stopping right after publishing still consumes every item.
+    drain_publish(&drain, ITEMS);
+    drain_stop(&drain);
+
+    ck_assert_int_eq(consumer.count, ITEMS);
+
+    for (size_t i = 0; i < ITEMS; i++) {
+        ck_assert_int_eq(consumer.items[i], i);
+    }
+}
+END_TEST
+
+Suite *create_drain_suite(void) {
+    Suite *suite = suite_create("Drain");
+    TCase *chain = tcase_create("drain tests");
+
+    suite_add_tcase(suite, chain);
+
+    tcase_add_test(chain, test_drain_wake);
+    tcase_add_test(chain, test_drain_stop);
+
+    return suite;
+}
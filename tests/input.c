@@ -0,0 +1,137 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include <check.h>
+#include <libchippy/chippy.h>
+#include <libchippy/input.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "program.h"
+
+/**
+ * Counts loop iterations in V0 until key V5 is pressed, and then stops in a
+ * loop at 0x206.
+ */
+static const uint16_t program[][2] = {
+    { 0x200, 0x7001 }, { 0x202, 0xE59E }, { 0x204, 0x1200 }, { 0x206, 0x1206 }
+};
+
+static struct chippy *create_machine(void) {
+    struct chippy *machine = malloc(sizeof(struct chippy));
+
+    chippy_init(machine);
+
+    load_program(machine, program, PROGRAM_SIZE(program));
+
+    machine->V[5] = 5;
+
+    return machine;
+}
+
+START_TEST(test_input_timing)
+{
+    struct chippy *machine = create_machine();
+    struct chippy_input input;
+
+    chippy_input_init(&input);
+
+    // Halfway through the frame, and at the start of the next one.
+    chippy_input_push(&input, 1500, 5, 1);
+    chippy_input_push(&input, 2000, 5, 0);
+
+    ck_assert_int_eq(chippy_input_run(machine, &input, 100, 1000, 2000), EXIT_SUCCESS);
+
+    // The press is seen at cycle 52, in the 18th iteration.
+    ck_assert_int_eq(machine->V[0], 18);
+    ck_assert_int_eq(machine->pc, 0x206);
+    ck_assert_int_eq(machine->cycles, 100);
+    ck_assert_int_eq(machine->keys, 1 << 5);
+
+    // The release belongs to the next frame.
+    ck_assert_int_eq(input.tail, 1);
+
+    chippy_input_run(machine, &input, 100, 2000, 3000);
+
+    ck_assert_int_eq(machine->keys, 0);
+    ck_assert_int_eq(input.tail, 2);
+
+    chippy_destroy(machine);
+}
+END_TEST
+
+START_TEST(test_input_tap)
+{
+    struct chippy *machine = create_machine();
+    struct chippy_input input;
+
+    chippy_input_init(&input);
+
+    // A tap between two frames is still seen by the next instruction.
+    machine->pc = 0x202;
+
+    chippy_input_push(&input, 500, 5, 1);
+    chippy_input_push(&input, 600, 5, 0);
+
+    chippy_input_run(machine, &input, 1, 1000, 2000);
+    chippy_input_run(machine, &input, 2, 2000, 3000);
+
+    ck_assert_int_eq(machine->pc, 0x206);
+    ck_assert_int_eq(machine->keys, 0);
+
+    chippy_destroy(machine);
+}
+END_TEST
+
+START_TEST(test_input_overflow)
+{
+    struct chippy *machine = create_machine();
+    struct chippy_input input;
+
+    chippy_input_init(&input);
+
+    for (int i = 0; i < INPUT_CAPACITY; i++) {
+        chippy_input_push(&input, i, 1, i % 2 == 0);
+    }
+
+    // Dropped, but the keypad catches up once the queue is drained.
+    chippy_input_push(&input, INPUT_CAPACITY, 2, 1);
+
+    ck_assert_int_eq(input.head, INPUT_CAPACITY);
+    ck_assert_int_eq(chippy_input_keys(&input), 1 << 2);
+
+    chippy_input_run(machine, &input, 10, 0, INPUT_CAPACITY + 1);
+
+    ck_assert_int_eq(machine->keys, 1 << 2);
+    ck_assert_int_eq(machine->cycles, 10);
+
+    // Restoring an older state discards what is queued.
+    chippy_input_push(&input, 1000, 3, 1);
+    machine->keys = 0;
+    chippy_input_sync(machine, &input);
+
+    ck_assert_int_eq(machine->keys, 1 << 2 | 1 << 3);
+    ck_assert_int_eq(input.tail, input.head);
+
+    chippy_destroy(machine);
+}
+END_TEST
+
+Suite *create_input_suite(void) {
+    Suite *suite = suite_create("Input");
+    TCase *chain = tcase_create("input tests");
+
+    suite_add_tcase(suite, chain);
+
+    tcase_add_test(chain, test_input_timing);
+    tcase_add_test(chain, test_input_tap);
+    tcase_add_test(chain, test_input_overflow);
+
+    return suite;
+}
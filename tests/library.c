@@ -0,0 +1,185 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <check.h>
+#include <libchippy/chippy.h>
+#include <libchippy/library.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * A program that draws the digits of a counter in a loop.
+ */
+static const uint8_t program[] = {
+    0x63, 0x00, 0xA3, 0x00, 0xF3, 0x33, 0xF2, 0x65, 0xF0, 0x29, 0x00, 0xE0,
+    0xD4, 0x55, 0x73, 0x01, 0x12, 0x02
+};
+
+/**
+ * Writes the given contents to a new temporary file.
+ */
+static void write_rom(char *path, const uint8_t *data, size_t size) {
+    strcpy(path, "/tmp/chippy-test-XXXXXX");
+
+    int fd = mkstemp(path);
+
+    ck_assert_int_ne(fd, -1);
+    ck_assert_int_eq(write(fd, data, size), size);
+
+    close(fd);
+}
+
+static struct chippy *create_machine(void) {
+    struct chippy *machine = malloc(sizeof(struct chippy));
+
+    chippy_init(machine);
+
+    return machine;
+}
+
+START_TEST(test_load_rom_errors)
+{
+    struct chippy *machine = create_machine();
+    uint8_t *large = calloc(MAX_ROM_SIZE + 1, 1);
+    char path[32];
+
+    ck_assert_int_eq(chippy_load_rom(machine, "/nonexistent/rom.ch8"), CHIPPY_ROM_UNREADABLE);
+
+    write_rom(path, large, 0);
+    ck_assert_int_eq(chippy_load_rom(machine, path), CHIPPY_ROM_EMPTY);
+    unlink(path);
+
+    write_rom(path, large, MAX_ROM_SIZE + 1);
+    ck_assert_int_eq(chippy_load_rom(machine, path), CHIPPY_ROM_TOO_LARGE);
+    unlink(path);
+
+    // A ROM that fills the program area exactly still fits.
+    large[MAX_ROM_SIZE - 1] = 0xAB;
+    write_rom(path, large, MAX_ROM_SIZE);
+    ck_assert_int_eq(chippy_load_rom(machine, path), CHIPPY_ROM_OK);
+    ck_assert_int_eq(machine->ram[RAM_SIZE - 1], 0xAB);
+    unlink(path);
+
+    free(large);
+    chippy_destroy(machine);
+}
+END_TEST
+
+START_TEST(test_library_errors)
+{
+    struct chippy_library *library = chippy_library_create();
+    const struct chippy_rom *rom = NULL;
+    uint8_t *large = calloc(MAX_ROM_SIZE + 1, 1);
+    char path[32];
+
+    ck_assert_int_eq(chippy_library_open(library, "/nonexistent/rom.ch8", &rom), CHIPPY_ROM_UNREADABLE);
+
+    write_rom(path, large, 0);
+    ck_assert_int_eq(chippy_library_open(library, path, &rom), CHIPPY_ROM_EMPTY);
+    unlink(path);
+
+    write_rom(path, large, MAX_ROM_SIZE + 1);
+    ck_assert_int_eq(chippy_library_open(library, path, &rom), CHIPPY_ROM_TOO_LARGE);
+    unlink(path);
+
+    ck_assert_ptr_eq(rom, NULL);
+
+    free(large);
+    chippy_library_destroy(library);
+}
+END_TEST
+
+START_TEST(test_library_shared)
+{
+    struct chippy_library *library = chippy_library_create();
+    const struct chippy_rom *first = NULL;
+    const struct chippy_rom *second = NULL;
+    const struct chippy_rom *other = NULL;
+    uint8_t changed[sizeof(program)];
+    char paths[3][32];
+
+    memcpy(changed, program, sizeof(program));
+    changed[1] = 0x05;
+
+    write_rom(paths[0], program, sizeof(program));
+    write_rom(paths[1], program, sizeof(program));
+    write_rom(paths[2], changed, sizeof(changed));
+
+    ck_assert_int_eq(chippy_library_open(library, paths[0], &first), CHIPPY_ROM_OK);
+    ck_assert_int_eq(chippy_library_open(library, paths[1], &second), CHIPPY_ROM_OK);
+    ck_assert_int_eq(chippy_library_open(library, paths[2], &other), CHIPPY_ROM_OK);
+
+    // Files with the same contents share one ROM.
+    ck_assert_ptr_eq(first, second);
+    ck_assert_ptr_ne(first, other);
+    ck_assert_int_eq(first->size, sizeof(program));
+
+    for (int i = 0; i < 3; i++) {
+        unlink(paths[i]);
+    }
+
+    chippy_library_destroy(library);
+}
+END_TEST
+
+START_TEST(test_library_load)
+{
+    struct chippy_library *library = chippy_library_create();
+    struct chippy *loaded = create_machine();
+    struct chippy *reference = create_machine();
+    const struct chippy_rom *rom = NULL;
+    char path[32];
+
+    write_rom(path, program, sizeof(program));
+
+    ck_assert_int_eq(chippy_library_open(library, path, &rom), CHIPPY_ROM_OK);
+    ck_assert_int_eq(chippy_load_rom(reference, path), CHIPPY_ROM_OK);
+
+    chippy_load(loaded, rom);
+
+    ck_assert_int_eq(memcmp(loaded->ram, reference->ram, sizeof(loaded->ram)), 0);
+
+    // The instructions of the ROM are decoded before the machine runs.
+    ck_assert_int_ne(loaded->decoded[PROGRAM_START].op, 0);
+    ck_assert_int_eq(loaded->decoded[PROGRAM_START].nnn, 0x300);
+
+    chippy_run_cycles(loaded, 1000);
+    chippy_run_cycles(reference, 1000);
+
+    ck_assert_int_eq(loaded->pc, reference->pc);
+    ck_assert_int_eq(memcmp(loaded->V, reference->V, sizeof(loaded->V)), 0);
+    ck_assert_int_eq(memcmp(loaded->gfx, reference->gfx, sizeof(loaded->gfx)), 0);
+    ck_assert_int_eq(memcmp(loaded->ram, reference->ram, sizeof(loaded->ram)), 0);
+
+    unlink(path);
+
+    chippy_destroy(reference);
+    chippy_destroy(loaded);
+    chippy_library_destroy(library);
+}
+END_TEST
+
+Suite *create_library_suite(void) {
+    Suite *suite = suite_create("Library");
+    TCase *chain = tcase_create("library tests");
+
+    suite_add_tcase(suite, chain);
+
+    tcase_add_test(chain, test_load_rom_errors);
+    tcase_add_test(chain, test_library_errors);
+    tcase_add_test(chain, test_library_shared);
+    tcase_add_test(chain, test_library_load);
+
+    return suite;
+}
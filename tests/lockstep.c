@@ -0,0 +1,221 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include <check.h>
+#include <libchippy/chippy.h>
+#include <libchippy/lockstep.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+
+/**
+ * A program that mixes arithmetic, calls, sprites, timers, random numbers and
+ * memory traffic. V0 decides whether a lane takes the indirect jump at 0x234
+ * to 0x238 or 0x23A, which makes lanes diverge and converge again.
+ */
+static const uint16_t program[][2] = {
+    { 0x200, 0x6A00 }, { 0x202, 0xA300 }, { 0x204, 0x7A01 }, { 0x206, 0x8104 },
+    { 0x208, 0x3100 }, { 0x20A, 0x1210 }, { 0x20C, 0x2230 }, { 0x20E, 0x1210 },
+    { 0x210, 0xC30F }, { 0x212, 0x8316 }, { 0x214, 0xF333 }, { 0x216, 0xD345 },
+    { 0x218, 0xF415 }, { 0x21A, 0xF507 }, { 0x21C, 0x8457 }, { 0x21E, 0xF255 },
+    { 0x220, 0xF265 }, { 0x222, 0x8124 }, { 0x224, 0x1204 },
+    { 0x230, 0x7401 }, { 0x232, 0x845E }, { 0x234, 0xB238 }, { 0x238, 0x00EE },
+    { 0x23A, 0x6B07 }, { 0x23C, 0x00EE }
+};
+
+/**
+ * A program that draws 16x16 sprites to both planes of a high resolution
+ * screen and scrolls them, and that skips over F000 NNNN in the lanes where the
+ * random V3 is not zero.
+ */
+static const uint16_t xo_program[][2] = {
+    { 0x200, 0x00FF }, { 0x202, 0xF301 }, { 0x204, 0xA300 }, { 0x206, 0xC37F },
+    { 0x208, 0xD340 }, { 0x20A, 0x00FB }, { 0x20C, 0x00C1 }, { 0x20E, 0xF275 },
+    { 0x210, 0x5312 }, { 0x212, 0x3300 }, { 0x214, 0xF000 }, { 0x216, 0x0310 },
+    { 0x218, 0xF485 }, { 0x21A, 0x7401 }, { 0x21C, 0x00FC }, { 0x21E, 0xF330 },
+    { 0x220, 0xD340 }, { 0x222, 0xA300 }, { 0x224, 0x1206 }
+};
+
+/**
+ * A program that tests random keys with SKP and SKNP, each lane with its own
+ * keypad, until it loads an audio pattern and pitch and waits for a key press
+ * with FX0A after 64 iterations.
+ */
+static const uint16_t key_program[][2] = {
+    { 0x200, 0x6A00 }, { 0x202, 0xC30F }, { 0x204, 0xE39E }, { 0x206, 0x7A01 },
+    { 0x208, 0xE3A1 }, { 0x20A, 0x7A10 }, { 0x20C, 0x7B01 }, { 0x20E, 0x3B40 },
+    { 0x210, 0x1202 }, { 0x212, 0xF002 }, { 0x214, 0xF33A }, { 0x216, 0xF50A },
+    { 0x218, 0x1218 }
+};
+
+/**
+ * Programs in which the lanes with V0 = 2, or with V0 = 0, skip the load at
+ * 0x202 and rejoin the others at 0x204 one cycle ahead of them.
+ */
+static const uint16_t rejoin_program[][2] = {
+    { 0x200, 0x3002 }, { 0x202, 0x6B05 }, { 0x204, 0x7C01 }, { 0x206, 0x1204 }
+};
+
+static const uint16_t rejoin_swapped_program[][2] = {
+    { 0x200, 0x3000 }, { 0x202, 0x6B05 }, { 0x204, 0x7C01 }, { 0x206, 0x1204 }
+};
+
+static void load_lane(struct chippy *machine, int lane, const uint16_t (*program)[2], size_t size) {
+    chippy_init(machine);
+    chippy_seed(machine, lane);
+    load_program(machine, program, size);
+
+    machine->cycles_per_tick = 7;
+    machine->V[0] = (lane % 2) * 2;
+    machine->V[4] = lane * 3;
+    machine->keys = 0x5A3C >> (lane % 8);
+}
+
+static void assert_same(struct chippy *machine, struct chippy *reference) {
+    ck_assert_int_eq(machine->pc, reference->pc);
+    ck_assert_int_eq(machine->I, reference->I);
+    ck_assert_int_eq(machine->sp, reference->sp);
+    ck_assert_int_eq(machine->cycles, reference->cycles);
+    ck_assert_int_eq(chippy_get_delay_timer(machine), chippy_get_delay_timer(reference));
+    ck_assert_int_eq(memcmp(machine->V, reference->V, sizeof(machine->V)), 0);
+    ck_assert_int_eq(memcmp(machine->stack, reference->stack, sizeof(machine->stack)), 0);
+    ck_assert_int_eq(memcmp(machine->gfx, reference->gfx, sizeof(machine->gfx)), 0);
+    ck_assert_int_eq(memcmp(machine->ram, reference->ram, sizeof(machine->ram)), 0);
+    ck_assert_int_eq(memcmp(machine->flags, reference->flags, sizeof(machine->flags)), 0);
+    ck_assert_int_eq(machine->hires, reference->hires);
+    ck_assert_int_eq(machine->planes, reference->planes);
+    ck_assert_int_eq(memcmp(machine->pattern, reference->pattern, sizeof(machine->pattern)), 0);
+    ck_assert_int_eq(machine->pitch, reference->pitch);
+}
+
+static void run_against_interpreter(int lanes, const uint16_t (*program)[2], size_t size) {
+    struct chippy_lockstep *lockstep = malloc(sizeof(struct chippy_lockstep));
+    struct chippy *machine = malloc(sizeof(struct chippy));
+    struct chippy *references = malloc(lanes * sizeof(struct chippy));
+
+    chippy_lockstep_init(lockstep, lanes);
+
+    for (int lane = 0; lane < lanes; lane++) {
+        load_lane(&references[lane], lane, program, size);
+        chippy_lockstep_load(lockstep, lane, &references[lane]);
+    }
+
+    unsigned long steps[] = { 1, 6, 10, 100, 1000, 5000 };
+
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        chippy_lockstep_run(lockstep, steps[i]);
+
+        for (int lane = 0; lane < lanes; lane++) {
+            for (unsigned long step = 0; step < steps[i]; step++) {
+                chippy_step(&references[lane]);
+            }
+
+            chippy_init(machine);
+            chippy_lockstep_store(lockstep, lane, machine);
+
+            assert_same(machine, &references[lane]);
+        }
+    }
+
+    free(references);
+    free(machine);
+    free(lockstep);
+}
+
+START_TEST(test_lockstep_full)
+{
+    run_against_interpreter(LOCKSTEP_LANES, program, PROGRAM_SIZE(program));
+}
+END_TEST
+
+START_TEST(test_lockstep_partial)
+{
+    run_against_interpreter(5, program, PROGRAM_SIZE(program));
+}
+END_TEST
+
+START_TEST(test_lockstep_xo_chip)
+{
+    run_against_interpreter(LOCKSTEP_LANES, xo_program, PROGRAM_SIZE(xo_program));
+}
+END_TEST
+
+START_TEST(test_lockstep_keys)
+{
+    run_against_interpreter(LOCKSTEP_LANES, key_program, PROGRAM_SIZE(key_program));
+}
+END_TEST
+
+START_TEST(test_lockstep_rejoin)
+{
+    run_against_interpreter(2, rejoin_program, PROGRAM_SIZE(rejoin_program));
+    run_against_interpreter(2, rejoin_swapped_program, PROGRAM_SIZE(rejoin_swapped_program));
+}
+END_TEST
+
+START_TEST(test_lockstep_self_modifying_code)
+{
+    struct chippy_lockstep *lockstep = malloc(sizeof(struct chippy_lockstep));
+    struct chippy *machine = malloc(sizeof(struct chippy));
+
+    chippy_lockstep_init(lockstep, 2);
+
+    // Lane 0 overwrites the jump at 0x206 with LD V2, 0x33 before reaching it,
+    // lane 1 skips the store and keeps looping.
+    for (int lane = 0; lane < 2; lane++) {
+        chippy_init(machine);
+
+        machine->ram[0x200] = 0xA2;
+        machine->ram[0x201] = 0x06;
+        machine->ram[0x202] = 0x3A;
+        machine->ram[0x203] = 0x01;
+        machine->ram[0x204] = 0xF1;
+        machine->ram[0x205] = 0x55;
+        machine->ram[0x206] = 0x12;
+        machine->ram[0x207] = 0x06;
+
+        machine->V[0] = 0x62;
+        machine->V[1] = 0x33;
+        machine->V[0xA] = lane;
+
+        chippy_lockstep_load(lockstep, lane, machine);
+    }
+
+    chippy_lockstep_run(lockstep, 4);
+
+    chippy_lockstep_store(lockstep, 0, machine);
+    ck_assert_int_eq(machine->pc, 0x208);
+    ck_assert_int_eq(machine->V[2], 0x33);
+
+    chippy_lockstep_store(lockstep, 1, machine);
+    ck_assert_int_eq(machine->pc, 0x206);
+    ck_assert_int_eq(machine->V[2], 0);
+
+    free(machine);
+    free(lockstep);
+}
+END_TEST
+
+Suite *create_lockstep_suite(void) {
+    Suite *suite = suite_create("Lockstep");
+    TCase *chain = tcase_create("lockstep tests");
+
+    suite_add_tcase(suite, chain);
+
+    tcase_add_test(chain, test_lockstep_full);
+    tcase_add_test(chain, test_lockstep_partial);
+    tcase_add_test(chain, test_lockstep_xo_chip);
+    tcase_add_test(chain, test_lockstep_keys);
+    tcase_add_test(chain, test_lockstep_self_modifying_code);
+    tcase_add_test(chain, test_lockstep_rejoin);
+
+    return suite;
+}
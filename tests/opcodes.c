@@ -14,14 +14,42 @@
 
 #include <stdio.h>
 
+static enum chippy_engine engine;
+
+static void use_interpreter(void) {
+    engine = CHIPPY_ENGINE_INTERPRETER;
+}
+
+static void use_jit(void) {
+    engine = CHIPPY_ENGINE_JIT;
+}
+
+/**
+ * The machines created by the running test, which are destroyed after it.
+ */
+static struct chippy *machines[2];
+static int machine_count = 0;
+
 static struct chippy *chippy_create(void) {
     struct chippy *machine = malloc(sizeof(struct chippy));
 
+    ck_assert_ptr_ne(machine, NULL);
+    ck_assert_int_lt(machine_count, 2);
+
     chippy_init(machine);
 
+    machine->engine = engine;
+    machines[machine_count++] = machine;
+
     return machine;
 }
 
+static void destroy_machines(void) {
+    while (machine_count > 0) {
+        chippy_destroy(machines[--machine_count]);
+    }
+}
+
 static void chippy_insert_opcode(struct chippy *machine, uint16_t opcode, uint16_t address) {
     machine->ram[address] = opcode >> 8;
     machine->ram[address + 1] = opcode & 0xFF;
@@ -31,13 +59,16 @@ START_TEST(test_cls)
 {
     struct chippy *machine = chippy_create();
 
-    memset(machine->gfx, 1, SCREEN_W * SCREEN_H);
+    // Only the selected plane is cleared, which is the first by default.
+    memset(machine->gfx[0], 0xFF, sizeof(machine->gfx[0]));
 
     chippy_insert_opcode(machine, 0x00E0, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
-    for (int i = 0; i < (SCREEN_W * SCREEN_H); i++) {
-        ck_assert_int_eq(machine->gfx[i], 0);
+    for (int y = 0; y < SCREEN_H; y++) {
+        for (int x = 0; x < SCREEN_W; x++) {
+            ck_assert_int_eq(chippy_get_pixel(machine, x, y), 0);
+        }
     }
 }
 END_TEST
@@ -53,7 +84,7 @@ START_TEST(test_ret)
     ck_assert_int_eq(machine->sp, 3);
 
     chippy_insert_opcode(machine, 0x00EE, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->pc, 0x230);
     ck_assert_int_eq(machine->sp, 2);
@@ -65,7 +96,7 @@ START_TEST(test_jp)
     struct chippy *machine = chippy_create();
 
     chippy_insert_opcode(machine, 0x1234, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->pc, 0x234);
 }
@@ -80,7 +111,7 @@ START_TEST(test_call)
     ck_assert_int_eq(machine->sp, 1);
 
     chippy_insert_opcode(machine, 0x2345, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->sp, 2);
     ck_assert_int_eq(machine->pc, 0x345);
@@ -94,7 +125,7 @@ START_TEST(test_se_xkk)
     machine->V[2] = 0x12;
 
     chippy_insert_opcode(machine, 0x3212, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->pc, 0x204);
 }
@@ -107,7 +138,7 @@ START_TEST(test_sne_xkk)
     machine->V[2] = 0x12;
 
     chippy_insert_opcode(machine, 0x4299, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->pc, 0x204);
 }
@@ -121,7 +152,7 @@ START_TEST(test_se_xy)
     machine->V[3] = 0x12;
 
     chippy_insert_opcode(machine, 0x5230, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->pc, 0x204);
 }
@@ -132,7 +163,7 @@ START_TEST(test_ld_kk)
     struct chippy *machine = chippy_create();
 
     chippy_insert_opcode(machine, 0x6230, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[2], 0x30);
 }
@@ -143,7 +174,7 @@ START_TEST(test_add_xkk)
     struct chippy *machine = chippy_create();
 
     chippy_insert_opcode(machine, 0x7120, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 0x20);
 }
@@ -156,7 +187,7 @@ START_TEST(test_ld_xy)
     machine->V[2] = 3;
 
     chippy_insert_opcode(machine, 0x8121, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 3);
 }
@@ -170,7 +201,7 @@ START_TEST(test_or)
     machine->V[2] = 3;
 
     chippy_insert_opcode(machine, 0x8122, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 7);
 }
@@ -184,7 +215,7 @@ START_TEST(test_xor)
     machine->V[2] = 3;
 
     chippy_insert_opcode(machine, 0x8123, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 6);
 }
@@ -198,7 +229,7 @@ START_TEST(test_add_xy)
     machine->V[2] = 3;
 
     chippy_insert_opcode(machine, 0x8124, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 8);
     ck_assert_int_eq(machine->V[0xF], 0);
@@ -207,7 +238,7 @@ START_TEST(test_add_xy)
     machine->V[2] = 200;
 
     chippy_insert_opcode(machine, 0x8124, 0x202);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 144);
     ck_assert_int_eq(machine->V[0xF], 1);
@@ -222,7 +253,7 @@ START_TEST(test_sub_xy)
     machine->V[2] = 3;
 
     chippy_insert_opcode(machine, 0x8125, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 2);
     ck_assert_int_eq(machine->V[0xF], 1);
@@ -231,7 +262,7 @@ START_TEST(test_sub_xy)
     machine->V[2] = 5;
 
     chippy_insert_opcode(machine, 0x8125, 0x202);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 254);
     ck_assert_int_eq(machine->V[0xF], 0);
@@ -245,7 +276,7 @@ START_TEST(test_shr)
     machine->V[1] = 23;
 
     chippy_insert_opcode(machine, 0x8106, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 11);
     ck_assert_int_eq(machine->V[0xF], 1);
@@ -253,7 +284,7 @@ START_TEST(test_shr)
     machine->V[1] = 22;
 
     chippy_insert_opcode(machine, 0x8106, 0x202);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 11);
     ck_assert_int_eq(machine->V[0xF], 0);
@@ -268,7 +299,7 @@ START_TEST(test_subn)
     machine->V[2] = 5;
 
     chippy_insert_opcode(machine, 0x8127, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 2);
     ck_assert_int_eq(machine->V[0xF], 1);
@@ -277,7 +308,7 @@ START_TEST(test_subn)
     machine->V[2] = 3;
 
     chippy_insert_opcode(machine, 0x8127, 0x202);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 254);
     ck_assert_int_eq(machine->V[0xF], 0);
@@ -291,7 +322,7 @@ START_TEST(test_shl)
     machine->V[1] = 23;
 
     chippy_insert_opcode(machine, 0x810E, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 46);
     ck_assert_int_eq(machine->V[0xF], 0);
@@ -299,7 +330,7 @@ START_TEST(test_shl)
     machine->V[1] = 151;
 
     chippy_insert_opcode(machine, 0x810E, 0x202);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->V[1], 46);
     ck_assert_int_eq(machine->V[0xF], 1);
@@ -314,7 +345,7 @@ START_TEST(test_sne_xy)
     machine->V[3] = 0x12;
 
     chippy_insert_opcode(machine, 0x9230, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->pc, 0x204);
 }
@@ -325,7 +356,7 @@ START_TEST(test_ld_i)
     struct chippy *machine = chippy_create();
 
     chippy_insert_opcode(machine, 0xA123, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->I, 0x123);
 }
@@ -338,18 +369,673 @@ START_TEST(test_jp_nnn)
     machine->V[0] = 4;
 
     chippy_insert_opcode(machine, 0xB123, 0x200);
-    chippy_step(machine);
+    chippy_run_cycles(machine, 1);
 
     ck_assert_int_eq(machine->pc, 0x127);
 }
 END_TEST
 
-Suite *create_opcodes_suite(void) {
-    Suite *suite = suite_create("Opcodes");
-    TCase *chain = tcase_create("opcode tests");
+START_TEST(test_rnd)
+{
+    struct chippy *machine = chippy_create();
+    struct chippy *other = chippy_create();
+
+    chippy_seed(machine, 42);
+    chippy_seed(other, 42);
+
+    for (int i = 0; i < 8; i++) {
+        chippy_insert_opcode(machine, 0xC10F, 0x200 + i * 2);
+        chippy_insert_opcode(other, 0xC10F, 0x200 + i * 2);
+
+        chippy_run_cycles(machine, 1);
+        chippy_run_cycles(other, 1);
+
+        ck_assert_int_eq(machine->V[1], other->V[1]);
+        ck_assert_int_eq(machine->V[1] & 0xF0, 0);
+    }
+}
+END_TEST
+
+START_TEST(test_drw)
+{
+    struct chippy *machine = chippy_create();
+
+    memset(machine->gfx, 0, sizeof(machine->gfx));
+
+    machine->I = 0x300;
+    machine->ram[0x300] = 0xC3;
+    machine->ram[0x301] = 0x81;
+    machine->V[1] = 60 + SCREEN_W;
+    machine->V[2] = 30;
+
+    chippy_insert_opcode(machine, 0xD123, 0x200);
+    chippy_run_cycles(machine, 1);
+
+    // The sprite wraps to (60, 30) and is clipped at the edges.
+    ck_assert_int_eq(chippy_get_pixel(machine, 60, 30), 1);
+    ck_assert_int_eq(chippy_get_pixel(machine, 61, 30), 1);
+    ck_assert_int_eq(chippy_get_pixel(machine, 62, 30), 0);
+    ck_assert_int_eq(chippy_get_pixel(machine, 60, 31), 1);
+    ck_assert_int_eq(chippy_get_pixel(machine, 61, 31), 0);
+    ck_assert_int_eq(chippy_get_pixel(machine, 0, 30), 0);
+    ck_assert_int_eq(chippy_get_pixel(machine, 60, 0), 0);
+    ck_assert_int_eq(machine->V[0xF], 0);
+
+    chippy_insert_opcode(machine, 0xD121, 0x202);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(chippy_get_pixel(machine, 60, 30), 0);
+    ck_assert_int_eq(chippy_get_pixel(machine, 60, 31), 1);
+    ck_assert_int_eq(machine->V[0xF], 1);
+}
+END_TEST
+
+START_TEST(test_gfx_dirty)
+{
+    struct chippy *machine = chippy_create();
+
+    ck_assert(machine->gfx_dirty == GFX_ALL_ROWS);
+
+    machine->gfx_dirty = 0;
+    machine->V[2] = 30;
+
+    // A sprite at the bottom edge is clipped to the last two rows.
+    chippy_insert_opcode(machine, 0xD125, 0x200);
+    chippy_insert_opcode(machine, 0x7201, 0x202);
+    chippy_insert_opcode(machine, 0x00E0, 0x204);
+
+    uint64_t generation = machine->gfx_generation;
+
+    chippy_run_cycles(machine, 2);
+
+    ck_assert(machine->gfx_dirty == UINT64_C(3) << 30);
+    ck_assert(machine->gfx_generation == generation + 1);
+
+    chippy_run_cycles(machine, 1);
+
+    ck_assert(machine->gfx_dirty == GFX_ALL_ROWS);
+    ck_assert(machine->gfx_generation == generation + 2);
+
+    // With VF as VY, the rows are those of VY before the collision flag.
+    machine->gfx_dirty = 0;
+    machine->V[0xF] = 20;
+    machine->I = FONT_ADDRESS;
+
+    chippy_insert_opcode(machine, 0xD0F5, 0x206);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert(machine->gfx_dirty == UINT64_C(0x1F) << 20);
+    ck_assert_int_eq(machine->V[0xF], 0);
+}
+END_TEST
+
+START_TEST(test_skp_sknp)
+{
+    struct chippy *machine = chippy_create();
+
+    // Only the low nibble of VX selects the key.
+    machine->keys = 1 << 0xA;
+    machine->V[2] = 0x1A;
+    machine->V[3] = 0x0B;
+
+    chippy_insert_opcode(machine, 0xE29E, 0x200);
+    chippy_insert_opcode(machine, 0xE39E, 0x204);
+    chippy_insert_opcode(machine, 0xE3A1, 0x206);
+    chippy_insert_opcode(machine, 0xE2A1, 0x20A);
+
+    chippy_run_cycles(machine, 3);
+    ck_assert_int_eq(machine->pc, 0x20A);
+
+    chippy_run_cycles(machine, 1);
+    ck_assert_int_eq(machine->pc, 0x20C);
+}
+END_TEST
+
+START_TEST(test_timers)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->cycles_per_tick = 10;
+
+    chippy_insert_opcode(machine, 0x613C, 0x200);
+    chippy_insert_opcode(machine, 0xF115, 0x202);
+    chippy_insert_opcode(machine, 0xF118, 0x204);
+    chippy_insert_opcode(machine, 0x1206, 0x206);
+
+    chippy_run_cycles(machine, 3);
+
+    ck_assert_int_eq(chippy_get_delay_timer(machine), 60);
+    ck_assert_int_eq(chippy_get_sound_timer(machine), 60);
+    ck_assert_int_eq(chippy_cycles_until_tick(machine), 7);
+
+    // The sound started at cycle 2, and stops on the 60th tick after.
+    ck_assert_int_eq(chippy_get_sound_end(machine), 600);
+
+    chippy_run_cycles(machine, 100);
+
+    ck_assert_int_eq(machine->cycles, 103);
+    ck_assert_int_eq(chippy_get_delay_timer(machine), 50);
+
+    // Replaces the loop with a read of the delay timer.
+    chippy_insert_opcode(machine, 0xF207, 0x206);
+    chippy_invalidate(machine, 0x206, 2);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(machine->V[2], 50);
+
+    chippy_run_cycles(machine, 1000);
+
+    ck_assert_int_eq(chippy_get_delay_timer(machine), 0);
+    ck_assert_int_eq(chippy_get_sound_timer(machine), 0);
+}
+END_TEST
+
+START_TEST(test_add_i)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->I = 0x300;
+    machine->V[1] = 0x12;
+
+    chippy_insert_opcode(machine, 0xF11E, 0x200);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(machine->I, 0x312);
+}
+END_TEST
+
+START_TEST(test_ld_f)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->V[1] = 0xA;
+
+    chippy_insert_opcode(machine, 0xF129, 0x200);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(machine->I, 50);
+}
+END_TEST
+
+START_TEST(test_ld_b)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->I = 0x300;
+    machine->V[1] = 254;
+
+    chippy_insert_opcode(machine, 0xF133, 0x200);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(machine->ram[0x300], 2);
+    ck_assert_int_eq(machine->ram[0x301], 5);
+    ck_assert_int_eq(machine->ram[0x302], 4);
+}
+END_TEST
+
+START_TEST(test_ld_mem_x)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->I = 0x300;
+    machine->V[0] = 1;
+    machine->V[1] = 2;
+    machine->V[2] = 3;
+
+    chippy_insert_opcode(machine, 0xF255, 0x200);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(machine->ram[0x300], 1);
+    ck_assert_int_eq(machine->ram[0x301], 2);
+    ck_assert_int_eq(machine->ram[0x302], 3);
+}
+END_TEST
+
+START_TEST(test_ld_x_mem)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->I = 0x300;
+    machine->ram[0x300] = 1;
+    machine->ram[0x301] = 2;
+
+    chippy_insert_opcode(machine, 0xF165, 0x200);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(machine->V[0], 1);
+    ck_assert_int_eq(machine->V[1], 2);
+}
+END_TEST
+
+START_TEST(test_ld_x_k)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->keys = 1 << 3;
+
+    chippy_insert_opcode(machine, 0xF50A, 0x200);
+    chippy_insert_opcode(machine, 0x7601, 0x202);
+
+    // The machine waits, and the time spent waiting counts.
+    ck_assert_int_eq(chippy_run_cycles(machine, 100), CHIPPY_WAITING);
+    ck_assert_int_eq(machine->cycles, 100);
+    ck_assert_int_eq(machine->pc, 0x202);
+
+    // A key that was held when the wait started has to be pressed again.
+    ck_assert_int_eq(chippy_run_cycles(machine, 100), CHIPPY_WAITING);
+    machine->keys = 0;
+    ck_assert_int_eq(chippy_step(machine), CHIPPY_WAITING);
+    ck_assert_int_eq(machine->cycles, 201);
+
+    machine->keys = 1 << 3;
+    ck_assert_int_eq(chippy_run_cycles(machine, 1), EXIT_SUCCESS);
+    ck_assert_int_eq(machine->V[5], 3);
+    ck_assert_int_eq(machine->V[6], 1);
+    ck_assert_int_eq(machine->pc, 0x204);
+}
+END_TEST
+
+START_TEST(test_hires)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->I = 0x300;
+    machine->V[1] = 56;
+    machine->V[2] = 60;
+
+    for (int i = 0; i < 32; i++) {
+        machine->ram[0x300 + i] = 0xFF;
+    }
+
+    // HIGH, then a 16x16 sprite that straddles two words and the bottom edge.
+    chippy_insert_opcode(machine, 0x00FF, 0x200);
+    chippy_insert_opcode(machine, 0xD120, 0x202);
+    chippy_run_cycles(machine, 2);
+
+    ck_assert_int_eq(chippy_screen_width(machine), HIRES_SCREEN_W);
+    ck_assert_int_eq(chippy_screen_height(machine), HIRES_SCREEN_H);
+    ck_assert_int_eq(chippy_get_pixel(machine, 55, 60), 0);
+    ck_assert_int_eq(chippy_get_pixel(machine, 56, 60), 1);
+    ck_assert_int_eq(chippy_get_pixel(machine, 63, 63), 1);
+    ck_assert_int_eq(chippy_get_pixel(machine, 64, 63), 1);
+    ck_assert_int_eq(chippy_get_pixel(machine, 71, 60), 1);
+    ck_assert_int_eq(chippy_get_pixel(machine, 72, 60), 0);
+    ck_assert_int_eq(chippy_get_pixel(machine, 56, 0), 0);
+    ck_assert_int_eq(machine->V[0xF], 0);
+
+    // LOW clears the screen.
+    chippy_insert_opcode(machine, 0x00FE, 0x204);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(chippy_screen_width(machine), SCREEN_W);
+    ck_assert_int_eq(chippy_get_pixel(machine, 56, 30), 0);
+}
+END_TEST
+
+START_TEST(test_scroll)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->gfx[0][10][0] = UINT64_C(0x000000000000000F);
+
+    // HIGH clears the screen, so the pixels are set after switching.
+    chippy_insert_opcode(machine, 0x00FF, 0x200);
+    chippy_run_cycles(machine, 1);
 
-    suite_add_tcase(suite, chain);
+    machine->gfx[0][10][0] = UINT64_C(0x000000000000000F);
 
+    // SCR moves the pixels into the next word, SCD 3 moves them down, and SCL
+    // moves them back.
+    chippy_insert_opcode(machine, 0x00FB, 0x202);
+    chippy_insert_opcode(machine, 0x00C3, 0x204);
+    chippy_run_cycles(machine, 2);
+
+    ck_assert_int_eq(chippy_get_pixel(machine, 63, 10), 0);
+    ck_assert_int_eq(chippy_get_pixel(machine, 64, 13), 1);
+    ck_assert_int_eq(chippy_get_pixel(machine, 67, 13), 1);
+    ck_assert_int_eq(chippy_get_pixel(machine, 68, 13), 0);
+
+    chippy_insert_opcode(machine, 0x00FC, 0x206);
+    chippy_insert_opcode(machine, 0x00D1, 0x208);
+    chippy_run_cycles(machine, 2);
+
+    ck_assert_int_eq(machine->gfx[0][12][0], UINT64_C(0x000000000000000F));
+    ck_assert_int_eq(machine->gfx[0][12][1], 0);
+    ck_assert_int_eq(machine->gfx[0][13][0], 0);
+}
+END_TEST
+
+START_TEST(test_plane)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->I = 0x300;
+    machine->ram[0x300] = 0xC0;
+    machine->ram[0x301] = 0xA0;
+
+    // PLANE 3 draws the second row of sprite data to the second plane.
+    chippy_insert_opcode(machine, 0xF301, 0x200);
+    chippy_insert_opcode(machine, 0xD001, 0x202);
+    chippy_run_cycles(machine, 2);
+
+    ck_assert_int_eq(chippy_get_pixel(machine, 0, 0), 3);
+    ck_assert_int_eq(chippy_get_pixel(machine, 1, 0), 1);
+    ck_assert_int_eq(chippy_get_pixel(machine, 2, 0), 2);
+    ck_assert_int_eq(chippy_get_pixel(machine, 3, 0), 0);
+
+    // PLANE 2 clears only the second plane.
+    chippy_insert_opcode(machine, 0xF201, 0x204);
+    chippy_insert_opcode(machine, 0x00E0, 0x206);
+    chippy_run_cycles(machine, 2);
+
+    ck_assert_int_eq(chippy_get_pixel(machine, 0, 0), 1);
+    ck_assert_int_eq(chippy_get_pixel(machine, 2, 0), 0);
+}
+END_TEST
+
+START_TEST(test_ld_i_long)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->V[0] = 1;
+
+    // The skip steps over both words of LD I, 0xE000.
+    chippy_insert_opcode(machine, 0x3001, 0x200);
+    chippy_insert_opcode(machine, 0xF000, 0x202);
+    chippy_insert_opcode(machine, 0xE000, 0x204);
+    chippy_insert_opcode(machine, 0xF000, 0x206);
+    chippy_insert_opcode(machine, 0xE000, 0x208);
+    chippy_run_cycles(machine, 2);
+
+    ck_assert_int_eq(machine->pc, 0x20A);
+    ck_assert_int_eq(machine->I, 0xE000);
+
+    // Memory above 4KB is addressable through it.
+    machine->V[0] = 0x42;
+    chippy_insert_opcode(machine, 0xF055, 0x20A);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(machine->ram[0xE000], 0x42);
+}
+END_TEST
+
+START_TEST(test_save_load_xy)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->I = 0x300;
+    machine->V[2] = 1;
+    machine->V[3] = 2;
+    machine->V[4] = 3;
+
+    // Saves V2 to V4, then loads them in reverse order into V7 to V5.
+    chippy_insert_opcode(machine, 0x5242, 0x200);
+    chippy_insert_opcode(machine, 0x5753, 0x202);
+    chippy_run_cycles(machine, 2);
+
+    ck_assert_int_eq(machine->ram[0x300], 1);
+    ck_assert_int_eq(machine->ram[0x301], 2);
+    ck_assert_int_eq(machine->ram[0x302], 3);
+    ck_assert_int_eq(machine->V[7], 1);
+    ck_assert_int_eq(machine->V[6], 2);
+    ck_assert_int_eq(machine->V[5], 3);
+    ck_assert_int_eq(machine->I, 0x300);
+}
+END_TEST
+
+START_TEST(test_flags)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->V[0] = 7;
+    machine->V[1] = 8;
+    machine->V[2] = 9;
+
+    chippy_insert_opcode(machine, 0xF175, 0x200);
+    chippy_insert_opcode(machine, 0x6000, 0x202);
+    chippy_insert_opcode(machine, 0x6100, 0x204);
+    chippy_insert_opcode(machine, 0xF285, 0x206);
+    chippy_run_cycles(machine, 4);
+
+    ck_assert_int_eq(machine->V[0], 7);
+    ck_assert_int_eq(machine->V[1], 8);
+    ck_assert_int_eq(machine->V[2], 0);
+}
+END_TEST
+
+START_TEST(test_ld_hf)
+{
+    struct chippy *machine = chippy_create();
+
+    machine->V[3] = 0x1A;
+
+    chippy_insert_opcode(machine, 0xF330, 0x200);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(machine->I, BIG_FONT_ADDRESS + 0xA * 10);
+}
+END_TEST
+
+START_TEST(test_audio)
+{
+    struct chippy *machine = chippy_create();
+
+    ck_assert_int_eq(machine->pattern[0], 0xF0);
+    ck_assert_int_eq(machine->pitch, DEFAULT_PITCH);
+
+    machine->I = 0x300;
+    machine->V[4] = 112;
+
+    for (int i = 0; i < AUDIO_PATTERN_SIZE; i++) {
+        machine->ram[0x300 + i] = i;
+    }
+
+    chippy_insert_opcode(machine, 0xF002, 0x200);
+    chippy_insert_opcode(machine, 0xF43A, 0x202);
+    chippy_run_cycles(machine, 2);
+
+    for (int i = 0; i < AUDIO_PATTERN_SIZE; i++) {
+        ck_assert_int_eq(machine->pattern[i], i);
+    }
+
+    ck_assert_int_eq(machine->pitch, 112);
+}
+END_TEST
+
+START_TEST(test_exit)
+{
+    struct chippy *machine = chippy_create();
+
+    chippy_insert_opcode(machine, 0x00FD, 0x200);
+    chippy_run_cycles(machine, 10);
+
+    ck_assert_int_eq(machine->pc, 0x200);
+}
+END_TEST
+
+START_TEST(test_self_modifying_code)
+{
+    struct chippy *machine = chippy_create();
+
+    // Executes LD V2, 0x11 at 0x204, then overwrites it with LD V2, 0x33.
+    chippy_insert_opcode(machine, 0x1204, 0x200);
+    chippy_insert_opcode(machine, 0x6211, 0x204);
+    chippy_insert_opcode(machine, 0x1208, 0x206);
+    chippy_insert_opcode(machine, 0x6062, 0x208);
+    chippy_insert_opcode(machine, 0x6133, 0x20A);
+    chippy_insert_opcode(machine, 0xA204, 0x20C);
+    chippy_insert_opcode(machine, 0xF155, 0x20E);
+    chippy_insert_opcode(machine, 0x1204, 0x210);
+
+    for (int i = 0; i < 3; i++) {
+        chippy_run_cycles(machine, 1);
+    }
+
+    ck_assert_int_eq(machine->V[2], 0x11);
+
+    for (int i = 0; i < 6; i++) {
+        chippy_run_cycles(machine, 1);
+    }
+
+    ck_assert_int_eq(machine->pc, 0x206);
+    ck_assert_int_eq(machine->V[2], 0x33);
+}
+END_TEST
+
+START_TEST(test_run_cycles)
+{
+    struct chippy *machine = chippy_create();
+    struct chippy *reference = chippy_create();
+
+    // Counts V1 down from 200 while accumulating V2 and V3, and halts.
+    uint16_t program[] = {
+        0x61C8, 0x6200, 0x6300, 0x6401, 0x7205, 0x8324, 0x8326, 0x8145,
+        0x3100, 0x1208, 0x1214
+    };
+
+    for (int i = 0; i < (int)(sizeof(program) / sizeof(program[0])); i++) {
+        chippy_insert_opcode(machine, program[i], 0x200 + i * 2);
+        chippy_insert_opcode(reference, program[i], 0x200 + i * 2);
+    }
+
+    // An empty budget runs nothing, on every path through the engines.
+    for (int skip_idle = 0; skip_idle < 2; skip_idle++) {
+        machine->skip_idle = skip_idle;
+
+        ck_assert_int_eq(chippy_run_cycles(machine, 0), 0);
+        ck_assert_int_eq(machine->pc, 0x200);
+        ck_assert_int_eq(machine->cycles, 0);
+    }
+
+    for (int cycles = 1; cycles < 1500; cycles += 97) {
+        chippy_run_cycles(machine, cycles);
+
+        for (int i = 0; i < cycles; i++) {
+            chippy_step(reference);
+        }
+
+        ck_assert_int_eq(machine->pc, reference->pc);
+        ck_assert_int_eq(machine->cycles, reference->cycles);
+        ck_assert_int_eq(memcmp(machine->V, reference->V, sizeof(machine->V)), 0);
+    }
+
+    ck_assert_int_eq(machine->pc, 0x214);
+    ck_assert_int_eq(machine->V[1], 0);
+}
+END_TEST
+
+START_TEST(test_idle_loop)
+{
+    struct chippy *machine = chippy_create();
+    struct chippy *reference = chippy_create();
+
+    // Waits for the delay timer three times, counting in V2, and halts.
+    uint16_t program[] = {
+        0x6303, 0xF315, 0xF107, 0x3100, 0x1204, 0x7201, 0x5230, 0x1202,
+        0x1210
+    };
+
+    for (int i = 0; i < (int)(sizeof(program) / sizeof(program[0])); i++) {
+        chippy_insert_opcode(machine, program[i], 0x200 + i * 2);
+        chippy_insert_opcode(reference, program[i], 0x200 + i * 2);
+    }
+
+    machine->cycles_per_tick = 1000;
+    reference->cycles_per_tick = 1000;
+
+    for (int cycles = 1; cycles < 20000; cycles += 997) {
+        chippy_run_cycles(machine, cycles);
+
+        for (int i = 0; i < cycles; i++) {
+            chippy_step(reference);
+        }
+
+        ck_assert_int_eq(machine->pc, reference->pc);
+        ck_assert_int_eq(machine->cycles, reference->cycles);
+        ck_assert_int_eq(chippy_get_delay_timer(machine), chippy_get_delay_timer(reference));
+        ck_assert_int_eq(memcmp(machine->V, reference->V, sizeof(machine->V)), 0);
+    }
+
+    ck_assert_int_eq(machine->pc, 0x210);
+    ck_assert_int_eq(machine->V[2], 3);
+
+    // The halted machine only counts cycles.
+    chippy_run_cycles(machine, 1000000000);
+
+    ck_assert_int_eq(machine->pc, 0x210);
+    ck_assert_int_eq(machine->cycles, reference->cycles + 1000000000);
+}
+END_TEST
+
+START_TEST(test_wrap_around)
+{
+    struct chippy *machine = chippy_create();
+
+    // A full stack wraps around instead of overflowing.
+    machine->sp = 16;
+
+    chippy_insert_opcode(machine, 0x2300, 0x200);
+    chippy_insert_opcode(machine, 0x00EE, 0x300);
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(machine->stack[0], 0x202);
+    ck_assert_int_eq(machine->sp, 17);
+
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(machine->pc, 0x202);
+    ck_assert_int_eq(machine->sp, 16);
+
+    // So does memory, at the end of the address space.
+    machine->I = 0xFFFF;
+    machine->V[0] = 1;
+    machine->V[1] = 2;
+    machine->V[2] = 123;
+
+    chippy_insert_opcode(machine, 0xF155, 0x202);
+    chippy_insert_opcode(machine, 0xF233, 0x204);
+    chippy_insert_opcode(machine, 0xF165, 0x206);
+    chippy_run_cycles(machine, 2);
+
+    ck_assert_int_eq(machine->ram[0xFFFF], 1);
+    ck_assert_int_eq(machine->ram[0x0000], 2);
+    ck_assert_int_eq(machine->ram[0x0001], 3);
+
+    chippy_run_cycles(machine, 1);
+
+    ck_assert_int_eq(machine->V[0], 1);
+    ck_assert_int_eq(machine->V[1], 2);
+}
+END_TEST
+
+START_TEST(test_reset)
+{
+    struct chippy *machine = chippy_create();
+
+    chippy_insert_opcode(machine, 0x6001, 0x200);
+    chippy_insert_opcode(machine, 0x1202, 0x202);
+    chippy_run_cycles(machine, 10);
+
+    struct chippy_jit *jit = machine->jit;
+
+    // The JIT state is kept, but what it translated from the old program is
+    // not run again.
+    chippy_reset(machine);
+    machine->engine = engine;
+
+    ck_assert_ptr_eq(machine->jit, jit);
+    ck_assert_int_eq(machine->V[0], 0);
+
+    chippy_insert_opcode(machine, 0x6002, 0x200);
+    chippy_insert_opcode(machine, 0x1202, 0x202);
+    chippy_run_cycles(machine, 10);
+
+    ck_assert_int_eq(machine->V[0], 2);
+    ck_assert_int_eq(machine->pc, 0x202);
+}
+END_TEST
+
+static void add_opcode_tests(TCase *chain) {
     tcase_add_test(chain, test_cls);
     tcase_add_test(chain, test_ret);
     tcase_add_test(chain, test_jp);
@@ -370,6 +1056,46 @@ Suite *create_opcodes_suite(void) {
     tcase_add_test(chain, test_sne_xy);
     tcase_add_test(chain, test_ld_i);
     tcase_add_test(chain, test_jp_nnn);
+    tcase_add_test(chain, test_rnd);
+    tcase_add_test(chain, test_drw);
+    tcase_add_test(chain, test_gfx_dirty);
+    tcase_add_test(chain, test_skp_sknp);
+    tcase_add_test(chain, test_timers);
+    tcase_add_test(chain, test_add_i);
+    tcase_add_test(chain, test_ld_f);
+    tcase_add_test(chain, test_ld_b);
+    tcase_add_test(chain, test_ld_mem_x);
+    tcase_add_test(chain, test_ld_x_mem);
+    tcase_add_test(chain, test_ld_x_k);
+    tcase_add_test(chain, test_hires);
+    tcase_add_test(chain, test_scroll);
+    tcase_add_test(chain, test_plane);
+    tcase_add_test(chain, test_ld_i_long);
+    tcase_add_test(chain, test_save_load_xy);
+    tcase_add_test(chain, test_flags);
+    tcase_add_test(chain, test_ld_hf);
+    tcase_add_test(chain, test_audio);
+    tcase_add_test(chain, test_exit);
+    tcase_add_test(chain, test_self_modifying_code);
+    tcase_add_test(chain, test_run_cycles);
+    tcase_add_test(chain, test_idle_loop);
+    tcase_add_test(chain, test_wrap_around);
+    tcase_add_test(chain, test_reset);
+}
+
+Suite *create_opcodes_suite(void) {
+    Suite *suite = suite_create("Opcodes");
+    TCase *interpreter = tcase_create("interpreter");
+    TCase *jit = tcase_create("jit");
+
+    tcase_add_checked_fixture(interpreter, use_interpreter, destroy_machines);
+    tcase_add_checked_fixture(jit, use_jit, destroy_machines);
+
+    add_opcode_tests(interpreter);
+    add_opcode_tests(jit);
+
+    suite_add_tcase(suite, interpreter);
+    suite_add_tcase(suite, jit);
 
     return suite;
 }
@@ -0,0 +1,147 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include <check.h>
+#include <libchippy/chippy.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+
+/**
+ * Calls the subroutine at 0x210 three times, which calls the one at 0x216,
+ * and then stops in a loop at 0x20A. The first 30 cycles spend 18 cycles in
+ * the main code, 6 in the subroutine at 0x210 and 6 in the one at 0x216.
+ */
+static const uint16_t program[][2] = {
+    { 0x200, 0x6003 }, { 0x202, 0x2210 }, { 0x204, 0x70FF }, { 0x206, 0x3000 },
+    { 0x208, 0x1202 }, { 0x20A, 0x120A }, { 0x210, 0x2216 }, { 0x212, 0x00EE },
+    { 0x216, 0x7101 }, { 0x218, 0x00EE }
+};
+
+static struct chippy *create_machine(void) {
+    struct chippy *machine = malloc(sizeof(struct chippy));
+
+    chippy_init(machine);
+
+    load_program(machine, program, PROGRAM_SIZE(program));
+
+    return machine;
+}
+
+/**
+ * Reads everything written to a temporary file.
+ */
+static void read_back(FILE *f, char *buffer, size_t size) {
+    rewind(f);
+
+    size_t length = fread(buffer, 1, size - 1, f);
+
+    buffer[length] = '\0';
+
+    fclose(f);
+}
+
+static void assert_profile(struct chippy_profile *profile) {
+    char buffer[1024];
+    FILE *f = tmpfile();
+
+    chippy_profile_write_folded(profile, "test", f);
+    read_back(f, buffer, sizeof(buffer));
+
+    ck_assert_ptr_ne(strstr(buffer, "test;main 18\n"), NULL);
+    ck_assert_ptr_ne(strstr(buffer, "test;main;0x210 6\n"), NULL);
+    ck_assert_ptr_ne(strstr(buffer, "test;main;0x210;0x216 6\n"), NULL);
+
+    f = tmpfile();
+    chippy_profile_write_pcs(profile, f);
+    read_back(f, buffer, sizeof(buffer));
+
+    ck_assert_ptr_ne(strstr(buffer, "0x216\t3\n"), NULL);
+    ck_assert_ptr_ne(strstr(buffer, "0x20A\t6\n"), NULL);
+
+    f = tmpfile();
+    chippy_profile_write_opcodes(profile, f);
+    read_back(f, buffer, sizeof(buffer));
+
+    ck_assert_ptr_ne(strstr(buffer, "CALL\t6\t"), NULL);
+    ck_assert_ptr_ne(strstr(buffer, "RET\t6\t"), NULL);
+    ck_assert_ptr_ne(strstr(buffer, "JP\t8\t"), NULL);
+    ck_assert_ptr_ne(strstr(buffer, "ADD_XKK\t6\t"), NULL);
+}
+
+START_TEST(test_profile_run_cycles)
+{
+    struct chippy_profile *profile = chippy_profile_create();
+    struct chippy *machine = create_machine();
+    struct chippy *reference = create_machine();
+
+    if (profile == NULL) {
+        // The library was built without the profiler.
+        chippy_destroy(reference);
+        chippy_destroy(machine);
+        return;
+    }
+
+    machine->profile = profile;
+
+    chippy_run_cycles(machine, 30);
+    chippy_run_cycles(reference, 30);
+
+    assert_profile(profile);
+
+    // Profiling does not change what the machine does.
+    ck_assert_int_eq(machine->pc, reference->pc);
+    ck_assert_int_eq(machine->cycles, reference->cycles);
+    ck_assert_int_eq(memcmp(machine->V, reference->V, sizeof(machine->V)), 0);
+
+    chippy_profile_destroy(profile);
+    chippy_destroy(reference);
+    chippy_destroy(machine);
+}
+END_TEST
+
+START_TEST(test_profile_step)
+{
+    struct chippy_profile *profile = chippy_profile_create();
+    struct chippy *machine = create_machine();
+
+    if (profile == NULL) {
+        chippy_destroy(machine);
+        return;
+    }
+
+    machine->profile = profile;
+
+    // The position in the call tree is found again from the stack every time
+    // the interpreter is entered.
+    for (int i = 0; i < 30; i++) {
+        chippy_step(machine);
+    }
+
+    assert_profile(profile);
+
+    chippy_profile_destroy(profile);
+    chippy_destroy(machine);
+}
+END_TEST
+
+Suite *create_profile_suite(void) {
+    Suite *suite = suite_create("Profile");
+    TCase *chain = tcase_create("profile tests");
+
+    suite_add_tcase(suite, chain);
+
+    tcase_add_test(chain, test_profile_run_cycles);
+    tcase_add_test(chain, test_profile_step);
+
+    return suite;
+}
@@ -0,0 +1,39 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#ifndef __PROGRAM_H__
+#define __PROGRAM_H__
+
+#include <libchippy/chippy.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The number of instructions in a test program.
+ */
+#define PROGRAM_SIZE(program) (sizeof(program) / sizeof(program[0]))
+
+/**
+ * Writes a test program into the memory of a machine. A program is a list of
+ * { address, opcode } pairs, so that it can leave gaps.
+ *
+ * @param machine The machine to write the program into.
+ * @param program The instructions and their addresses.
+ * @param size    The number of instructions, see PROGRAM_SIZE().
+ */
+static inline void load_program(struct chippy *machine, const uint16_t (*program)[2], size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        machine->ram[program[i][0]] = program[i][1] >> 8;
+        machine->ram[program[i][0] + 1] = program[i][1] & 0xFF;
+    }
+
+    chippy_invalidate(machine, PROGRAM_START, RAM_SIZE - PROGRAM_START);
+}
+
+#endif
@@ -0,0 +1,221 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include <check.h>
+#include <libchippy/chippy.h>
+#include <libchippy/rewind.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+
+#define FRAMES 300
+#define IPF 11
+
+/**
+ * A program that draws random sprites at random positions, and stores the
+ * BCD of a counter in RAM every pass.
+ */
+static const uint16_t program[][2] = {
+    { 0x200, 0xC03F }, { 0x202, 0xC11F }, { 0x204, 0xC207 }, { 0x206, 0xF229 },
+    { 0x208, 0xD015 }, { 0x20A, 0x7301 }, { 0x20C, 0xA400 }, { 0x20E, 0xF333 },
+    { 0x210, 0xF315 }, { 0x212, 0x1200 }
+};
+
+static struct chippy *create_machine(void) {
+    struct chippy *machine = malloc(sizeof(struct chippy));
+
+    chippy_init(machine);
+    chippy_seed(machine, 7);
+
+    load_program(machine, program, PROGRAM_SIZE(program));
+
+    return machine;
+}
+
+static void assert_same(struct chippy *machine, struct chippy *reference) {
+    ck_assert_int_eq(machine->pc, reference->pc);
+    ck_assert_int_eq(machine->I, reference->I);
+    ck_assert_int_eq(machine->cycles, reference->cycles);
+    ck_assert_int_eq(machine->rng == reference->rng, 1);
+    ck_assert_int_eq(memcmp(machine->V, reference->V, sizeof(machine->V)), 0);
+    ck_assert_int_eq(memcmp(machine->gfx, reference->gfx, sizeof(machine->gfx)), 0);
+    ck_assert_int_eq(memcmp(machine->ram, reference->ram, sizeof(machine->ram)), 0);
+}
+
+/**
+ * Runs a fresh copy of the program for the given number of frames.
+ */
+static void assert_frame(struct chippy *machine, int frame) {
+    struct chippy *reference = create_machine();
+
+    chippy_run_cycles(reference, frame * IPF);
+    assert_same(machine, reference);
+
+    chippy_destroy(reference);
+}
+
+static struct chippy_rewind *create_rewind(size_t capacity) {
+    struct chippy_rewind *rewind = malloc(sizeof(struct chippy_rewind));
+
+    ck_assert_int_eq(chippy_rewind_init(rewind, capacity), 0);
+
+    return rewind;
+}
+
+/**
+ * Pushes the state of every frame up to and including the given frame.
+ */
+static void push_frames(struct chippy_rewind *rewind, struct chippy *machine, int first, int last) {
+    for (int frame = first; frame <= last; frame++) {
+        if (frame != first) {
+            chippy_run_cycles(machine, IPF);
+        }
+
+        chippy_rewind_push(rewind, machine);
+    }
+}
+
+START_TEST(test_rewind)
+{
+    struct chippy_rewind *rewind = create_rewind(DEFAULT_REWIND_CAPACITY);
+    struct chippy *machine = create_machine();
+
+    push_frames(rewind, machine, 0, FRAMES);
+
+    ck_assert_int_eq(rewind->frames, FRAMES);
+
+    // Every delta is a small fraction of the state.
+    ck_assert_int_lt(rewind->used, FRAMES * 64);
+
+    for (int frame = FRAMES - 1; frame >= 0; frame--) {
+        ck_assert_int_eq(chippy_rewind_pop(rewind, machine), 0);
+        assert_frame(machine, frame);
+    }
+
+    ck_assert_int_eq(chippy_rewind_pop(rewind, machine), 1);
+    assert_frame(machine, 0);
+
+    chippy_rewind_destroy(rewind);
+    chippy_destroy(machine);
+}
+END_TEST
+
+START_TEST(test_rewind_resume)
+{
+    struct chippy_rewind *rewind = create_rewind(DEFAULT_REWIND_CAPACITY);
+    struct chippy *machine = create_machine();
+
+    push_frames(rewind, machine, 0, 100);
+
+    for (int i = 0; i < 50; i++) {
+        chippy_rewind_pop(rewind, machine);
+    }
+
+    assert_frame(machine, 50);
+
+    // The program is deterministic, so running on from frame 50 repeats the
+    // frames that were dropped.
+    chippy_run_cycles(machine, IPF);
+    push_frames(rewind, machine, 51, 70);
+
+    for (int frame = 69; frame >= 0; frame--) {
+        ck_assert_int_eq(chippy_rewind_pop(rewind, machine), 0);
+        assert_frame(machine, frame);
+    }
+
+    chippy_rewind_destroy(rewind);
+    chippy_destroy(machine);
+}
+END_TEST
+
+START_TEST(test_rewind_capacity)
+{
+    struct chippy_rewind *rewind = create_rewind(1024);
+    struct chippy *machine = create_machine();
+
+    push_frames(rewind, machine, 0, FRAMES);
+
+    size_t frames = rewind->frames;
+
+    // The oldest frames were dropped to make room for the newest.
+    ck_assert_int_lt(frames, FRAMES);
+    ck_assert_int_gt(frames, 0);
+    ck_assert_int_le(rewind->used, 1024);
+
+    for (size_t i = 0; i < frames; i++) {
+        ck_assert_int_eq(chippy_rewind_pop(rewind, machine), 0);
+    }
+
+    ck_assert_int_eq(chippy_rewind_pop(rewind, machine), 1);
+    assert_frame(machine, FRAMES - frames);
+
+    chippy_rewind_destroy(rewind);
+    chippy_destroy(machine);
+}
+END_TEST
+
+/**
+ * Flips every other byte of RAM below the given address.
+ */
+static void flip_ram(struct chippy *machine, uint32_t end) {
+    for (uint32_t address = 0; address < end; address += 2) {
+        machine->ram[address] ^= 0xFF;
+    }
+
+    chippy_invalidate(machine, 0, end);
+}
+
+START_TEST(test_rewind_worst_case)
+{
+    struct chippy_rewind *rewind = create_rewind(DEFAULT_REWIND_CAPACITY);
+    struct chippy *machine = create_machine();
+    struct chippy *reference = create_machine();
+
+    // Alternating changes are the largest delta, half again the size of the
+    // changed range. This one still fits in a delta.
+    chippy_rewind_push(rewind, machine);
+    flip_ram(machine, 0xA000);
+    chippy_rewind_push(rewind, machine);
+
+    ck_assert_int_eq(rewind->frames, 1);
+    ck_assert_int_eq(chippy_rewind_pop(rewind, machine), 0);
+    assert_same(machine, reference);
+
+    // This one does not, so the history starts over.
+    flip_ram(machine, RAM_SIZE);
+    chippy_rewind_push(rewind, machine);
+
+    ck_assert_int_eq(rewind->frames, 0);
+
+    flip_ram(reference, RAM_SIZE);
+
+    ck_assert_int_eq(chippy_rewind_pop(rewind, machine), 1);
+    assert_same(machine, reference);
+
+    chippy_rewind_destroy(rewind);
+    chippy_destroy(reference);
+    chippy_destroy(machine);
+}
+END_TEST
+
+Suite *create_rewind_suite(void) {
+    Suite *suite = suite_create("Rewind");
+    TCase *chain = tcase_create("rewind tests");
+
+    suite_add_tcase(suite, chain);
+
+    tcase_add_test(chain, test_rewind);
+    tcase_add_test(chain, test_rewind_resume);
+    tcase_add_test(chain, test_rewind_capacity);
+    tcase_add_test(chain, test_rewind_worst_case);
+
+    return suite;
+}
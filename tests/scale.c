@@ -0,0 +1,306 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include <check.h>
+#include <chippy/scale.h>
+#include <stdint.h>
+#include <string.h>
+
+#define W SCREEN_W
+#define H SCREEN_H
+
+#define BLACK UINT32_C(0x000000FF)
+#define WHITE UINT32_C(0xFFFFFFFF)
+
+static uint32_t screen[H][W];
+static uint32_t target[SCALE_MAX_FACTOR * H][SCALE_MAX_FACTOR * W];
+static uint32_t expected[SCALE_MAX_FACTOR * H][SCALE_MAX_FACTOR * W];
+
+/**
+ * Copies the given rows of the screen into the source image.
+ */
+static void upload(int first, int last) {
+    for (int y = first; y < last; y++) {
+        memcpy(scale_source_row(y), screen[y], sizeof(screen[y]));
+    }
+}
+
+/**
+ * Filters the given rows of the screen into the target, and checks that the
+ * changed rows are within the target.
+ */
+static void render(enum scale_filter filter, int first, int last, int target_width, int target_height) {
+    int target_first;
+    int target_last;
+
+    upload(first, last);
+    scale_prepare(filter, W, H, first, last, target_height, &target_first, &target_last);
+
+    ck_assert(target_first >= 0);
+    ck_assert_int_le(target_last, target_height);
+
+    scale_write(target[target_first], sizeof(target[0]), target_width);
+}
+
+/**
+ * Returns the pixel of the screen at (x, y), with the edge pixels repeated
+ * beyond the edges.
+ */
+static uint32_t at(int x, int y) {
+    x = x < 0 ? 0 : x >= W ? W - 1 : x;
+    y = y < 0 ? 0 : y >= H ? H - 1 : y;
+
+    return screen[y][x];
+}
+
+/**
+ * Scale2x of the screen, one pixel at a time.
+ */
+static void reference_scale2x(void) {
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            uint32_t a = at(x, y - 1), b = at(x + 1, y), c = at(x - 1, y), d = at(x, y + 1), p = at(x, y);
+
+            expected[2 * y][2 * x] = c == a && c != d && a != b ? a : p;
+            expected[2 * y][2 * x + 1] = a == b && a != c && b != d ? b : p;
+            expected[2 * y + 1][2 * x] = d == c && d != b && c != a ? c : p;
+            expected[2 * y + 1][2 * x + 1] = b == d && b != a && d != c ? d : p;
+        }
+    }
+}
+
+/**
+ * Scale3x of the screen, one pixel at a time.
+ */
+static void reference_scale3x(void) {
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            uint32_t a = at(x - 1, y - 1), b = at(x, y - 1), c = at(x + 1, y - 1);
+            uint32_t d = at(x - 1, y), e = at(x, y), f = at(x + 1, y);
+            uint32_t g = at(x - 1, y + 1), h = at(x, y + 1), i = at(x + 1, y + 1);
+            int db = d == b && b != f && d != h;
+            int bf = b == f && b != d && f != h;
+            int dh = d == h && d != b && h != f;
+            int hf = h == f && d != h && b != f;
+            uint32_t *row0 = &expected[3 * y][3 * x];
+            uint32_t *row1 = &expected[3 * y + 1][3 * x];
+            uint32_t *row2 = &expected[3 * y + 2][3 * x];
+
+            row0[0] = db ? d : e;
+            row0[1] = (db && e != c) || (bf && e != a) ? b : e;
+            row0[2] = bf ? f : e;
+            row1[0] = (db && e != g) || (dh && e != a) ? d : e;
+            row1[1] = e;
+            row1[2] = (bf && e != i) || (hf && e != c) ? f : e;
+            row2[0] = dh ? d : e;
+            row2[1] = (dh && e != i) || (hf && e != g) ? h : e;
+            row2[2] = hf ? f : e;
+        }
+    }
+}
+
+/**
+ * Fills the screen with random pixels, and draws a diagonal line and pixels in
+ * the corners, where the kernels read the edge padding.
+ */
+static void draw_pattern(void) {
+    uint32_t state = 12345;
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            state = state * 1103515245 + 12345;
+            screen[y][x] = (state >> 16) % 4 == 0 ? WHITE : BLACK;
+        }
+    }
+
+    for (int i = 0; i < H; i++) {
+        screen[i][i] = WHITE;
+    }
+
+    screen[0][0] = WHITE;
+    screen[0][W - 1] = WHITE;
+    screen[H - 1][0] = WHITE;
+    screen[H - 1][W - 1] = WHITE;
+}
+
+static void assert_target(int target_width, int target_height) {
+    for (int y = 0; y < target_height; y++) {
+        for (int x = 0; x < target_width; x++) {
+            ck_assert_msg(target[y][x] == expected[y][x], "pixel (%d, %d)", x, y);
+        }
+    }
+}
+
+START_TEST(test_scale_nearest)
+{
+    draw_pattern();
+
+    // A whole multiple, and a width that is not.
+    int widths[] = { 3 * W, 3 * W + 13 };
+
+    for (int i = 0; i < 2; i++) {
+        render(SCALE_NEAREST, 0, H, widths[i], 2 * H);
+
+        for (int y = 0; y < 2 * H; y++) {
+            for (int x = 0; x < widths[i]; x++) {
+                expected[y][x] = screen[y / 2][x * W / widths[i]];
+            }
+        }
+
+        assert_target(widths[i], 2 * H);
+    }
+}
+END_TEST
+
+START_TEST(test_scale_2x)
+{
+    draw_pattern();
+
+    // A staircase is rounded off: below the pixel at (11, 10) between its
+    // white neighbours to the left and below, a quarter turns white.
+    for (int y = 8; y < 14; y++) {
+        for (int x = 8; x < 14; x++) {
+            screen[y][x] = BLACK;
+        }
+    }
+
+    screen[10][10] = WHITE;
+    screen[11][11] = WHITE;
+
+    render(SCALE_2X, 0, H, 2 * W, 2 * H);
+
+    ck_assert(target[21][22] == WHITE);
+    ck_assert(target[20][22] == BLACK);
+    ck_assert(target[20][23] == BLACK);
+    ck_assert(target[21][23] == BLACK);
+
+    reference_scale2x();
+    assert_target(2 * W, 2 * H);
+}
+END_TEST
+
+START_TEST(test_scale_3x)
+{
+    draw_pattern();
+    render(SCALE_3X, 0, H, 3 * W, 3 * H);
+
+    reference_scale3x();
+    assert_target(3 * W, 3 * H);
+}
+END_TEST
+
+START_TEST(test_scale_4x)
+{
+    draw_pattern();
+    render(SCALE_4X, 0, H, 4 * W, 4 * H);
+
+    // Scale2x of Scale2x, which the reference computes in two passes through
+    // the screen.
+    static uint32_t doubled[2 * H][2 * W];
+
+    reference_scale2x();
+
+    for (int y = 0; y < 2 * H; y++) {
+        memcpy(doubled[y], expected[y], sizeof(doubled[y]));
+    }
+
+    for (int y = 0; y < 2 * H; y++) {
+        for (int x = 0; x < 2 * W; x++) {
+            int up = y > 0 ? y - 1 : 0, down = y < 2 * H - 1 ? y + 1 : y;
+            int left = x > 0 ? x - 1 : 0, right = x < 2 * W - 1 ? x + 1 : x;
+            uint32_t a = doubled[up][x], b = doubled[y][right], c = doubled[y][left], d = doubled[down][x], p = doubled[y][x];
+
+            expected[2 * y][2 * x] = c == a && c != d && a != b ? a : p;
+            expected[2 * y][2 * x + 1] = a == b && a != c && b != d ? b : p;
+            expected[2 * y + 1][2 * x] = d == c && d != b && c != a ? c : p;
+            expected[2 * y + 1][2 * x + 1] = b == d && b != a && d != c ? d : p;
+        }
+    }
+
+    assert_target(4 * W, 4 * H);
+}
+END_TEST
+
+START_TEST(test_scale_crt)
+{
+    draw_pattern();
+    render(SCALE_CRT, 0, H, 3 * W, 3 * H);
+
+    // The last of every three rows is half as bright, with the same alpha.
+    for (int y = 0; y < 3 * H; y++) {
+        for (int x = 0; x < 3 * W; x++) {
+            uint32_t pixel = screen[y / 3][x / 3];
+
+            expected[y][x] = y % 3 == 2 ? ((pixel >> 1) & 0x7F7F7F00) | (pixel & 0xFF) : pixel;
+        }
+    }
+
+    assert_target(3 * W, 3 * H);
+}
+END_TEST
+
+START_TEST(test_scale_partial)
+{
+    draw_pattern();
+    render(SCALE_3X, 0, H, 3 * W, 3 * H);
+
+    // Changing a single row filters the rows next to it again as well, so
+    // that a band that excludes them still matches a full filter.
+    for (int x = 0; x < W; x++) {
+        screen[20][x] = x % 3 == 0 ? WHITE : BLACK;
+    }
+
+    memset(target, 0, sizeof(target));
+
+    int target_first;
+    int target_last;
+
+    upload(20, 21);
+    scale_prepare(SCALE_3X, W, H, 20, 21, 3 * H, &target_first, &target_last);
+
+    ck_assert_int_eq(target_first, 3 * 19);
+    ck_assert_int_eq(target_last, 3 * 22);
+
+    scale_write(target[target_first], sizeof(target[0]), 3 * W);
+    reference_scale3x();
+
+    for (int y = 0; y < 3 * H; y++) {
+        for (int x = 0; x < 3 * W; x++) {
+            uint32_t want = y >= target_first && y < target_last ? expected[y][x] : 0;
+
+            ck_assert_msg(target[y][x] == want, "pixel (%d, %d)", x, y);
+        }
+    }
+
+    // At the bottom edge, the band stops at the last row.
+    screen[H - 1][5] ^= WHITE ^ BLACK;
+
+    upload(H - 1, H);
+    scale_prepare(SCALE_2X, W, H, H - 1, H, 2 * H, &target_first, &target_last);
+
+    ck_assert_int_eq(target_first, 2 * (H - 2));
+    ck_assert_int_eq(target_last, 2 * H);
+}
+END_TEST
+
+Suite *create_scale_suite(void) {
+    Suite *suite = suite_create("Scale");
+    TCase *chain = tcase_create("scale tests");
+
+    suite_add_tcase(suite, chain);
+
+    tcase_add_test(chain, test_scale_nearest);
+    tcase_add_test(chain, test_scale_2x);
+    tcase_add_test(chain, test_scale_3x);
+    tcase_add_test(chain, test_scale_4x);
+    tcase_add_test(chain, test_scale_crt);
+    tcase_add_test(chain, test_scale_partial);
+
+    return suite;
+}
@@ -0,0 +1,155 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#include <check.h>
+#include <libchippy/chippy.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+
+/**
+ * A program that executes the NOP at 0x206 once, and then overwrites it with
+ * ADD V2, 0x01. It keeps writing to the page at 0x300 after that.
+ */
+static const uint16_t program[][2] = {
+    { 0x200, 0x6072 }, { 0x202, 0x6101 }, { 0x204, 0xA206 }, { 0x206, 0x0000 },
+    { 0x208, 0x3301 }, { 0x20A, 0xF155 }, { 0x20C, 0x6301 }, { 0x20E, 0xA380 },
+    { 0x210, 0xF233 }, { 0x212, 0xC4FF }, { 0x214, 0xD015 }, { 0x216, 0xF415 },
+    { 0x218, 0x1206 }
+};
+
+static struct chippy *create_machine(enum chippy_engine engine) {
+    struct chippy *machine = malloc(sizeof(struct chippy));
+
+    chippy_init(machine);
+    chippy_seed(machine, 42);
+    machine->engine = engine;
+
+    load_program(machine, program, PROGRAM_SIZE(program));
+
+    return machine;
+}
+
+static void assert_same(struct chippy *machine, struct chippy *reference) {
+    ck_assert_int_eq(machine->pc, reference->pc);
+    ck_assert_int_eq(machine->I, reference->I);
+    ck_assert_int_eq(machine->sp, reference->sp);
+    ck_assert_int_eq(machine->cycles, reference->cycles);
+    ck_assert_int_eq(machine->rng == reference->rng, 1);
+    ck_assert_int_eq(chippy_get_delay_timer(machine), chippy_get_delay_timer(reference));
+    ck_assert_int_eq(memcmp(machine->V, reference->V, sizeof(machine->V)), 0);
+    ck_assert_int_eq(memcmp(machine->stack, reference->stack, sizeof(machine->stack)), 0);
+    ck_assert_int_eq(memcmp(machine->gfx, reference->gfx, sizeof(machine->gfx)), 0);
+    ck_assert_int_eq(memcmp(machine->ram, reference->ram, sizeof(machine->ram)), 0);
+}
+
+static void restore_repeatedly(enum chippy_engine engine) {
+    struct chippy *machine = create_machine(engine);
+    struct chippy *reference = create_machine(engine);
+    struct chippy_snapshot *snapshot = malloc(sizeof(struct chippy_snapshot));
+
+    // The snapshot is taken before the program modifies itself, so restoring
+    // it has to bring back the NOP at 0x206.
+    chippy_snapshot(machine, snapshot);
+
+    chippy_run_cycles(reference, 500);
+
+    for (int i = 0; i < 3; i++) {
+        chippy_run_cycles(machine, 500);
+        assert_same(machine, reference);
+
+        chippy_restore(machine, snapshot);
+        ck_assert_int_eq(machine->cycles, 0);
+        ck_assert_int_eq(machine->ram[0x206], 0x00);
+    }
+
+    free(snapshot);
+    chippy_destroy(reference);
+    chippy_destroy(machine);
+}
+
+START_TEST(test_restore_interpreter)
+{
+    restore_repeatedly(CHIPPY_ENGINE_INTERPRETER);
+}
+END_TEST
+
+START_TEST(test_restore_jit)
+{
+    restore_repeatedly(CHIPPY_ENGINE_JIT);
+}
+END_TEST
+
+START_TEST(test_restore_shared)
+{
+    struct chippy *first = create_machine(CHIPPY_ENGINE_INTERPRETER);
+    struct chippy *second = create_machine(CHIPPY_ENGINE_INTERPRETER);
+    struct chippy *reference = create_machine(CHIPPY_ENGINE_INTERPRETER);
+    struct chippy_snapshot *snapshot = malloc(sizeof(struct chippy_snapshot));
+
+    chippy_run_cycles(first, 10);
+    chippy_snapshot(first, snapshot);
+
+    // The second machine starts from a different state, so all of its RAM has
+    // to be copied.
+    chippy_restore(second, snapshot);
+    assert_same(second, first);
+
+    // Taking the snapshot again makes the dirty pages of the second machine
+    // meaningless, since they refer to the old contents of the snapshot.
+    chippy_run_cycles(second, 100);
+    chippy_run_cycles(first, 200);
+    chippy_snapshot(first, snapshot);
+    chippy_restore(second, snapshot);
+    assert_same(second, first);
+
+    chippy_run_cycles(reference, 210);
+    assert_same(second, reference);
+
+    free(snapshot);
+    chippy_destroy(reference);
+    chippy_destroy(second);
+    chippy_destroy(first);
+}
+END_TEST
+
+START_TEST(test_restore_direct_write)
+{
+    struct chippy *machine = create_machine(CHIPPY_ENGINE_INTERPRETER);
+    struct chippy_snapshot *snapshot = malloc(sizeof(struct chippy_snapshot));
+
+    chippy_snapshot(machine, snapshot);
+
+    // Writes made by the host are only tracked when they are reported.
+    machine->ram[0xF00] = 0xAB;
+    chippy_invalidate(machine, 0xF00, 1);
+
+    chippy_restore(machine, snapshot);
+    ck_assert_int_eq(machine->ram[0xF00], 0x00);
+
+    free(snapshot);
+    chippy_destroy(machine);
+}
+END_TEST
+
+Suite *create_snapshot_suite(void) {
+    Suite *suite = suite_create("Snapshot");
+    TCase *chain = tcase_create("snapshot tests");
+
+    suite_add_tcase(suite, chain);
+
+    tcase_add_test(chain, test_restore_interpreter);
+    tcase_add_test(chain, test_restore_jit);
+    tcase_add_test(chain, test_restore_shared);
+    tcase_add_test(chain, test_restore_direct_write);
+
+    return suite;
+}
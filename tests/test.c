@@ -10,10 +10,31 @@
 #include <check.h>
 
 extern Suite *create_opcodes_suite();
+extern Suite *create_capture_suite();
+extern Suite *create_drain_suite();
+extern Suite *create_input_suite();
+extern Suite *create_library_suite();
+extern Suite *create_lockstep_suite();
+extern Suite *create_profile_suite();
+extern Suite *create_rewind_suite();
+extern Suite *create_scale_suite();
+extern Suite *create_snapshot_suite();
+extern Suite *create_trace_suite();
 
 int main(void) {
     SRunner *runner = srunner_create(create_opcodes_suite());
 
+    srunner_add_suite(runner, create_capture_suite());
+    srunner_add_suite(runner, create_drain_suite());
+    srunner_add_suite(runner, create_input_suite());
+    srunner_add_suite(runner, create_library_suite());
+    srunner_add_suite(runner, create_lockstep_suite());
+    srunner_add_suite(runner, create_profile_suite());
+    srunner_add_suite(runner, create_rewind_suite());
+    srunner_add_suite(runner, create_scale_suite());
+    srunner_add_suite(runner, create_snapshot_suite());
+    srunner_add_suite(runner, create_trace_suite());
+
     srunner_run_all(runner, CK_NORMAL);
 
     int failed = srunner_ntests_failed(runner);
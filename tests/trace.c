@@ -0,0 +1,205 @@
+/**
+ * This file is part of Chippy.
+ *
+ * (c) Jacob van Eijk <jacob.vaneijk@gmail.com>
+ *
+ * For the full copyright and license information, please view the LICENSE file
+ * that was distributed with this source code.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <check.h>
+#include <libchippy/chippy.h>
+#include <libchippy/trace.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "program.h"
+
+/**
+ * Calls the subroutine at 0x210 three times, which calls the one at 0x216,
+ * and then stops in a loop at 0x20A after 24 cycles.
+ */
+static const uint16_t program[][2] = {
+    { 0x200, 0x6003 }, { 0x202, 0x2210 }, { 0x204, 0x70FF }, { 0x206, 0x3000 },
+    { 0x208, 0x1202 }, { 0x20A, 0x120A }, { 0x210, 0x2216 }, { 0x212, 0x00EE },
+    { 0x216, 0x7101 }, { 0x218, 0x00EE }
+};
+
+static struct chippy *create_machine(void) {
+    struct chippy *machine = malloc(sizeof(struct chippy));
+
+    chippy_init(machine);
+
+    load_program(machine, program, PROGRAM_SIZE(program));
+
+    return machine;
+}
+
+/**
+ * Opens a trace in a new temporary file.
+ */
+static struct chippy_trace *open_trace(char *path) {
+    strcpy(path, "/tmp/chippy-trace-XXXXXX");
+
+    int fd = mkstemp(path);
+
+    ck_assert_int_ne(fd, -1);
+    close(fd);
+
+    struct chippy_trace *trace = chippy_trace_open(path);
+
+    ck_assert_ptr_ne(trace, NULL);
+
+    return trace;
+}
+
+/**
+ * Reads a whole trace, and returns its size.
+ */
+static size_t read_trace(const char *path, uint8_t **data) {
+    FILE *f = fopen(path, "rb");
+
+    ck_assert_ptr_ne(f, NULL);
+
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    rewind(f);
+
+    *data = malloc(size);
+    ck_assert_int_eq(fread(*data, 1, size, f), size);
+
+    fclose(f);
+    unlink(path);
+
+    return size;
+}
+
+START_TEST(test_trace_records)
+{
+    struct chippy *machine = create_machine();
+    char path[32];
+    uint8_t *data;
+
+    machine->trace = open_trace(path);
+
+    chippy_run_cycles(machine, 3);
+
+    ck_assert_int_eq(chippy_trace_close(machine->trace), 0);
+
+    size_t size = read_trace(path, &data);
+
+    // The magic, a sync record, then LD V0, 3, CALL 0x210 and CALL 0x216.
+    static const uint8_t records[] = {
+        0x02, 0x60, 0x03, 0x00, 0x03,
+        0x10, 0x22, 0x10, 0x01,
+        0x11, 0x10, 0x02, 0x22, 0x16, 0x02
+    };
+
+    ck_assert_int_eq(size, TRACE_MAGIC_SIZE + TRACE_SYNC_SIZE + sizeof(records));
+    ck_assert_int_eq(memcmp(data, TRACE_MAGIC, TRACE_MAGIC_SIZE), 0);
+    ck_assert_int_eq(data[TRACE_MAGIC_SIZE], TRACE_SYNC);
+    ck_assert_int_eq(data[TRACE_MAGIC_SIZE + 1], 0x00);
+    ck_assert_int_eq(data[TRACE_MAGIC_SIZE + 2], 0x02);
+    ck_assert_int_eq(memcmp(data + TRACE_MAGIC_SIZE + TRACE_SYNC_SIZE, records, sizeof(records)), 0);
+
+    free(data);
+    chippy_destroy(machine);
+}
+END_TEST
+
+START_TEST(test_trace_sync)
+{
+    struct chippy *machine = create_machine();
+    char path[32];
+    uint8_t *data;
+
+    machine->trace = open_trace(path);
+
+    // Runs that continue where the last one stopped need no sync record.
+    for (int i = 0; i < 30; i++) {
+        chippy_step(machine);
+    }
+
+    // A register changed between runs is recorded with a new sync record.
+    machine->V[5] = 0x42;
+    chippy_step(machine);
+
+    ck_assert_int_eq(chippy_trace_close(machine->trace), 0);
+
+    size_t size = read_trace(path, &data);
+
+    // The sync record holds the PC, so the jump that follows it does not.
+    static const uint8_t loop[] = { 0x00, 0x12, 0x0A };
+
+    ck_assert_int_eq(memcmp(data + size - sizeof(loop), loop, sizeof(loop)), 0);
+
+    size_t sync = size - sizeof(loop) - TRACE_SYNC_SIZE;
+
+    ck_assert_int_eq(data[sync], TRACE_SYNC);
+    ck_assert_int_eq(data[sync + 6 + 5], 0x42);
+    ck_assert_int_eq(data[sync + 24], 30);
+
+    free(data);
+    chippy_destroy(machine);
+}
+END_TEST
+
+START_TEST(test_trace_large)
+{
+    struct chippy *small = create_machine();
+    struct chippy *large = create_machine();
+    struct chippy *reference = create_machine();
+    char small_path[32];
+    char large_path[32];
+    uint8_t *data;
+
+    small->trace = open_trace(small_path);
+    large->trace = open_trace(large_path);
+
+    chippy_run_cycles(small, 30);
+    chippy_run_cycles(large, 30);
+    chippy_run_cycles(reference, 30);
+
+    // Several times the ring buffer, so the machine waits for the writer.
+    for (int i = 0; i < 100; i++) {
+        chippy_run_cycles(large, 10000);
+        chippy_run_cycles(reference, 10000);
+    }
+
+    ck_assert_int_eq(chippy_trace_close(small->trace), 0);
+    ck_assert_int_eq(chippy_trace_close(large->trace), 0);
+
+    size_t size = read_trace(small_path, &data);
+    free(data);
+
+    ck_assert_int_eq(read_trace(large_path, &data), size + 5 * 1000000);
+    free(data);
+
+    // Tracing does not change what the machine does.
+    ck_assert_int_eq(large->pc, reference->pc);
+    ck_assert_int_eq(large->cycles, reference->cycles);
+    ck_assert_int_eq(memcmp(large->V, reference->V, sizeof(large->V)), 0);
+
+    chippy_destroy(reference);
+    chippy_destroy(large);
+    chippy_destroy(small);
+}
+END_TEST
+
+Suite *create_trace_suite(void) {
+    Suite *suite = suite_create("Trace");
+    TCase *chain = tcase_create("trace tests");
+
+    suite_add_tcase(suite, chain);
+
+    tcase_add_test(chain, test_trace_records);
+    tcase_add_test(chain, test_trace_sync);
+    tcase_add_test(chain, test_trace_large);
+
+    return suite;
+}